@@ -0,0 +1,73 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+#include <stdint.h>
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+
+    #define EXPORT __declspec(dllexport)
+#else
+    #define _POSIX_C_SOURCE 200809L
+    #include <time.h>
+
+    #define EXPORT __attribute__((visibility("default")))
+#endif
+
+// Spin() keeps the worker thread busy (CPU-bound calls), while Wait() puts
+// it to sleep (I/O-bound calls). Both return the requested duration.
+
+static int64_t GetMonotonicTime(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if (!freq.QuadPart) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+
+    return (int64_t)(now.QuadPart * 1000000 / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+EXPORT int Spin(int us)
+{
+    int64_t end = GetMonotonicTime() + us;
+    while (GetMonotonicTime() < end);
+
+    return us;
+}
+
+EXPORT int Wait(int us)
+{
+#ifdef _WIN32
+    // Sleep() only has millisecond resolution, spin for the remainder
+    Sleep((DWORD)(us / 1000));
+    Spin(us % 1000);
+#else
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+    while (nanosleep(&ts, &ts) < 0);
+#endif
+
+    return us;
+}
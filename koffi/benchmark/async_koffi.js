@@ -0,0 +1,151 @@
+#!/usr/bin/env node
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+const koffi = require('./build/koffi.node');
+const path = require('path');
+const { createHistogram } = require('perf_hooks');
+
+main();
+
+async function main() {
+    let duration = 1000;
+    let config = koffi.config();
+    let concurrency = null;
+
+    // Usage: async_koffi.js [duration_ms] [resident_async_pools] [max_async_calls] [concurrency]
+    if (process.argv.length >= 3)
+        duration = parseArgument(process.argv[2], 1);
+    if (process.argv.length >= 4)
+        config.resident_async_pools = parseArgument(process.argv[3], 0);
+    if (process.argv.length >= 5)
+        config.max_async_calls = parseArgument(process.argv[4], 1);
+    if (process.argv.length >= 6)
+        concurrency = parseArgument(process.argv[5], 1);
+
+    // Settings cannot be changed once a library is loaded
+    config = koffi.config(config);
+    concurrency ??= config.max_async_calls;
+
+    let lib_filename = path.dirname(__filename) + '/build/async' + koffi.extension;
+    let lib = koffi.load(lib_filename);
+
+    const Spin = lib.func('int Spin(int us)');
+    const Wait = lib.func('int Wait(int us)');
+
+    let cases = [
+        { name: 'spin 1 µs', func: Spin, us: 1 },
+        { name: 'spin 10 µs', func: Spin, us: 10 },
+        { name: 'spin 100 µs', func: Spin, us: 100 },
+        { name: 'spin 1 ms', func: Spin, us: 1000 },
+        { name: 'wait 100 µs', func: Wait, us: 100 },
+        { name: 'wait 1 ms', func: Wait, us: 1000 }
+    ];
+    let results = [];
+
+    for (let test of cases) {
+        // Warm up the worker threads and the resident pools
+        await measure(test, concurrency, Math.max(50, duration / 10));
+
+        let result = await measure(test, concurrency, duration);
+        results.push({ name: test.name, ...result });
+    }
+
+    console.log(JSON.stringify({
+        config: {
+            resident_async_pools: config.resident_async_pools,
+            max_async_calls: config.max_async_calls,
+            async_threads: config.async_threads,
+            concurrency: concurrency
+        },
+        cases: results
+    }));
+}
+
+function parseArgument(str, min) {
+    let value = parseInt(str, 10);
+
+    if (Number.isNaN(value))
+        throw new Error('Not a valid number');
+    if (value < min)
+        throw new Error(`Value must be >= ${min}`);
+
+    return value;
+}
+
+// Keep up to concurrency calls in flight for the given duration, calls that
+// Koffi rejects (max_async_calls) are retried as soon as another one completes.
+// Latency is measured from the first attempt, so retries are included.
+function measure(test, concurrency, duration) {
+    return new Promise((resolve, reject) => {
+        let histogram = createHistogram();
+
+        let start = performance.now();
+        let end = start + duration;
+
+        let calls = 0;
+        let rejected = 0;
+        let running = 0;
+        let waiting = [];
+
+        let issue = (issued) => {
+            try {
+                test.func.async(test.us, (err, res) => {
+                    running--;
+
+                    if (err) {
+                        reject(err);
+                        return;
+                    }
+
+                    histogram.record(Math.max(1, Number(process.hrtime.bigint() - issued)));
+                    calls++;
+
+                    if (waiting.length) {
+                        issue(waiting.shift());
+                    } else if (performance.now() < end) {
+                        issue(process.hrtime.bigint());
+                    }
+
+                    if (!running) {
+                        let time = performance.now() - start;
+
+                        resolve({
+                            calls: calls,
+                            time: time,
+                            rejected: rejected,
+                            p50: histogram.percentile(50),
+                            p99: histogram.percentile(99),
+                            p999: histogram.percentile(99.9),
+                            max: histogram.max
+                        });
+                    }
+                });
+
+                running++;
+            } catch (err) {
+                if (!running) {
+                    reject(err);
+                    return;
+                }
+
+                waiting.push(issued);
+                rejected++;
+            }
+        };
+
+        for (let i = 0; i < concurrency; i++)
+            issue(process.hrtime.bigint());
+    });
+}
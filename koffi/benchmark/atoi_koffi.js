@@ -14,6 +14,7 @@
 // along with this program. If not, see https://www.gnu.org/licenses/.
 
 const koffi = require('./build/koffi.node');
+const perf = require('./perf.js');
 
 const strings = [
     '424242',
@@ -40,6 +41,7 @@ function main() {
 
     const atoi = lib.cdecl('atoi', 'int', ['str']);
 
+    let counters = perf.start();
     let start = performance.now();
 
     for (let i = 0; i < iterations; i++) {
@@ -47,5 +49,7 @@ function main() {
     }
 
     let time = performance.now() - start;
-    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time) }));
+    counters = perf.stop(counters);
+
+    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time), counters: counters }));
 }
@@ -14,6 +14,7 @@
 // along with this program. If not, see https://www.gnu.org/licenses/.
 
 const atoi = require('./build/atoi_napi.node');
+const perf = require('./perf.js');
 
 const strings = [
     '424242',
@@ -36,6 +37,7 @@ function main() {
             throw new Error('Value must be positive');
     }
 
+    let counters = perf.start();
     let start = performance.now();
 
     for (let i = 0; i < iterations; i++) {
@@ -43,5 +45,7 @@ function main() {
     }
 
     let time = performance.now() - start;
-    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time) }));
+    counters = perf.stop(counters);
+
+    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time), counters: counters }));
 }
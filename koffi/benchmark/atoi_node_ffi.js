@@ -16,6 +16,7 @@
 const ref = require('ref-napi');
 const ffi = require('ffi-napi');
 const struct = require('ref-struct-di')(ref);
+const perf = require('./perf.js');
 
 const strings = [
     '424242',
@@ -42,6 +43,7 @@ async function main() {
         atoi: ['int', ['string']]
     });
 
+    let counters = perf.start();
     let start = performance.now();
 
     for (let i = 0; i < iterations; i++) {
@@ -52,5 +54,7 @@ async function main() {
     }
 
     let time = performance.now() - start;
-    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time) }));
+    counters = perf.stop(counters);
+
+    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time), counters: counters }));
 }
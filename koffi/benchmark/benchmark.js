@@ -37,6 +37,10 @@ function benchmark(select) {
         format(run('atoi', 'atoi_napi'), 'ns');
     if (!select.length || select.includes('raylib'))
         format(run('raylib', 'raylib_node_raylib'), 'us');
+    if (!select.length || select.includes('marshal'))
+        formatCases(runCases('marshal_koffi'));
+    if (!select.length || select.includes('async'))
+        formatAsync(runAsync('async_koffi'));
 }
 
 function run(name, ref) {
@@ -76,6 +80,7 @@ function run(name, ref) {
 
         test.iterations = perf.iterations;
         test.time = perf.time;
+        test.counters = perf.counters;
     }
 
     for (let test of tests) {
@@ -93,6 +98,67 @@ function run(name, ref) {
     return tests;
 }
 
+// Suites that run several independent cases in a single process
+function runCases(name) {
+    let filename = path.join(__dirname, name + '.js');
+    let proc = spawnSync(process.execPath, [filename]);
+
+    if (proc.status == null)
+        throw new Error(proc.error);
+    if (proc.status !== 0)
+        throw new Error(proc.stderr);
+
+    let perf = JSON.parse(proc.stdout);
+    return perf.cases;
+}
+
+// Settings cannot change once a library is loaded, so each configuration runs in its own process
+function runAsync(name) {
+    const pools = [0, 2, 8];
+    const limits = [16, 64, 256];
+    const concurrency = 256;
+
+    let filename = path.join(__dirname, name + '.js');
+    let results = [];
+
+    for (let resident of pools) {
+        for (let max of limits) {
+            let args = [filename, '1000', '' + resident, '' + max, '' + concurrency];
+            let proc = spawnSync(process.execPath, args);
+
+            if (proc.status == null)
+                throw new Error(proc.error);
+            if (proc.status !== 0)
+                throw new Error(proc.stderr);
+
+            let perf = JSON.parse(proc.stdout);
+
+            perf.cases.forEach((test, idx) => results.push({ config: perf.config, index: idx, ...test }));
+        }
+    }
+
+    results.sort((result1, result2) => result1.index - result2.index ||
+                                       result1.config.resident_async_pools - result2.config.resident_async_pools ||
+                                       result1.config.max_async_calls - result2.config.max_async_calls);
+
+    return results;
+}
+
+function formatCases(cases) {
+    let len0 = cases.reduce((acc, test) => Math.max(acc, test.name.length), 'Case'.length);
+
+    console.log(`${'Case'.padEnd(len0, ' ')} | Iterations | Time per call`);
+    console.log(`${'-'.padEnd(len0, '-')} | ---------- | -------------`);
+    for (let test of cases) {
+        let time = (test.time * 1000000 / test.iterations).toFixed(0) + ' ns';
+        console.log(`${test.name.padEnd(len0, ' ')} | ${('' + test.iterations).padEnd(10, ' ')} | ${time}`);
+    }
+
+    console.log('');
+
+    formatCounters(cases, 'Case');
+}
+
 function format(tests, unit) {
     let len0 = tests.reduce((acc, test) => Math.max(acc, test.name.length), 0);
 
@@ -107,6 +173,70 @@ function format(tests, unit) {
     }
 
     console.log('');
+
+    formatCounters(tests, 'Benchmark');
+}
+
+function formatAsync(results) {
+    const columns = ['Case', 'Resident pools', 'Max calls', 'Throughput', 'p50', 'p99', 'p99.9', 'Rejected'];
+
+    let rows = results.map(result => [
+        result.name,
+        '' + result.config.resident_async_pools,
+        '' + result.config.max_async_calls,
+        Math.round(result.calls * 1000 / result.time) + '/s',
+        ...[result.p50, result.p99, result.p999].map(ns => format_time(ns / 1000000, 'us')),
+        '' + result.rejected
+    ]);
+    let lengths = columns.map((col, idx) => rows.reduce((acc, row) => Math.max(acc, row[idx].length), col.length));
+
+    console.log(columns.map((col, idx) => col.padEnd(lengths[idx], ' ')).join(' | '));
+    console.log(lengths.map(len => '-'.padEnd(len, '-')).join(' | '));
+    for (let row of rows)
+        console.log(row.map((value, idx) => value.padEnd(lengths[idx], ' ')).join(' | '));
+
+    console.log('');
+}
+
+// Hardware counters are only available on Linux, and only if perf events are allowed
+function formatCounters(tests, title) {
+    const columns = [
+        ['Instructions', c => c.instructions],
+        ['Cycles', c => c.cycles],
+        ['IPC', c => (c.instructions != null && c.cycles) ? c.instructions / c.cycles : null],
+        ['Branch misses', c => c.branch_misses],
+        ['L1D misses', c => c.l1d_misses],
+        ['LLC misses', c => c.llc_misses],
+        ['Context switches', c => c.context_switches]
+    ];
+
+    tests = tests.filter(test => test.counters != null);
+    if (!tests.length)
+        return;
+
+    let rows = tests.map(test => columns.map(col => {
+        let value = col[1](test.counters);
+
+        if (value == null)
+            return '-';
+        if (col[0] == 'IPC')
+            return value.toFixed(2);
+
+        value /= test.iterations;
+        return value.toFixed(value < 10 ? 2 : 0);
+    }));
+
+    let len0 = tests.reduce((acc, test) => Math.max(acc, test.name.length), title.length);
+    let lengths = columns.map((col, idx) => rows.reduce((acc, row) => Math.max(acc, row[idx].length), col[0].length));
+
+    console.log(`${title.padEnd(len0, ' ')} | ` + columns.map((col, idx) => col[0].padEnd(lengths[idx], ' ')).join(' | '));
+    console.log(`${'-'.padEnd(len0, '-')} | ` + lengths.map(len => '-'.padEnd(len, '-')).join(' | '));
+    for (let i = 0; i < tests.length; i++) {
+        let values = rows[i].map((value, idx) => value.padEnd(lengths[idx], ' '));
+        console.log(`${tests[i].name.padEnd(len0, ' ')} | ` + values.join(' | '));
+    }
+
+    console.log('');
 }
 
 function format_time(time, unit) {
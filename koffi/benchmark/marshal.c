@@ -0,0 +1,125 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #define EXPORT __declspec(dllexport)
+#else
+    #define EXPORT __attribute__((visibility("default")))
+#endif
+
+// These functions do as little as possible, so that the measured
+// time is dominated by the conversion of arguments and return values.
+
+typedef struct Small {
+    int32_t a;
+    int32_t b;
+} Small;
+
+typedef struct Large {
+    double values[16];
+    int32_t len;
+} Large;
+
+typedef struct Nested {
+    Small first;
+    struct {
+        float x;
+        float y;
+        float z;
+    } pos;
+    Small second;
+} Nested;
+
+typedef struct Fixed {
+    int32_t values[16];
+} Fixed;
+
+typedef int IntCallback(int x);
+
+EXPORT int32_t PassInt(int32_t x) { return x; }
+EXPORT int64_t PassInt64(int64_t x) { return x; }
+EXPORT float PassFloat(float x) { return x; }
+EXPORT double PassDouble(double x) { return x; }
+EXPORT bool PassBool(bool x) { return x; }
+
+EXPORT int PassStr(const char *str) { return (int)strlen(str); }
+EXPORT int PassStr16(const uint16_t *str)
+{
+    int len = 0;
+    while (str[len]) {
+        len++;
+    }
+    return len;
+}
+EXPORT const char *ReturnStr(void) { return "Hello World!"; }
+
+EXPORT Small PassSmall(Small s) { return s; }
+EXPORT int32_t PassSmallPtr(const Small *s) { return s->a + s->b; }
+EXPORT double PassLarge(Large l) { return l.values[0] + l.len; }
+EXPORT double PassLargePtr(const Large *l) { return l->values[0] + l->len; }
+EXPORT Large ReturnLarge(double x)
+{
+    Large l;
+
+    for (int i = 0; i < 16; i++) {
+        l.values[i] = x;
+    }
+    l.len = 16;
+
+    return l;
+}
+EXPORT Nested PassNested(Nested n) { return n; }
+EXPORT int32_t PassFixed(Fixed f) { return f.values[0] + f.values[15]; }
+
+EXPORT int32_t SumBuffer(const int32_t *values, int len)
+{
+    int32_t sum = 0;
+    for (int i = 0; i < len; i++) {
+        sum += values[i];
+    }
+    return sum;
+}
+EXPORT void FillBuffer(int32_t *out, int len)
+{
+    for (int i = 0; i < len; i++) {
+        out[i] = i;
+    }
+}
+EXPORT void ScaleBuffer(int32_t *values, int len, int factor)
+{
+    for (int i = 0; i < len; i++) {
+        values[i] *= factor;
+    }
+}
+
+EXPORT int CallCallback(IntCallback *cb, int x) { return cb(x); }
+
+EXPORT int SumVariadic(int count, ...)
+{
+    va_list ap;
+    va_start(ap, count);
+
+    int sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += va_arg(ap, int);
+    }
+
+    va_end(ap);
+
+    return sum;
+}
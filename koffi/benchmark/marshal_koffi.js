@@ -0,0 +1,185 @@
+#!/usr/bin/env node
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+const koffi = require('./build/koffi.node');
+const path = require('path');
+const perf = require('./perf.js');
+
+const Small = koffi.struct('Small', {
+    a: 'int32_t',
+    b: 'int32_t'
+});
+
+const Large = koffi.struct('Large', {
+    values: koffi.array('double', 16),
+    len: 'int32_t'
+});
+
+const Nested = koffi.struct('Nested', {
+    first: Small,
+    pos: koffi.struct({
+        x: 'float',
+        y: 'float',
+        z: 'float'
+    }),
+    second: Small
+});
+
+const Fixed = koffi.struct('Fixed', {
+    values: koffi.array('int32_t', 16)
+});
+
+const IntCallback = koffi.callback('int IntCallback(int x)');
+
+let sink = 0;
+
+main();
+
+async function main() {
+    let iterations = 1000000;
+    let select = null;
+
+    if (process.argv.length >= 3) {
+        iterations = parseInt(process.argv[2], 10);
+        if (Number.isNaN(iterations))
+            throw new Error('Not a valid number');
+        if (iterations < 1)
+            throw new Error('Value must be positive');
+    }
+    if (process.argv.length >= 4)
+        select = new RegExp(process.argv[3]);
+
+    let lib_filename = path.dirname(__filename) + '/build/marshal' + koffi.extension;
+    let lib = koffi.load(lib_filename);
+
+    let cases = makeCases(lib);
+    let results = [];
+
+    for (let test of cases) {
+        if (select != null && !test.name.match(select))
+            continue;
+
+        let count = Math.max(1, Math.round(iterations * (test.scale ?? 1)));
+
+        // Warm up JIT and Koffi caches
+        await measure(test, Math.max(1, Math.round(count / 10)));
+        let [time, counters] = await measure(test, count);
+
+        results.push({ name: test.name, iterations: count, time: time, counters: counters });
+    }
+
+    console.log(JSON.stringify({ cases: results }));
+}
+
+async function measure(test, count) {
+    let counters = perf.start();
+    let start = performance.now();
+
+    if (test.run != null) {
+        for (let i = 0; i < count; i++)
+            test.run(i);
+    } else {
+        await test.batch(count);
+    }
+
+    let time = performance.now() - start;
+    counters = perf.stop(counters);
+
+    return [time, counters];
+}
+
+function makeCases(lib) {
+    const PassInt = lib.func('int32_t PassInt(int32_t x)');
+    const PassInt64 = lib.func('int64_t PassInt64(int64_t x)');
+    const PassFloat = lib.func('float PassFloat(float x)');
+    const PassDouble = lib.func('double PassDouble(double x)');
+    const PassBool = lib.func('bool PassBool(bool x)');
+    const PassStr = lib.func('int PassStr(const char *str)');
+    const PassStr16 = lib.func('int PassStr16(const char16_t *str)');
+    const ReturnStr = lib.func('const char *ReturnStr()');
+    const PassSmall = lib.func('Small PassSmall(Small s)');
+    const PassSmallPtr = lib.func('int32_t PassSmallPtr(const Small *s)');
+    const PassLarge = lib.func('double PassLarge(Large l)');
+    const PassLargePtr = lib.func('double PassLargePtr(const Large *l)');
+    const ReturnLarge = lib.func('Large ReturnLarge(double x)');
+    const PassNested = lib.func('Nested PassNested(Nested n)');
+    const PassFixed = lib.func('int32_t PassFixed(Fixed f)');
+    const SumBuffer = lib.func('int32_t SumBuffer(const int32_t *values, int len)');
+    const FillBuffer = lib.func('void FillBuffer(_Out_ int32_t *out, int len)');
+    const ScaleBuffer = lib.func('void ScaleBuffer(_Inout_ int32_t *values, int len, int factor)');
+    const PinnedBuffer = lib.func('void ScaleBuffer(_Pinned_ int32_t *values, int len, int factor)');
+    const CallCallback = lib.func('int CallCallback(IntCallback *cb, int x)');
+    const SumVariadic = lib.func('int SumVariadic(int count, ...)');
+
+    const strings = [8, 64, 1024].map(len => 'x'.repeat(len));
+    const small = { a: 1, b: 2 };
+    const large = { values: Array(16).fill(1.5), len: 16 };
+    const nested = { first: { a: 1, b: 2 }, pos: { x: 1, y: 2, z: 3 }, second: { a: 3, b: 4 } };
+    const fixed = { values: Int32Array.from(Array(16).keys()) };
+    const buffer = new Int32Array(64);
+
+    const transient = x => x;
+    const registered = koffi.register(x => x, koffi.pointer(IntCallback));
+
+    let cases = [
+        { name: 'int', run: i => { sink += PassInt(i); } },
+        { name: 'int64 (number)', run: i => { sink += PassInt64(i); } },
+        { name: 'int64 (BigInt)', run: i => { sink += Number(PassInt64(BigInt(i))); } },
+        { name: 'float', run: i => { sink += PassFloat(i); } },
+        { name: 'double', run: i => { sink += PassDouble(i); } },
+        { name: 'bool', run: i => { sink += PassBool(!!(i & 1)); } },
+
+        ...strings.map(str => ({ name: `str (${str.length})`, run: i => { sink += PassStr(str); } })),
+        ...strings.map(str => ({ name: `str16 (${str.length})`, run: i => { sink += PassStr16(str); } })),
+        { name: 'str (return)', run: i => { sink += ReturnStr().length; } },
+
+        { name: 'small struct', run: i => { sink += PassSmall(small).a; } },
+        { name: 'small struct (pointer)', run: i => { sink += PassSmallPtr(small); } },
+        { name: 'large struct', run: i => { sink += PassLarge(large); } },
+        { name: 'large struct (pointer)', run: i => { sink += PassLargePtr(large); } },
+        { name: 'large struct (return)', run: i => { sink += ReturnLarge(i).len; } },
+        { name: 'nested struct', run: i => { sink += PassNested(nested).second.b; } },
+        { name: 'fixed array', run: i => { sink += PassFixed(fixed); } },
+
+        { name: 'TypedArray (in)', run: i => { sink += SumBuffer(buffer, buffer.length); } },
+        { name: 'TypedArray (out)', run: i => { FillBuffer(buffer, buffer.length); } },
+        { name: 'TypedArray (inout)', run: i => { ScaleBuffer(buffer, buffer.length, 1); } },
+        { name: 'TypedArray (pinned)', run: i => { PinnedBuffer(buffer, buffer.length, 1); } },
+
+        { name: 'callback (transient)', scale: 0.5, run: i => { sink += CallCallback(transient, i); } },
+        { name: 'callback (registered)', scale: 0.5, run: i => { sink += CallCallback(registered, i); } },
+
+        { name: 'variadic', run: i => { sink += SumVariadic(2, 'int', i, 'int', 1); } },
+
+        { name: 'async', scale: 0.02, batch: count => runAsync(PassInt, count) }
+    ];
+
+    return cases;
+}
+
+// Keep a bounded number of calls in flight, to stay below max_async_calls
+async function runAsync(func, count) {
+    const parallel = 32;
+
+    let next = 0;
+    let workers = Array.from({ length: Math.min(parallel, count) }, async () => {
+        while (next < count) {
+            let i = next++;
+            sink += await func.promise(i);
+        }
+    });
+
+    await Promise.all(workers);
+}
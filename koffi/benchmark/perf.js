@@ -0,0 +1,38 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+'use strict';
+
+// Hardware performance counters (Linux only), the functions below return null
+// when the helper module is missing or when perf events are not available.
+
+let perf_napi = null;
+
+try {
+    perf_napi = require('./build/perf_napi.node');
+} catch (err) {
+    // Ignore
+}
+
+function start() {
+    return perf_napi ? perf_napi.start() : null;
+}
+
+function stop(handle) {
+    return (perf_napi && handle != null) ? perf_napi.stop(handle) : null;
+}
+
+module.exports = {
+    start,
+    stop
+};
@@ -0,0 +1,167 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+#include "vendor/libcc/libcc.hh"
+#include <napi.h>
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace RG {
+
+// Counters are measured for the calling thread only (the JS thread)
+
+struct CounterInfo {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+#ifdef __linux__
+
+static const CounterInfo Counters[] = {
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "l1d_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { "llc_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { "context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES }
+};
+
+struct CounterSet {
+    int fds[RG_LEN(Counters)];
+
+    ~CounterSet()
+    {
+        for (int fd: fds) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+};
+
+static int OpenCounter(const CounterInfo &info)
+{
+    struct perf_event_attr attr = {};
+
+    attr.size = RG_SIZE(attr);
+    attr.type = info.type;
+    attr.config = info.config;
+    attr.disabled = 1;
+    attr.exclude_kernel = (info.type != PERF_TYPE_SOFTWARE);
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+static Napi::Value StartCounters(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+
+    CounterSet *set = new CounterSet;
+    bool available = false;
+
+    for (Size i = 0; i < RG_LEN(Counters); i++) {
+        set->fds[i] = OpenCounter(Counters[i]);
+        available |= (set->fds[i] >= 0);
+    }
+
+    // Most likely restricted by perf_event_paranoid, or running in a container
+    if (!available) {
+        delete set;
+        return env.Null();
+    }
+
+    for (int fd: set->fds) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    return Napi::External<CounterSet>::New(env, set, [](Napi::Env, CounterSet *set) { delete set; });
+}
+
+static Napi::Value StopCounters(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+
+    if (info.Length() < 1 || !info[0].IsExternal())
+        return env.Null();
+
+    CounterSet *set = info[0].As<Napi::External<CounterSet>>().Data();
+
+    for (int fd: set->fds) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+
+    Napi::Object obj = Napi::Object::New(env);
+
+    for (Size i = 0; i < RG_LEN(Counters); i++) {
+        uint64_t values[3]; // Value, time enabled, time running
+
+        if (set->fds[i] < 0 || read(set->fds[i], values, RG_SIZE(values)) != RG_SIZE(values)) {
+            obj.Set(Counters[i].name, env.Null());
+            continue;
+        }
+
+        // Scale the value if the kernel had to multiplex counters
+        double value = (double)values[0];
+        if (values[2] && values[2] < values[1]) {
+            value *= (double)values[1] / (double)values[2];
+        }
+
+        obj.Set(Counters[i].name, value);
+    }
+
+    return obj;
+}
+
+#else
+
+static Napi::Value StartCounters(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    return env.Null();
+}
+
+static Napi::Value StopCounters(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    return env.Null();
+}
+
+#endif
+
+}
+
+static Napi::Object InitModule(Napi::Env env, Napi::Object exports)
+{
+    using namespace RG;
+
+    exports.Set("start", Napi::Function::New(env, StartCounters));
+    exports.Set("stop", Napi::Function::New(env, StopCounters));
+
+    return exports;
+}
+
+NODE_API_MODULE(koffi, InitModule);
@@ -14,6 +14,7 @@
 // along with this program. If not, see https://www.gnu.org/licenses/.
 
 const koffi = require('./build/koffi.node');
+const perf = require('./perf.js');
 
 let sum = 0;
 
@@ -37,6 +38,7 @@ function main() {
 
     srand(42);
 
+    let counters = perf.start();
     let start = performance.now();
 
     for (let i = 0; i < iterations; i++) {
@@ -44,5 +46,7 @@ function main() {
     }
 
     let time = performance.now() - start;
-    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time) }));
+    counters = perf.stop(counters);
+
+    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time), counters: counters }));
 }
@@ -14,6 +14,7 @@
 // along with this program. If not, see https://www.gnu.org/licenses/.
 
 const rand = require('./build/rand_napi.node');
+const perf = require('./perf.js');
 
 let sum = 0;
 
@@ -32,6 +33,7 @@ function main() {
 
     rand.srand(42);
 
+    let counters = perf.start();
     let start = performance.now();
 
     for (let i = 0; i < iterations; i++) {
@@ -39,5 +41,7 @@ function main() {
     }
 
     let time = performance.now() - start;
-    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time) }));
+    counters = perf.stop(counters);
+
+    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time), counters: counters }));
 }
@@ -16,6 +16,7 @@
 const ref = require('ref-napi');
 const ffi = require('ffi-napi');
 const struct = require('ref-struct-di')(ref);
+const perf = require('./perf.js');
 
 let sum = 0;
 
@@ -39,6 +40,7 @@ async function main() {
 
     lib.srand(42);
 
+    let counters = perf.start();
     let start = performance.now();
 
     for (let i = 0; i < iterations; i++) {
@@ -49,6 +51,8 @@ async function main() {
     }
 
     let time = performance.now() - start;
-    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time) }));
+    counters = perf.stop(counters);
+
+    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time), counters: counters }));
 }
 
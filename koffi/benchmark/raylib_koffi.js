@@ -15,6 +15,7 @@
 
 const koffi = require('./build/koffi.node');
 const path = require('path');
+const perf = require('./perf.js');
 
 const Color = koffi.struct('Color', {
     r: 'uchar',
@@ -102,6 +103,7 @@ function main() {
     let img = GenImageColor(800, 600, { r: 0, g: 0, b: 0, a: 255 });
     let font = GetFontDefault();
 
+    let counters = perf.start();
     let start = performance.now();
 
     for (let i = 0; i < iterations; i += 3600) {
@@ -128,5 +130,7 @@ function main() {
     }
 
     let time = performance.now() - start;
-    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time) }));
+    counters = perf.stop(counters);
+
+    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time), counters: counters }));
 }
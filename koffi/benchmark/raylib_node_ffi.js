@@ -18,6 +18,7 @@ const ffi = require('ffi-napi');
 const struct = require('ref-struct-di')(ref);
 const koffi = require('./build/koffi.node');
 const path = require('path');
+const perf = require('./perf.js');
 
 const Color = struct({
     r: 'uchar',
@@ -120,6 +121,7 @@ function main() {
     let imgp = img.ref();
     let font = r.GetFontDefault();
 
+    let counters = perf.start();
     let start = performance.now();
 
     for (let i = 0; i < iterations; i += 3600) {
@@ -146,5 +148,7 @@ function main() {
     }
 
     let time = performance.now() - start;
-    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time) }));
+    counters = perf.stop(counters);
+
+    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time), counters: counters }));
 }
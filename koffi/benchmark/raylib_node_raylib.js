@@ -14,6 +14,7 @@
 // along with this program. If not, see https://www.gnu.org/licenses/.
 
 const r = require('raylib');
+const perf = require('./perf.js');
 
 main();
 
@@ -36,6 +37,7 @@ function main() {
     let img = r.GenImageColor(800, 600, { r: 0, g: 0, b: 0, a: 255 });
     let font = r.GetFontDefault();
 
+    let counters = perf.start();
     let start = performance.now();
 
     for (let i = 0; i < iterations; i += 3600) {
@@ -62,5 +64,7 @@ function main() {
     }
 
     let time = performance.now() - start;
-    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time) }));
+    counters = perf.stop(counters);
+
+    console.log(JSON.stringify({ iterations: iterations, time: Math.round(time), counters: counters }));
 }
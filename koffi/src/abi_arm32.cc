@@ -14,8 +14,10 @@
 #if defined(__arm__) || (defined(__M_ARM) && !defined(_M_ARM64))
 
 #include "vendor/libcc/libcc.hh"
+#include "async.hh"
 #include "ffi.hh"
 #include "call.hh"
+#include "records.hh"
 #include "util.hh"
 
 #include <napi.h>
@@ -238,6 +240,14 @@ bool AnalyseFunction(Napi::Env, InstanceData *, FunctionInfo *func)
             } break;
 
             case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
+        }
+
+        if (!param.gpr_count && !param.vec_count) {
+            func->stack_size = AlignLen(func->stack_size, param.type->align > 4 ? 8 : 4) + AlignLen(param.type->size, 4);
+        } else if (!param.vec_count && param.gpr_count * 4 < param.type->size) {
+            // Split between the last registers and the stack
+            func->stack_size += AlignLen(param.type->size - param.gpr_count * 4, 4);
         }
 
         func->args_size += AlignLen(param.type->size, 16);
@@ -248,7 +258,7 @@ bool AnalyseFunction(Napi::Env, InstanceData *, FunctionInfo *func)
     return true;
 }
 
-bool CallData::Prepare(const Napi::CallbackInfo &info)
+bool CallData::Prepare(const napi_value *args)
 {
     uint32_t *args_ptr = nullptr;
     uint32_t *gpr_ptr = nullptr;
@@ -272,9 +282,9 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
     // Push arguments
     for (Size i = 0; i < func->parameters.len; i++) {
         const ParameterInfo &param = func->parameters[i];
-        RG_ASSERT(param.directions >= 1 && param.directions <= 3);
+        RG_ASSERT(param.directions >= 1 && param.directions <= 4);
 
-        Napi::Value value = info[param.offset];
+        Napi::Value value(env, args[param.offset]);
 
         switch (param.type->primitive) {
             case PrimitiveKind::Void: { RG_UNREACHABLE(); } break;
@@ -475,6 +485,7 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
             } break;
 
             case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
         }
     }
 
@@ -485,7 +496,10 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
 
 void CallData::Execute()
 {
+    // Trampolines called once this call is over must not find it, see RelayCallback()
+    CallData *prev_call = exec_call;
     exec_call = this;
+    RG_DEFER { exec_call = prev_call; };
 
 #define PERFORM_CALL(Suffix) \
         ([&]() { \
@@ -523,6 +537,7 @@ void CallData::Execute()
         case PrimitiveKind::Float64: { result.d = PERFORM_CALL(DDDD).d0; } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
 #undef PERFORM_CALL
@@ -549,7 +564,7 @@ Napi::Value CallData::Complete()
         case PrimitiveKind::UInt32: return Napi::Number::New(env, (double)result.u32);
         case PrimitiveKind::Int64: return NewBigInt(env, result.i64);
         case PrimitiveKind::UInt64: return NewBigInt(env, result.u64);
-        case PrimitiveKind::String: return result.ptr ? Napi::String::New(env, (const char *)result.ptr) : env.Null();
+        case PrimitiveKind::String: return result.ptr ? NewString(env, (const char *)result.ptr) : env.Null();
         case PrimitiveKind::String16: return result.ptr ? Napi::String::New(env, (const char16_t *)result.ptr) : env.Null();
         case PrimitiveKind::Pointer:
         case PrimitiveKind::Callback: {
@@ -566,7 +581,7 @@ Napi::Value CallData::Complete()
             const uint8_t *ptr = return_ptr ? (const uint8_t *)return_ptr
                                             : (const uint8_t *)&result.buf;
 
-            Napi::Object obj = PopObject(ptr, func->ret.type);
+            Napi::Object obj = PopReturnObject(ptr);
             return obj;
         } break;
         case PrimitiveKind::Array: { RG_UNREACHABLE(); } break;
@@ -574,6 +589,7 @@ Napi::Value CallData::Complete()
         case PrimitiveKind::Float64: return Napi::Number::New(env, result.d);
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
     RG_UNREACHABLE();
@@ -608,7 +624,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
     // Convert to JS arguments
     for (Size i = 0; i < proto->parameters.len; i++) {
         const ParameterInfo &param = proto->parameters[i];
-        RG_ASSERT(param.directions >= 1 && param.directions <= 3);
+        RG_ASSERT(param.directions >= 1 && param.directions <= 4);
 
         switch (param.type->primitive) {
             case PrimitiveKind::Void: { RG_UNREACHABLE(); } break;
@@ -676,7 +692,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
             case PrimitiveKind::String: {
                 const char *str = *(const char **)((param.gpr_count ? gpr_ptr : args_ptr)++);
 
-                Napi::Value arg = str ? Napi::String::New(env, str) : env.Null();
+                Napi::Value arg = str ? NewString(env, str) : env.Null();
                 arguments.Append(arg);
 
                 if (param.type->dispose) {
@@ -712,7 +728,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
             } break;
             case PrimitiveKind::Record: {
                 if (param.vec_count) {
-                    Napi::Object obj = PopObject((const uint8_t *)vec_ptr, param.type);
+                    Napi::Value obj = DecodeRelayedObject(env, (const uint8_t *)vec_ptr, param.type);
                     arguments.Append(obj);
 
                     vec_ptr += param.vec_count;
@@ -731,13 +747,13 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
                         memcpy(ptr, gpr_ptr, gpr_size);
                         memcpy(ptr + gpr_size, args_ptr, param.type->size - gpr_size);
 
-                        Napi::Object obj = PopObject(ptr, param.type);
+                        Napi::Value obj = DecodeRelayedObject(env, ptr, param.type);
                         arguments.Append(obj);
 
                         gpr_ptr += param.gpr_count;
                         args_ptr += (param.type->size - gpr_size + 3) / 4;
                     } else {
-                        Napi::Object obj = PopObject((const uint8_t *)gpr_ptr, param.type);
+                        Napi::Value obj = DecodeRelayedObject(env, (const uint8_t *)gpr_ptr, param.type);
                         arguments.Append(obj);
 
                         gpr_ptr += param.gpr_count;
@@ -746,7 +762,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
                     int16_t align = (param.type->align <= 4) ? 4 : 8;
                     args_ptr = AlignUp(args_ptr, align);
 
-                    Napi::Object obj = PopObject((const uint8_t *)args_ptr, param.type);
+                    Napi::Value obj = DecodeRelayedObject(env, (const uint8_t *)args_ptr, param.type);
                     arguments.Append(obj);
 
                     args_ptr += (param.type->size + 3) / 4;
@@ -786,14 +802,19 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
             } break;
 
             case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
         }
     }
 
     const TypeInfo *type = proto->ret.type;
 
-    // Make the call
-    napi_value ret = CallSwitchStack(&func, (size_t)arguments.len, arguments.data, old_sp, &mem->stack,
-                                     [](Napi::Function *func, size_t argc, napi_value *argv) { return (napi_value)func->Call(argc, argv); });
+    // Make the call, thread-safe callbacks are relayed from the event loop and can use the JS stack as-is
+    napi_value ret;
+    if (RG_LIKELY(old_sp)) {
+        ret = CallSwitchStack(&func, (size_t)arguments.len, arguments.data, old_sp, &mem->stack, CallRelayed);
+    } else {
+        ret = CallRelayed(&func, (size_t)arguments.len, arguments.data);
+    }
     Napi::Value value(env, ret);
 
     if (RG_UNLIKELY(env.IsExceptionPending()))
@@ -971,6 +992,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
         } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
     err_guard.Disable();
@@ -984,6 +1006,16 @@ void *GetTrampoline(Size idx, const FunctionInfo *proto)
 
 extern "C" void RelayCallback(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegisters *out_reg)
 {
+    if (RG_UNLIKELY(idx >= MaxTrampolines) && ThreadedCallback::Relay(idx, own_sp, caller_sp, out_reg, RG_SIZE(*out_reg)))
+        return;
+
+    // C code called a transient callback after its call was over, from a call stub or a fast call
+    if (RG_UNLIKELY(!exec_call)) {
+        memset(out_reg, 0, RG_SIZE(*out_reg));
+        missed_relay = true;
+        return;
+    }
+
     exec_call->Relay(idx, own_sp, caller_sp, out_reg);
 }
 
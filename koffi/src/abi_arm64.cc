@@ -14,8 +14,10 @@
 #if defined(__aarch64__) || defined(_M_ARM64)
 
 #include "vendor/libcc/libcc.hh"
+#include "async.hh"
 #include "ffi.hh"
 #include "call.hh"
+#include "records.hh"
 #include "util.hh"
 
 #include <napi.h>
@@ -232,6 +234,12 @@ bool AnalyseFunction(Napi::Env, InstanceData *, FunctionInfo *func)
             } break;
 
             case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
+        }
+
+        // Apple platforms pack stack arguments, so this is only an upper bound there
+        if (!param.gpr_count && !param.vec_count) {
+            func->stack_size += param.use_memory ? 8 : AlignLen(param.type->size, 8);
         }
     }
 
@@ -241,7 +249,7 @@ bool AnalyseFunction(Napi::Env, InstanceData *, FunctionInfo *func)
     return true;
 }
 
-bool CallData::Prepare(const Napi::CallbackInfo &info)
+bool CallData::Prepare(const napi_value *args)
 {
     uint64_t *args_ptr = nullptr;
     uint64_t *gpr_ptr = nullptr;
@@ -262,9 +270,9 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
     // Push arguments
     for (Size i = 0; i < func->parameters.len; i++) {
         const ParameterInfo &param = func->parameters[i];
-        RG_ASSERT(param.directions >= 1 && param.directions <= 3);
+        RG_ASSERT(param.directions >= 1 && param.directions <= 4);
 
-        Napi::Value value = info[param.offset];
+        Napi::Value value(env, args[param.offset]);
 
         switch (param.type->primitive) {
             case PrimitiveKind::Void: { RG_UNREACHABLE(); } break;
@@ -493,6 +501,7 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
             } break;
 
             case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
         }
     }
 
@@ -503,7 +512,10 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
 
 void CallData::Execute()
 {
+    // Trampolines called once this call is over must not find it, see RelayCallback()
+    CallData *prev_call = exec_call;
     exec_call = this;
+    RG_DEFER { exec_call = prev_call; };
 
 #define PERFORM_CALL(Suffix) \
         ([&]() { \
@@ -544,6 +556,7 @@ void CallData::Execute()
         case PrimitiveKind::Float64: { result.d = PERFORM_CALL(DDDD).d0; } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
 #undef PERFORM_CALL
@@ -570,7 +583,7 @@ Napi::Value CallData::Complete()
         case PrimitiveKind::UInt32: return Napi::Number::New(env, (double)result.u32);
         case PrimitiveKind::Int64: return NewBigInt(env, result.i64);
         case PrimitiveKind::UInt64: return NewBigInt(env, result.u64);
-        case PrimitiveKind::String: return result.ptr ? Napi::String::New(env, (const char *)result.ptr) : env.Null();
+        case PrimitiveKind::String: return result.ptr ? NewString(env, (const char *)result.ptr) : env.Null();
         case PrimitiveKind::String16: return result.ptr ? Napi::String::New(env, (const char16_t *)result.ptr) : env.Null();
         case PrimitiveKind::Pointer:
         case PrimitiveKind::Callback: {
@@ -585,13 +598,13 @@ Napi::Value CallData::Complete()
         } break;
         case PrimitiveKind::Record: {
             if (func->ret.vec_count) { // HFA
-                Napi::Object obj = PopObject((const uint8_t *)&result.buf, func->ret.type, 8);
+                Napi::Object obj = PopReturnObject((const uint8_t *)&result.buf, 8);
                 return obj;
             } else {
                 const uint8_t *ptr = return_ptr ? (const uint8_t *)return_ptr
                                                 : (const uint8_t *)&result.buf;
 
-                Napi::Object obj = PopObject(ptr, func->ret.type);
+                Napi::Object obj = PopReturnObject(ptr);
                 return obj;
             }
         } break;
@@ -600,6 +613,7 @@ Napi::Value CallData::Complete()
         case PrimitiveKind::Float64: return Napi::Number::New(env, result.d);
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
     RG_UNREACHABLE();
@@ -633,7 +647,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
     // Convert to JS arguments
     for (Size i = 0; i < proto->parameters.len; i++) {
         const ParameterInfo &param = proto->parameters[i];
-        RG_ASSERT(param.directions >= 1 && param.directions <= 3);
+        RG_ASSERT(param.directions >= 1 && param.directions <= 4);
 
         switch (param.type->primitive) {
             case PrimitiveKind::Void: { RG_UNREACHABLE(); } break;
@@ -781,7 +795,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
 
                 const char *str = *(const char **)((param.gpr_count ? gpr_ptr : args_ptr)++);
 
-                Napi::Value arg = str ? Napi::String::New(env, str) : env.Null();
+                Napi::Value arg = str ? NewString(env, str) : env.Null();
                 arguments.Append(arg);
 
                 if (param.type->dispose) {
@@ -825,7 +839,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
             } break;
             case PrimitiveKind::Record: {
                 if (param.vec_count) { // HFA
-                    Napi::Object obj = PopObject((uint8_t *)vec_ptr, param.type, 8);
+                    Napi::Value obj = DecodeRelayedObject(env, (uint8_t *)vec_ptr, param.type, 8);
                     arguments.Append(obj);
 
                     vec_ptr += param.vec_count;
@@ -833,14 +847,14 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
                     if (param.gpr_count) {
                         RG_ASSERT(param.type->align <= 8);
 
-                        Napi::Object obj = PopObject((uint8_t *)gpr_ptr, param.type);
+                        Napi::Value obj = DecodeRelayedObject(env, (uint8_t *)gpr_ptr, param.type);
                         arguments.Append(obj);
 
                         gpr_ptr += param.gpr_count;
                     } else if (param.type->size) {
                         args_ptr = AlignUp(args_ptr, param.type->align);
 
-                        Napi::Object obj = PopObject((uint8_t *)args_ptr, param.type);
+                        Napi::Value obj = DecodeRelayedObject(env, (uint8_t *)args_ptr, param.type);
                         arguments.Append(obj);
 
                         args_ptr += (param.type->size + 7) / 8;
@@ -852,7 +866,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
 
                     void *ptr2 = *(void **)((param.gpr_count ? gpr_ptr : args_ptr)++);
 
-                    Napi::Object obj = PopObject((uint8_t *)ptr2, param.type);
+                    Napi::Value obj = DecodeRelayedObject(env, (uint8_t *)ptr2, param.type);
                     arguments.Append(obj);
                 }
             } break;
@@ -899,14 +913,19 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
             } break;
 
             case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
         }
     }
 
     const TypeInfo *type = proto->ret.type;
 
-    // Make the call
-    napi_value ret = CallSwitchStack(&func, (size_t)arguments.len, arguments.data, old_sp, &mem->stack,
-                                     [](Napi::Function *func, size_t argc, napi_value *argv) { return (napi_value)func->Call(argc, argv); });
+    // Make the call, thread-safe callbacks are relayed from the event loop and can use the JS stack as-is
+    napi_value ret;
+    if (RG_LIKELY(old_sp)) {
+        ret = CallSwitchStack(&func, (size_t)arguments.len, arguments.data, old_sp, &mem->stack, CallRelayed);
+    } else {
+        ret = CallRelayed(&func, (size_t)arguments.len, arguments.data);
+    }
     Napi::Value value(env, ret);
 
     if (RG_UNLIKELY(env.IsExceptionPending()))
@@ -1052,6 +1071,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
         } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
     err_guard.Disable();
@@ -1065,6 +1085,16 @@ void *GetTrampoline(Size idx, const FunctionInfo *proto)
 
 extern "C" void RelayCallback(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegisters *out_reg)
 {
+    if (RG_UNLIKELY(idx >= MaxTrampolines) && ThreadedCallback::Relay(idx, own_sp, caller_sp, out_reg, RG_SIZE(*out_reg)))
+        return;
+
+    // C code called a transient callback after its call was over, from a call stub or a fast call
+    if (RG_UNLIKELY(!exec_call)) {
+        memset(out_reg, 0, RG_SIZE(*out_reg));
+        missed_relay = true;
+        return;
+    }
+
     exec_call->Relay(idx, own_sp, caller_sp, out_reg);
 }
 
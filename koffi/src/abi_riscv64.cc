@@ -14,8 +14,10 @@
 #if __riscv_xlen == 64
 
 #include "vendor/libcc/libcc.hh"
+#include "async.hh"
 #include "ffi.hh"
 #include "call.hh"
+#include "records.hh"
 #include "util.hh"
 
 #include <napi.h>
@@ -188,6 +190,13 @@ bool AnalyseFunction(Napi::Env, InstanceData *, FunctionInfo *func)
     for (ParameterInfo &param: func->parameters) {
         AnalyseParameter(&param, gpr_avail, !param.variadic ? vec_avail : 0);
 
+        if (!param.gpr_count && !param.vec_count) {
+            func->stack_size += param.use_memory ? 8 : AlignLen(param.type->size, 8);
+        } else if (param.gpr_count > gpr_avail) {
+            // Split between the last register and the stack
+            func->stack_size += 8 * (param.gpr_count - gpr_avail);
+        }
+
         gpr_avail = std::max(0, gpr_avail - param.gpr_count);
         vec_avail = std::max(0, vec_avail - param.vec_count);
     }
@@ -198,7 +207,7 @@ bool AnalyseFunction(Napi::Env, InstanceData *, FunctionInfo *func)
     return true;
 }
 
-bool CallData::Prepare(const Napi::CallbackInfo &info)
+bool CallData::Prepare(const napi_value *args)
 {
     uint64_t *args_ptr = nullptr;
     uint64_t *gpr_ptr = nullptr;
@@ -219,9 +228,9 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
     // Push arguments
     for (Size i = 0; i < func->parameters.len; i++) {
         const ParameterInfo &param = func->parameters[i];
-        RG_ASSERT(param.directions >= 1 && param.directions <= 3);
+        RG_ASSERT(param.directions >= 1 && param.directions <= 4);
 
-        Napi::Value value = info[param.offset];
+        Napi::Value value(env, args[param.offset]);
 
         switch (param.type->primitive) {
             case PrimitiveKind::Void: { RG_UNREACHABLE(); } break;
@@ -402,6 +411,7 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
             } break;
 
             case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
         }
     }
 
@@ -412,7 +422,10 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
 
 void CallData::Execute()
 {
+    // Trampolines called once this call is over must not find it, see RelayCallback()
+    CallData *prev_call = exec_call;
     exec_call = this;
+    RG_DEFER { exec_call = prev_call; };
 
 #define PERFORM_CALL(Suffix) \
         ([&]() { \
@@ -457,6 +470,7 @@ void CallData::Execute()
         case PrimitiveKind::Float64: { result.d = PERFORM_CALL(DD).fa0; } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
 #undef PERFORM_CALL
@@ -483,7 +497,7 @@ Napi::Value CallData::Complete()
         case PrimitiveKind::UInt32: return Napi::Number::New(env, (double)result.u32);
         case PrimitiveKind::Int64: return NewBigInt(env, result.i64);
         case PrimitiveKind::UInt64: return NewBigInt(env, result.u64);
-        case PrimitiveKind::String: return result.ptr ? Napi::String::New(env, (const char *)result.ptr) : env.Null();
+        case PrimitiveKind::String: return result.ptr ? NewString(env, (const char *)result.ptr) : env.Null();
         case PrimitiveKind::String16: return result.ptr ? Napi::String::New(env, (const char16_t *)result.ptr) : env.Null();
         case PrimitiveKind::Pointer:
         case PrimitiveKind::Callback: {
@@ -498,13 +512,13 @@ Napi::Value CallData::Complete()
         } break;
         case PrimitiveKind::Record: {
             if (func->ret.vec_count) { // HFA
-                Napi::Object obj = PopObject((const uint8_t *)&result.buf, func->ret.type, 8);
+                Napi::Object obj = PopReturnObject((const uint8_t *)&result.buf, 8);
                 return obj;
             } else {
                 const uint8_t *ptr = return_ptr ? (const uint8_t *)return_ptr
                                                 : (const uint8_t *)&result.buf;
 
-                Napi::Object obj = PopObject(ptr, func->ret.type);
+                Napi::Object obj = PopReturnObject(ptr);
                 return obj;
             }
         } break;
@@ -513,6 +527,7 @@ Napi::Value CallData::Complete()
         case PrimitiveKind::Float64: return Napi::Number::New(env, result.d);
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
     RG_UNREACHABLE();
@@ -547,7 +562,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
     // Convert to JS arguments
     for (Size i = 0; i < proto->parameters.len; i++) {
         const ParameterInfo &param = proto->parameters[i];
-        RG_ASSERT(param.directions >= 1 && param.directions <= 3);
+        RG_ASSERT(param.directions >= 1 && param.directions <= 4);
 
         switch (param.type->primitive) {
             case PrimitiveKind::Void: { RG_UNREACHABLE(); } break;
@@ -609,7 +624,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
             case PrimitiveKind::String: {
                 const char *str = *(const char **)((param.gpr_count ? gpr_ptr : args_ptr)++);
 
-                Napi::Value arg = str ? Napi::String::New(env, str) : env.Null();
+                Napi::Value arg = str ? NewString(env, str) : env.Null();
                 arguments.Append(arg);
 
                 if (param.type->dispose) {
@@ -665,12 +680,12 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
                     // Reassemble float or mixed int-float structs from registers
                     int realign = param.vec_count ? 8 : 0;
 
-                    Napi::Object obj = PopObject((const uint8_t *)buf, param.type, realign);
+                    Napi::Value obj = DecodeRelayedObject(env, (const uint8_t *)buf, param.type, realign);
                     arguments.Append(obj);
                 } else {
                     uint8_t *ptr = *(uint8_t **)((param.gpr_count ? gpr_ptr : args_ptr)++);
 
-                    Napi::Object obj = PopObject(ptr, param.type);
+                    Napi::Value obj = DecodeRelayedObject(env, ptr, param.type);
                     arguments.Append(obj);
                 }
             } break;
@@ -703,14 +718,19 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
             } break;
 
             case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
         }
     }
 
     const TypeInfo *type = proto->ret.type;
 
-    // Make the call
-    napi_value ret = CallSwitchStack(&func, (size_t)arguments.len, arguments.data, old_sp, &mem->stack,
-                                     [](Napi::Function *func, size_t argc, napi_value *argv) { return (napi_value)func->Call(argc, argv); });
+    // Make the call, thread-safe callbacks are relayed from the event loop and can use the JS stack as-is
+    napi_value ret;
+    if (RG_LIKELY(old_sp)) {
+        ret = CallSwitchStack(&func, (size_t)arguments.len, arguments.data, old_sp, &mem->stack, CallRelayed);
+    } else {
+        ret = CallRelayed(&func, (size_t)arguments.len, arguments.data);
+    }
     Napi::Value value(env, ret);
 
     if (RG_UNLIKELY(env.IsExceptionPending()))
@@ -855,6 +875,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
         } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
     err_guard.Disable();
@@ -868,6 +889,16 @@ void *GetTrampoline(Size idx, const FunctionInfo *proto)
 
 extern "C" void RelayCallback(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegisters *out_reg)
 {
+    if (RG_UNLIKELY(idx >= MaxTrampolines) && ThreadedCallback::Relay(idx, own_sp, caller_sp, out_reg, RG_SIZE(*out_reg)))
+        return;
+
+    // C code called a transient callback after its call was over, from a call stub or a fast call
+    if (RG_UNLIKELY(!exec_call)) {
+        memset(out_reg, 0, RG_SIZE(*out_reg));
+        missed_relay = true;
+        return;
+    }
+
     exec_call->Relay(idx, own_sp, caller_sp, out_reg);
 }
 
@@ -14,11 +14,15 @@
 #if defined(__x86_64__) && !defined(_WIN32)
 
 #include "vendor/libcc/libcc.hh"
+#include "async.hh"
 #include "ffi.hh"
 #include "call.hh"
+#include "records.hh"
+#include "trampolines.hh"
 #include "util.hh"
 
 #include <napi.h>
+#include <sys/mman.h>
 
 namespace RG {
 
@@ -140,6 +144,98 @@ RG_STATIC_ASSERT(RG_LEN(Trampolines) == MaxTrampolines * 2);
 
 static RG_THREAD_LOCAL CallData *exec_call;
 
+// The ForwardCall functions load all 6 GPR (and all 8 XMM registers for the X variants),
+// whatever the function needs. These thunks are generated at runtime and only load the
+// registers used by the signature. They share the ForwardCall calling convention, and
+// there is one for each combination of GPR (0 to 6) and XMM (0 to 8) register counts.
+static const Size ThunkSize = 128;
+static const Size ThunkCount = 7 * 9;
+static const Size ThunkMapSize = AlignLen(ThunkCount * ThunkSize, 4096);
+
+static std::once_flag thunks_once;
+static uint8_t *thunks = nullptr;
+
+static void WriteForwardThunk(uint8_t *ptr, int gpr_count, int xmm_count)
+{
+    static const uint8_t GprLoads[6][4] = {
+        { 0x48, 0x8B, 0x7E, 0x00 }, // movq 0(%rsi), %rdi
+        { 0x48, 0x8B, 0x76, 0x08 }, // movq 8(%rsi), %rsi
+        { 0x48, 0x8B, 0x56, 0x10 }, // movq 16(%rsi), %rdx
+        { 0x48, 0x8B, 0x4E, 0x18 }, // movq 24(%rsi), %rcx
+        { 0x4C, 0x8B, 0x46, 0x20 }, // movq 32(%rsi), %r8
+        { 0x4C, 0x8B, 0x4E, 0x28 }  // movq 40(%rsi), %r9
+    };
+
+    uint8_t *end = ptr;
+    const auto emit = [&](std::initializer_list<uint8_t> bytes) {
+        memcpy(end, bytes.begin(), bytes.size());
+        end += bytes.size();
+    };
+
+    memset(ptr, 0xCC, ThunkSize); // int3
+
+    // Same prologue as the assembly code
+    emit({ 0xF3, 0x0F, 0x1E, 0xFA }); // endbr64
+    emit({ 0x49, 0x89, 0xFB }); // movq %rdi, %r11
+    emit({ 0x53 }); // pushq %rbx
+    emit({ 0x48, 0x89, 0x22 }); // movq %rsp, (%rdx)
+    emit({ 0x48, 0x89, 0xE3 }); // movq %rsp, %rbx
+    emit({ 0x48, 0x8D, 0x66, 0x70 }); // leaq 112(%rsi), %rsp
+
+    for (int i = 0; i < xmm_count; i++) {
+        emit({ 0xF2, 0x0F, 0x10, (uint8_t)(0x46 | (i << 3)), (uint8_t)(48 + 8 * i) }); // movsd (48 + 8 * i)(%rsi), %xmmI
+    }
+
+    // RSI holds the register array, so it must be loaded last
+    for (int i = gpr_count - 1; i >= 0; i--) {
+        if (i == 1)
+            continue;
+
+        memcpy(end, GprLoads[i], 4);
+        end += 4;
+    }
+    if (gpr_count >= 2) {
+        memcpy(end, GprLoads[1], 4);
+        end += 4;
+    }
+
+    emit({ 0xB0, (uint8_t)xmm_count }); // movb $xmm_count, %al
+    emit({ 0x41, 0xFF, 0xD3 }); // call *%r11
+    emit({ 0x48, 0x89, 0xDC }); // movq %rbx, %rsp
+    emit({ 0x5B }); // popq %rbx
+    emit({ 0xC3 }); // ret
+
+    RG_ASSERT(end - ptr <= ThunkSize);
+}
+
+static const void *GetForwardThunk(int gpr_count, int xmm_count)
+{
+    RG_ASSERT(gpr_count >= 0 && gpr_count <= 6);
+    RG_ASSERT(xmm_count >= 0 && xmm_count <= 8);
+
+    std::call_once(thunks_once, []() {
+        uint8_t *map = (uint8_t *)mmap(nullptr, ThunkMapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (map == MAP_FAILED)
+            return;
+
+        for (int i = 0; i <= 6; i++) {
+            for (int j = 0; j <= 8; j++) {
+                WriteForwardThunk(map + (i * 9 + j) * ThunkSize, i, j);
+            }
+        }
+
+        // Keep using the assembly code if the system refuses executable pages
+        if (mprotect(map, ThunkMapSize, PROT_READ | PROT_EXEC) < 0) {
+            munmap(map, ThunkMapSize);
+            return;
+        }
+
+        thunks = map;
+    });
+
+    return thunks ? thunks + (gpr_count * 9 + xmm_count) * ThunkSize : nullptr;
+}
+
 static inline RegisterClass MergeClasses(RegisterClass cls1, RegisterClass cls2)
 {
     if (cls1 == cls2)
@@ -218,6 +314,7 @@ static Size ClassifyType(const TypeInfo *type, Size offset, Span<RegisterClass>
         } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
     RG_UNREACHABLE();
@@ -259,89 +356,150 @@ static void AnalyseParameter(ParameterInfo *param, int gpr_avail, int xmm_avail)
     }
 }
 
-bool AnalyseFunction(Napi::Env, InstanceData *, FunctionInfo *func)
+bool AnalyseFunction(Napi::Env, InstanceData *instance, FunctionInfo *func)
 {
     AnalyseParameter(&func->ret, 2, 2);
 
     int gpr_avail = 6 - func->ret.use_memory;
     int xmm_avail = 8;
 
-    for (ParameterInfo &param: func->parameters) {
+    int32_t gpr_offset = 8 * func->ret.use_memory;
+    int32_t xmm_offset = 6 * 8;
+    int32_t args_offset = 14 * 8;
+
+    const auto next_slot = [&](bool reg, int32_t *reg_offset) {
+        int32_t *ptr = reg ? reg_offset : &args_offset;
+        int32_t offset = *ptr;
+
+        *ptr += 8;
+        return offset;
+    };
+
+    func->steps.Clear();
+
+    for (Size i = 0; i < func->parameters.len; i++) {
+        ParameterInfo &param = func->parameters[i];
+
         AnalyseParameter(&param, gpr_avail, xmm_avail);
 
         gpr_avail -= param.gpr_count;
         xmm_avail -= param.xmm_count;
 
-        func->args_size += AlignLen(param.type->size, 16);
+        ForwardStep step = {};
+
+        step.param = (int8_t)i;
+        step.offset2 = -1;
+
+        switch (param.type->primitive) {
+            case PrimitiveKind::Void: { RG_UNREACHABLE(); } break;
+
+            case PrimitiveKind::Bool: { step.op = ForwardOp::Bool; } break;
+            case PrimitiveKind::Int8:
+            case PrimitiveKind::UInt8:
+            case PrimitiveKind::Int16:
+            case PrimitiveKind::UInt16:
+            case PrimitiveKind::Int32:
+            case PrimitiveKind::UInt32:
+            case PrimitiveKind::Int64: { step.op = ForwardOp::Integer; } break;
+            case PrimitiveKind::UInt64: { step.op = ForwardOp::UInt64; } break;
+            case PrimitiveKind::String: { step.op = ForwardOp::String; } break;
+            case PrimitiveKind::String16: { step.op = ForwardOp::String16; } break;
+            case PrimitiveKind::Pointer: { step.op = ForwardOp::Pointer; } break;
+            case PrimitiveKind::Record: {
+                if (param.gpr_count || param.xmm_count) {
+                    bool second = (param.gpr_count + param.xmm_count == 2);
+                    bool second_gpr = param.gpr_first ? (param.gpr_count == 2) : (param.gpr_count == 1);
+
+                    step.op = ForwardOp::RecordRegisters;
+                    step.offset = next_slot(true, param.gpr_first ? &gpr_offset : &xmm_offset);
+                    step.offset2 = second ? next_slot(true, second_gpr ? &gpr_offset : &xmm_offset) : -1;
+                } else if (param.use_memory) {
+                    step.op = ForwardOp::RecordMemory;
+                    step.offset = (int32_t)AlignLen(args_offset, param.type->align);
+
+                    args_offset = step.offset + (int32_t)AlignLen(param.type->size, 8);
+                } else {
+                    continue;
+                }
+
+                func->steps.Append(step);
+                continue;
+            } break;
+            case PrimitiveKind::Array: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Float32: { step.op = ForwardOp::Float32; } break;
+            case PrimitiveKind::Float64: { step.op = ForwardOp::Float64; } break;
+            case PrimitiveKind::Callback: { step.op = ForwardOp::Callback; } break;
+
+            case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
+        }
+
+        if (IsFloat(param.type)) {
+            step.offset = next_slot(param.xmm_count, &xmm_offset);
+        } else {
+            step.offset = next_slot(param.gpr_count, &gpr_offset);
+        }
+
+        func->steps.Append(step);
     }
 
+    func->args_size = AlignLen(args_offset - 14 * 8, 16);
+    func->stack_size = args_offset - 14 * 8;
     func->forward_fp = (xmm_avail < 8);
+    func->forward_thunk = instance->jit ? GetForwardThunk(6 - gpr_avail, 8 - xmm_avail) : nullptr;
 
     return true;
 }
 
-bool CallData::Prepare(const Napi::CallbackInfo &info)
+bool CallData::Prepare(const napi_value *args)
 {
-    uint64_t *args_ptr = nullptr;
-    uint64_t *gpr_ptr = nullptr;
-    uint64_t *xmm_ptr = nullptr;
+    uint8_t *base;
 
-    // Return through registers unless it's too big
-    if (RG_UNLIKELY(!AllocStack(func->args_size, 16, &args_ptr)))
-        return false;
-    if (RG_UNLIKELY(!AllocStack(8 * 8, 8, &xmm_ptr)))
-        return false;
-    if (RG_UNLIKELY(!AllocStack(6 * 8, 8, &gpr_ptr)))
+    // GPR and XMM slots come first, stack arguments follow
+    if (RG_UNLIKELY(!AllocStack(14 * 8 + func->args_size, 16, &base)))
         return false;
     if (func->ret.use_memory) {
         return_ptr = AllocHeap(func->ret.type->size, 16);
-        *(uint8_t **)(gpr_ptr++) = return_ptr;
+        *(uint8_t **)base = return_ptr;
     }
 
     // Push arguments
-    for (Size i = 0; i < func->parameters.len; i++) {
-        const ParameterInfo &param = func->parameters[i];
-        RG_ASSERT(param.directions >= 1 && param.directions <= 3);
+    for (const ForwardStep &step: func->steps) {
+        const ParameterInfo &param = func->parameters[step.param];
+        RG_ASSERT(param.directions >= 1 && param.directions <= 4);
 
-        Napi::Value value = info[param.offset];
+        Napi::Value value(env, args[param.offset]);
+        uint8_t *dest = base + step.offset;
 
-        switch (param.type->primitive) {
-            case PrimitiveKind::Void: { RG_UNREACHABLE(); } break;
-
-            case PrimitiveKind::Bool: {
+        switch (step.op) {
+            case ForwardOp::Bool: {
                 if (RG_UNLIKELY(!value.IsBoolean())) {
                     ThrowError<Napi::TypeError>(env, "Unexpected %1 value for argmument %2, expected boolean", GetValueType(instance, value), param.offset + 1);
                     return false;
                 }
 
                 bool b = value.As<Napi::Boolean>();
-                *((param.gpr_count ? gpr_ptr : args_ptr)++) = (uint64_t)b;
+                *(uint64_t *)dest = (uint64_t)b;
             } break;
-            case PrimitiveKind::Int8:
-            case PrimitiveKind::UInt8:
-            case PrimitiveKind::Int16:
-            case PrimitiveKind::UInt16:
-            case PrimitiveKind::Int32:
-            case PrimitiveKind::UInt32:
-            case PrimitiveKind::Int64: {
+            case ForwardOp::Integer: {
                 if (RG_UNLIKELY(!value.IsNumber() && !value.IsBigInt())) {
                     ThrowError<Napi::TypeError>(env, "Unexpected %1 value for argument %2, expected number", GetValueType(instance, value), param.offset + 1);
                     return false;
                 }
 
                 int64_t v = CopyNumber<int64_t>(value);
-                *(int64_t *)((param.gpr_count ? gpr_ptr : args_ptr)++) = v;
+                *(int64_t *)dest = v;
             } break;
-            case PrimitiveKind::UInt64: {
+            case ForwardOp::UInt64: {
                 if (RG_UNLIKELY(!value.IsNumber() && !value.IsBigInt())) {
                     ThrowError<Napi::TypeError>(env, "Unexpected %1 value for argument %2, expected number", GetValueType(instance, value), param.offset + 1);
                     return false;
                 }
 
                 uint64_t v = CopyNumber<uint64_t>(value);
-                *((param.gpr_count ? gpr_ptr : args_ptr)++) = v;
+                *(uint64_t *)dest = v;
             } break;
-            case PrimitiveKind::String: {
+            case ForwardOp::String: {
                 const char *str;
                 if (RG_LIKELY(value.IsString())) {
                     str = PushString(value);
@@ -354,9 +512,9 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
                     return false;
                 }
 
-                *(const char **)((param.gpr_count ? gpr_ptr : args_ptr)++) = str;
+                *(const char **)dest = str;
             } break;
-            case PrimitiveKind::String16: {
+            case ForwardOp::String16: {
                 const char16_t *str16;
                 if (RG_LIKELY(value.IsString())) {
                     str16 = PushString16(value);
@@ -369,97 +527,84 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
                     return false;
                 }
 
-                *(const char16_t **)((param.gpr_count ? gpr_ptr : args_ptr)++) = str16;
+                *(const char16_t **)dest = str16;
             } break;
-            case PrimitiveKind::Pointer: {
+            case ForwardOp::Pointer: {
                 void *ptr;
                 if (RG_UNLIKELY(!PushPointer(value, param, &ptr)))
                     return false;
 
-                *(void **)((param.gpr_count ? gpr_ptr : args_ptr)++) = ptr;
+                *(void **)dest = ptr;
             } break;
-            case PrimitiveKind::Record: {
+            case ForwardOp::Callback: {
+                void *ptr;
+
+                if (value.IsFunction()) {
+                    Napi::Function func = value.As<Napi::Function>();
+
+                    ptr = ReserveTrampoline(param.type->ref.proto, func);
+                    if (RG_UNLIKELY(!ptr))
+                        return false;
+                } else if (CheckValueTag(instance, value, param.type->ref.marker)) {
+                    ptr = value.As<Napi::External<void>>().Data();
+                } else if (IsNullOrUndefined(value)) {
+                    ptr = nullptr;
+                } else {
+                    ThrowError<Napi::TypeError>(env, "Unexpected %1 value for argument %2, expected %3", GetValueType(instance, value), param.offset + 1, param.type->name);
+                    return false;
+                }
+
+                *(void **)dest = ptr;
+            } break;
+            case ForwardOp::RecordRegisters: {
                 if (RG_UNLIKELY(!IsObject(value))) {
                     ThrowError<Napi::TypeError>(env, "Unexpected %1 value for argument %2, expected object", GetValueType(instance, value), param.offset + 1);
                     return false;
                 }
+                RG_ASSERT(param.type->size <= 16);
 
                 Napi::Object obj = value.As<Napi::Object>();
 
-                if (param.gpr_count || param.xmm_count) {
-                    RG_ASSERT(param.type->size <= 16);
-
-                    uint64_t buf[2] = {};
-                    if (!PushObject(obj, param.type, (uint8_t *)buf))
-                        return false;
-                    uint64_t *ptr = buf;
+                uint64_t buf[2] = {};
+                if (!PushObject(obj, param.type, (uint8_t *)buf))
+                    return false;
 
-                    if (param.gpr_first) {
-                        *(gpr_ptr++) = *(ptr++);
-                        if (param.gpr_count == 2) {
-                            *(gpr_ptr++) = *(ptr++);
-                        } else if (param.xmm_count == 1) {
-                            *(xmm_ptr++) = *(ptr++);
-                        }
-                    } else {
-                        *(xmm_ptr++) = *(ptr++);
-                        if (param.xmm_count == 2) {
-                            *(xmm_ptr++) = *(ptr++);
-                        } else if (param.gpr_count == 1) {
-                            *(gpr_ptr++) = *(ptr++);
-                        }
-                    }
-                } else if (param.use_memory) {
-                    args_ptr = AlignUp(args_ptr, param.type->align);
-                    if (!PushObject(obj, param.type, (uint8_t *)args_ptr))
-                        return false;
-                    args_ptr += (param.type->size + 7) / 8;
+                *(uint64_t *)dest = buf[0];
+                if (step.offset2 >= 0) {
+                    *(uint64_t *)(base + step.offset2) = buf[1];
                 }
             } break;
-            case PrimitiveKind::Array: { RG_UNREACHABLE(); } break;
-            case PrimitiveKind::Float32: {
-                if (RG_UNLIKELY(!value.IsNumber() && !value.IsBigInt())) {
-                    ThrowError<Napi::TypeError>(env, "Unexpected %1 value for argument %2, expected number", GetValueType(instance, value), param.offset + 1);
+            case ForwardOp::RecordMemory: {
+                if (RG_UNLIKELY(!IsObject(value))) {
+                    ThrowError<Napi::TypeError>(env, "Unexpected %1 value for argument %2, expected object", GetValueType(instance, value), param.offset + 1);
                     return false;
                 }
 
-                float f = CopyNumber<float>(value);
-                uint64_t *ptr = (param.xmm_count ? xmm_ptr : args_ptr)++;
+                Napi::Object obj = value.As<Napi::Object>();
 
-                memset((uint8_t *)ptr + 4, 0, 4);
-                *(float *)ptr = f;
+                if (!PushObject(obj, param.type, dest))
+                    return false;
             } break;
-            case PrimitiveKind::Float64: {
+            case ForwardOp::Float32: {
                 if (RG_UNLIKELY(!value.IsNumber() && !value.IsBigInt())) {
                     ThrowError<Napi::TypeError>(env, "Unexpected %1 value for argument %2, expected number", GetValueType(instance, value), param.offset + 1);
                     return false;
                 }
 
-                double d = CopyNumber<double>(value);
-                *(double *)((param.xmm_count ? xmm_ptr : args_ptr)++) = d;
-            } break;
-            case PrimitiveKind::Callback: {
-                void *ptr;
-
-                if (value.IsFunction()) {
-                    Napi::Function func = value.As<Napi::Function>();
+                float f = CopyNumber<float>(value);
 
-                    ptr = ReserveTrampoline(param.type->ref.proto, func);
-                    if (RG_UNLIKELY(!ptr))
-                        return false;
-                } else if (CheckValueTag(instance, value, param.type->ref.marker)) {
-                    ptr = value.As<Napi::External<void>>().Data();
-                } else if (IsNullOrUndefined(value)) {
-                    ptr = nullptr;
-                } else {
-                    ThrowError<Napi::TypeError>(env, "Unexpected %1 value for argument %2, expected %3", GetValueType(instance, value), param.offset + 1, param.type->name);
+                memset(dest + 4, 0, 4);
+                *(float *)dest = f;
+            } break;
+            case ForwardOp::Float64: {
+                if (RG_UNLIKELY(!value.IsNumber() && !value.IsBigInt())) {
+                    ThrowError<Napi::TypeError>(env, "Unexpected %1 value for argument %2, expected number", GetValueType(instance, value), param.offset + 1);
                     return false;
                 }
 
-                *(void **)((param.gpr_count ? gpr_ptr : args_ptr)++) = ptr;
+                double d = CopyNumber<double>(value);
+                *(double *)dest = d;
             } break;
-
-            case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
         }
     }
 
@@ -470,12 +615,16 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
 
 void CallData::Execute()
 {
+    // Trampolines called once this call is over must not find it, see RelayCallback()
+    CallData *prev_call = exec_call;
     exec_call = this;
+    RG_DEFER { exec_call = prev_call; };
 
 #define PERFORM_CALL(Suffix) \
         ([&]() { \
-            auto ret = (func->forward_fp ? ForwardCallX ## Suffix(func->func, new_sp, &old_sp) \
-                                         : ForwardCall ## Suffix(func->func, new_sp, &old_sp)); \
+            auto ret = (func->forward_thunk ? ((decltype(&ForwardCall ## Suffix))func->forward_thunk)(func->func, new_sp, &old_sp) \
+                        : func->forward_fp ? ForwardCallX ## Suffix(func->func, new_sp, &old_sp) \
+                                           : ForwardCall ## Suffix(func->func, new_sp, &old_sp)); \
             return ret; \
         })()
 
@@ -515,6 +664,7 @@ void CallData::Execute()
         case PrimitiveKind::Float64: { result.d = PERFORM_CALL(DG).xmm0; } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
 #undef PERFORM_CALL
@@ -541,7 +691,7 @@ Napi::Value CallData::Complete()
         case PrimitiveKind::UInt32: return Napi::Number::New(env, (double)result.u32);
         case PrimitiveKind::Int64: return NewBigInt(env, result.i64);
         case PrimitiveKind::UInt64: return NewBigInt(env, result.u64);
-        case PrimitiveKind::String: return result.ptr ? Napi::String::New(env, (const char *)result.ptr) : env.Null();
+        case PrimitiveKind::String: return result.ptr ? NewString(env, (const char *)result.ptr) : env.Null();
         case PrimitiveKind::String16: return result.ptr ? Napi::String::New(env, (const char16_t *)result.ptr) : env.Null();
         case PrimitiveKind::Pointer:
         case PrimitiveKind::Callback: {
@@ -558,7 +708,7 @@ Napi::Value CallData::Complete()
             const uint8_t *ptr = return_ptr ? (const uint8_t *)return_ptr
                                             : (const uint8_t *)&result.buf;
 
-            Napi::Object obj = PopObject(ptr, func->ret.type);
+            Napi::Object obj = PopReturnObject(ptr);
             return obj;
         } break;
         case PrimitiveKind::Array: { RG_UNREACHABLE(); } break;
@@ -566,6 +716,7 @@ Napi::Value CallData::Complete()
         case PrimitiveKind::Float64: return Napi::Number::New(env, result.d);
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
     RG_UNREACHABLE();
@@ -576,7 +727,15 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
     if (RG_UNLIKELY(env.IsExceptionPending()))
         return;
 
-    const TrampolineInfo &trampoline = instance->trampolines[idx];
+    const TrampolineInfo *info = instance->GetTrampolineInfo(idx);
+
+    if (RG_UNLIKELY(!info)) {
+        memset(out_reg, 0, RG_SIZE(*out_reg));
+        ThrowError<Napi::Error>(env, "Cannot use unregistered callback");
+        return;
+    }
+
+    const TrampolineInfo &trampoline = *info;
 
     const FunctionInfo *proto = trampoline.proto;
     Napi::Function func = trampoline.func.Value();
@@ -600,7 +759,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
     // Convert to JS arguments
     for (Size i = 0; i < proto->parameters.len; i++) {
         const ParameterInfo &param = proto->parameters[i];
-        RG_ASSERT(param.directions >= 1 && param.directions <= 3);
+        RG_ASSERT(param.directions >= 1 && param.directions <= 4);
 
         switch (param.type->primitive) {
             case PrimitiveKind::Void: { RG_UNREACHABLE(); } break;
@@ -662,7 +821,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
             case PrimitiveKind::String: {
                 const char *str = *(const char **)((param.gpr_count ? gpr_ptr : args_ptr)++);
 
-                Napi::Value arg = str ? Napi::String::New(env, str) : env.Null();
+                Napi::Value arg = str ? NewString(env, str) : env.Null();
                 arguments.Append(arg);
 
                 if (param.type->dispose) {
@@ -719,12 +878,12 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
                         }
                     }
 
-                    Napi::Object obj = PopObject((const uint8_t *)buf, param.type);
+                    Napi::Value obj = DecodeRelayedObject(env, (const uint8_t *)buf, param.type);
                     arguments.Append(obj);
                 } else if (param.use_memory) {
                     args_ptr = AlignUp(args_ptr, param.type->align);
 
-                    Napi::Object obj = PopObject((const uint8_t *)args_ptr, param.type);
+                    Napi::Value obj = DecodeRelayedObject(env, (const uint8_t *)args_ptr, param.type);
                     arguments.Append(obj);
 
                     args_ptr += (param.type->size + 7) / 8;
@@ -745,14 +904,19 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
             } break;
 
             case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
         }
     }
 
     const TypeInfo *type = proto->ret.type;
 
-    // Make the call
-    napi_value ret = CallSwitchStack(&func, (size_t)arguments.len, arguments.data, old_sp, &mem->stack,
-                                     [](Napi::Function *func, size_t argc, napi_value *argv) { return (napi_value)func->Call(argc, argv); });
+    // Make the call, thread-safe callbacks are relayed from the event loop and can use the JS stack as-is
+    napi_value ret;
+    if (RG_LIKELY(old_sp)) {
+        ret = CallSwitchStack(&func, (size_t)arguments.len, arguments.data, old_sp, &mem->stack, CallRelayed);
+    } else {
+        ret = CallRelayed(&func, (size_t)arguments.len, arguments.data);
+    }
     Napi::Value value(env, ret);
 
     if (RG_UNLIKELY(env.IsExceptionPending()))
@@ -914,6 +1078,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
         } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
     err_guard.Disable();
@@ -922,11 +1087,25 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
 void *GetTrampoline(Size idx, const FunctionInfo *proto)
 {
     bool xmm = proto->forward_fp || IsFloat(proto->ret.type);
+
+    if (idx >= MaxTrampolines * 2)
+        return GetDynamicTrampoline(idx, xmm);
+
     return Trampolines[idx][xmm];
 }
 
 extern "C" void RelayCallback(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegisters *out_reg)
 {
+    if (RG_UNLIKELY(idx >= MaxTrampolines) && ThreadedCallback::Relay(idx, own_sp, caller_sp, out_reg, RG_SIZE(*out_reg)))
+        return;
+
+    // C code called a transient callback after its call was over, from a call stub or a fast call
+    if (RG_UNLIKELY(!exec_call)) {
+        memset(out_reg, 0, RG_SIZE(*out_reg));
+        missed_relay = true;
+        return;
+    }
+
     exec_call->Relay(idx, own_sp, caller_sp, out_reg);
 }
 
@@ -14,8 +14,10 @@
 #if defined(_WIN32) && (defined(__x86_64__) || defined(_M_AMD64))
 
 #include "vendor/libcc/libcc.hh"
+#include "async.hh"
 #include "ffi.hh"
 #include "call.hh"
+#include "records.hh"
 #include "util.hh"
 
 #include <napi.h>
@@ -125,11 +127,12 @@ bool AnalyseFunction(Napi::Env, InstanceData *, FunctionInfo *func)
     }
 
     func->args_size = AlignLen(8 * std::max((Size)4, func->parameters.len + !func->ret.regular), 16);
+    func->stack_size = 8 * std::max((Size)0, func->parameters.len + !func->ret.regular - 4);
 
     return true;
 }
 
-bool CallData::Prepare(const Napi::CallbackInfo &info)
+bool CallData::Prepare(const napi_value *args)
 {
     uint64_t *args_ptr = nullptr;
 
@@ -144,9 +147,9 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
     // Push arguments
     for (Size i = 0; i < func->parameters.len; i++) {
         const ParameterInfo &param = func->parameters[i];
-        RG_ASSERT(param.directions >= 1 && param.directions <= 3);
+        RG_ASSERT(param.directions >= 1 && param.directions <= 4);
 
-        Napi::Value value = info[param.offset];
+        Napi::Value value(env, args[param.offset]);
 
         switch (param.type->primitive) {
             case PrimitiveKind::Void: { RG_UNREACHABLE(); } break;
@@ -283,6 +286,7 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
             } break;
 
             case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
         }
     }
 
@@ -293,7 +297,10 @@ bool CallData::Prepare(const Napi::CallbackInfo &info)
 
 void CallData::Execute()
 {
+    // Trampolines called once this call is over must not find it, see RelayCallback()
+    CallData *prev_call = exec_call;
     exec_call = this;
+    RG_DEFER { exec_call = prev_call; };
 
 #define PERFORM_CALL(Suffix) \
         ([&]() { \
@@ -323,6 +330,7 @@ void CallData::Execute()
         case PrimitiveKind::Float64: { result.d = PERFORM_CALL(D); } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
 #undef PERFORM_CALL
@@ -349,7 +357,7 @@ Napi::Value CallData::Complete()
         case PrimitiveKind::UInt32: return Napi::Number::New(env, (double)result.u32);
         case PrimitiveKind::Int64: return NewBigInt(env, result.i64);
         case PrimitiveKind::UInt64: return NewBigInt(env, result.u64);
-        case PrimitiveKind::String: return result.ptr ? Napi::String::New(env, (const char *)result.ptr) : env.Null();
+        case PrimitiveKind::String: return result.ptr ? NewString(env, (const char *)result.ptr) : env.Null();
         case PrimitiveKind::String16: return result.ptr ? Napi::String::New(env, (const char16_t *)result.ptr) : env.Null();
         case PrimitiveKind::Pointer:
         case PrimitiveKind::Callback: {
@@ -366,7 +374,7 @@ Napi::Value CallData::Complete()
             const uint8_t *ptr = return_ptr ? (const uint8_t *)return_ptr
                                             : (const uint8_t *)&result.buf;
 
-            Napi::Object obj = PopObject(ptr, func->ret.type);
+            Napi::Object obj = PopReturnObject(ptr);
             return obj;
         } break;
         case PrimitiveKind::Array: { RG_UNREACHABLE(); } break;
@@ -374,6 +382,7 @@ Napi::Value CallData::Complete()
         case PrimitiveKind::Float64: return Napi::Number::New(env, result.d);
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
     RG_UNREACHABLE();
@@ -407,7 +416,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
     // Convert to JS arguments
     for (Size i = 0, j = !!return_ptr; i < proto->parameters.len; i++, j++) {
         const ParameterInfo &param = proto->parameters[i];
-        RG_ASSERT(param.directions >= 1 && param.directions <= 3);
+        RG_ASSERT(param.directions >= 1 && param.directions <= 4);
 
         switch (param.type->primitive) {
             case PrimitiveKind::Void: { RG_UNREACHABLE(); } break;
@@ -479,7 +488,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
                 const char *str = *(const char **)(j < 4 ? gpr_ptr + j : args_ptr);
                 args_ptr += (j >= 4);
 
-                Napi::Value arg = str ? Napi::String::New(env, str) : env.Null();
+                Napi::Value arg = str ? NewString(env, str) : env.Null();
                 arguments.Append(arg);
 
                 if (param.type->dispose) {
@@ -524,7 +533,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
                 }
                 args_ptr += (j >= 4);
 
-                Napi::Object obj2 = PopObject(ptr, param.type);
+                Napi::Value obj2 = DecodeRelayedObject(env, ptr, param.type);
                 arguments.Append(obj2);
             } break;
             case PrimitiveKind::Array: { RG_UNREACHABLE(); } break;
@@ -544,14 +553,19 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
             } break;
 
             case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
         }
     }
 
     const TypeInfo *type = proto->ret.type;
 
-    // Make the call
-    napi_value ret = CallSwitchStack(&func, (size_t)arguments.len, arguments.data, old_sp, &mem->stack,
-                                     [](Napi::Function *func, size_t argc, napi_value *argv) { return (napi_value)func->Call(argc, argv); });
+    // Make the call, thread-safe callbacks are relayed from the event loop and can use the JS stack as-is
+    napi_value ret;
+    if (RG_LIKELY(old_sp)) {
+        ret = CallSwitchStack(&func, (size_t)arguments.len, arguments.data, old_sp, &mem->stack, CallRelayed);
+    } else {
+        ret = CallRelayed(&func, (size_t)arguments.len, arguments.data);
+    }
     Napi::Value value(env, ret);
 
     if (RG_UNLIKELY(env.IsExceptionPending()))
@@ -694,6 +708,7 @@ void CallData::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegister
         } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
     err_guard.Disable();
@@ -707,6 +722,16 @@ void *GetTrampoline(Size idx, const FunctionInfo *proto)
 
 extern "C" void RelayCallback(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegisters *out_reg)
 {
+    if (RG_UNLIKELY(idx >= MaxTrampolines) && ThreadedCallback::Relay(idx, own_sp, caller_sp, out_reg, RG_SIZE(*out_reg)))
+        return;
+
+    // C code called a transient callback after its call was over, from a call stub or a fast call
+    if (RG_UNLIKELY(!exec_call)) {
+        memset(out_reg, 0, RG_SIZE(*out_reg));
+        missed_relay = true;
+        return;
+    }
+
     exec_call->Relay(idx, own_sp, caller_sp, out_reg);
 }
 
@@ -0,0 +1,644 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+#include "vendor/libcc/libcc.hh"
+#include "async.hh"
+#include "call.hh"
+#include "ffi.hh"
+#include "trace.hh"
+#include "util.hh"
+
+#include <napi.h>
+
+namespace RG {
+
+AsyncCall::AsyncCall(Napi::Env env, InstanceData *instance, const FunctionInfo *func,
+                     InstanceMemory *mem, Napi::Function callback)
+    : env(env), func(func->Ref()), call(env, instance, func, mem)
+{
+    napi_status status = napi_create_reference(env, callback, 1, &this->callback);
+    RG_ASSERT(status == napi_ok);
+}
+
+AsyncCall::AsyncCall(Napi::Env env, InstanceData *instance, const FunctionInfo *func,
+                     InstanceMemory *mem, napi_deferred deferred)
+    : env(env), func(func->Ref()), call(env, instance, func, mem), deferred(deferred)
+{
+}
+
+AsyncCall::~AsyncCall()
+{
+    for (napi_ref ref: pins) {
+        napi_delete_reference(env, ref);
+    }
+    if (error) {
+        napi_delete_reference(env, error);
+    }
+    if (callback) {
+        napi_delete_reference(env, callback);
+    }
+
+    func->Unref();
+}
+
+bool AsyncCall::Prepare(const napi_value *args)
+{
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    measured = func->stats || instance->tracer;
+
+    int64_t start = measured ? GetStatsTime() : 0;
+
+    // Span lengths are not given by JS code, see ExpandSpans()
+    napi_value expanded[MaxExpandedArguments];
+    if (RG_UNLIKELY(func->hidden_parameters)) {
+        prepared = ExpandSpans(env, func, args, expanded) && call.Prepare(expanded);
+        args = expanded;
+    } else {
+        prepared = call.Prepare(args);
+    }
+
+    if (measured) {
+        int64_t end = GetStatsTime();
+
+        if (func->stats) {
+            func->stats->calls++;
+            func->stats->errors += !prepared;
+            func->stats->prepare_time += end - start;
+        }
+        if (instance->tracer) {
+            CallTracer::SummarizeArguments(env, func, args, &trace);
+        }
+
+        // Overwritten by Execute() for successful calls
+        trace.u.call.start = start;
+        trace.u.call.end = end;
+    }
+
+    if (!prepared) {
+        napi_value err;
+        napi_valuetype type;
+
+        napi_get_and_clear_last_exception(env, &err);
+        napi_typeof(env, err, &type);
+
+        // Only objects can be referenced, wrap anything else in an Error
+        if (type != napi_object) {
+            napi_value msg;
+
+            napi_coerce_to_string(env, err, &msg);
+            napi_create_error(env, nullptr, msg, &err);
+        }
+
+        napi_status status = napi_create_reference(env, err, 1, &error);
+        RG_ASSERT(status == napi_ok);
+
+        return false;
+    }
+
+    for (const ParameterInfo &param: func->parameters) {
+        Napi::Value value(env, args[param.offset]);
+
+        // Record arrays share their memory with C code, keep them alive too
+        bool pin = (param.directions & 4) ||
+                   (param.type->primitive == PrimitiveKind::Pointer &&
+                    CheckValueTag(instance, value, param.type->ref.marker));
+
+        if (pin && value.Type() == napi_object) {
+            napi_ref ref;
+
+            napi_status status = napi_create_reference(env, value, 1, &ref);
+            RG_ASSERT(status == napi_ok);
+
+            pins.Append(ref);
+        }
+    }
+
+    return true;
+}
+
+void AsyncCall::Execute()
+{
+    if (!prepared)
+        return;
+
+    if (measured) {
+        int64_t start = GetStatsTime();
+        call.Execute();
+        int64_t end = GetStatsTime();
+
+        if (func->stats) {
+            func->stats->execute_time += end - start;
+        }
+
+        trace.thread = CallTracer::GetThreadID();
+        trace.u.call.start = start;
+        trace.u.call.end = end;
+        trace.u.call.native_time = end - start;
+    } else {
+        call.Execute();
+    }
+}
+
+napi_value AsyncCall::Complete()
+{
+    if (measured) {
+        InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+        int64_t start = GetStatsTime();
+        napi_value ret = call.Complete();
+
+        if (func->stats) {
+            func->stats->complete_time += GetStatsTime() - start;
+        }
+        if (instance->tracer) {
+            trace.types[2] = CallTracer::SummarizeValue(env, ret, &trace.u.call.ret);
+        }
+
+        return ret;
+    } else {
+        return call.Complete();
+    }
+}
+
+void AsyncCall::RecordTrace()
+{
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    // Tracing may have been stopped (or restarted) while the call was running
+    if (!instance->tracer)
+        return;
+
+    trace.kind = TraceKind::AsyncCall;
+    trace.flags = !prepared;
+
+    instance->tracer->Record(func, &trace);
+}
+
+void AsyncCall::Finish()
+{
+    RG_DEFER {
+        if (measured) {
+            RecordTrace();
+        }
+    };
+
+    if (deferred) {
+        if (prepared) {
+            napi_resolve_deferred(env, deferred, Complete());
+        } else {
+            napi_value err;
+            napi_get_reference_value(env, error, &err);
+
+            napi_reject_deferred(env, deferred, err);
+        }
+
+        return;
+    }
+
+    napi_value self = env.Null();
+    napi_value cb;
+    napi_get_reference_value(env, callback, &cb);
+
+    if (prepared) {
+        napi_value args[] = {
+            env.Null(),
+            Complete()
+        };
+
+        napi_call_function(env, self, cb, RG_LEN(args), args, nullptr);
+    } else {
+        napi_value err;
+        napi_get_reference_value(env, error, &err);
+
+        napi_call_function(env, self, cb, 1, &err, nullptr);
+    }
+}
+
+void AsyncEngine::SharedState::Unref()
+{
+    if (!--refcount) {
+        delete this;
+    }
+}
+
+AsyncEngine::AsyncEngine(Napi::Env env, int threads)
+    : env(env), max_threads(threads)
+{
+    shared = new SharedState();
+
+    napi_value name = Napi::String::New(env, "Koffi");
+    napi_status status = napi_create_threadsafe_function(env, nullptr, nullptr, name, 0, 1,
+                                                         shared, FinalizeQueue, shared,
+                                                         DispatchCompletions, &shared->tsfn);
+    RG_ASSERT(status == napi_ok);
+
+    // Only keep the event loop alive while calls are running
+    napi_unref_threadsafe_function(env, shared->tsfn);
+}
+
+AsyncEngine::~AsyncEngine()
+{
+    // Workers finish the queued calls before they exit
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+
+        stop = true;
+        queue_cv.notify_all();
+    }
+    for (std::thread &worker: workers) {
+        worker.join();
+    }
+
+    // No worker can touch the shared state anymore
+    HeapArray<AsyncCall *> calls;
+    std::swap(calls, shared->done);
+
+    if (!shared->closed) {
+        shared->closed = true;
+        napi_release_threadsafe_function(shared->tsfn, napi_tsfn_abort);
+    }
+
+    for (AsyncCall *call: calls) {
+        delete call;
+    }
+
+    shared->Unref();
+}
+
+void AsyncEngine::Queue(AsyncCall *call)
+{
+    if (!shared->running++) {
+        napi_ref_threadsafe_function(env, shared->tsfn);
+    }
+
+    std::lock_guard<std::mutex> lock(queue_mutex);
+
+    queue.Append(call);
+
+    // Wake up a single worker, or start a new one if they are all busy
+    if (idle_threads) {
+        queue_cv.notify_one();
+    } else if (workers.len < max_threads) {
+        std::thread *worker = workers.AppendDefault();
+        *worker = std::thread(&AsyncEngine::RunWorker, this);
+    }
+}
+
+void AsyncEngine::RunWorker()
+{
+    std::unique_lock<std::mutex> lock(queue_mutex);
+
+    for (;;) {
+        while (!queue.len && !stop) {
+            idle_threads++;
+            queue_cv.wait(lock);
+            idle_threads--;
+        }
+        if (!queue.len)
+            break;
+
+        AsyncCall *call = queue[0];
+        queue.RemoveFirst();
+
+        lock.unlock();
+
+        call->Execute();
+
+        // Only wake up the JS thread once, it will pick up everything that is
+        // ready when it gets to it.
+        {
+            std::lock_guard<std::mutex> lock_done(shared->mutex);
+
+            // Once the environment is going away, there is nothing left to give the result to,
+            // but the call must still be freed, which the engine destructor does.
+            if (!shared->closed && !shared->done.len) {
+                napi_call_threadsafe_function(shared->tsfn, nullptr, napi_tsfn_nonblocking);
+            }
+            shared->done.Append(call);
+        }
+
+        lock.lock();
+    }
+}
+
+void AsyncEngine::DispatchCompletions(napi_env env, napi_value, void *ctx, void *)
+{
+    SharedState *shared = (SharedState *)ctx;
+
+    // Teardown is handled by the AsyncEngine destructor
+    if (!env)
+        return;
+
+    HeapArray<AsyncCall *> calls;
+    {
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        std::swap(calls, shared->done);
+    }
+
+    for (Size i = 0; i < calls.len; i++) {
+        AsyncCall *call = calls[i];
+
+        {
+            Napi::HandleScope scope(env);
+            call->Finish();
+        }
+        delete call;
+
+        if (!--shared->running) {
+            napi_unref_threadsafe_function(env, shared->tsfn);
+        }
+
+        bool pending;
+        napi_is_exception_pending(env, &pending);
+
+        // Report exceptions thrown by callbacks right away, the same way Node does for
+        // other asynchronous callbacks, so that the next completions can proceed.
+        if (RG_UNLIKELY(pending)) {
+            napi_value err;
+
+            napi_get_and_clear_last_exception(env, &err);
+            napi_fatal_exception(env, err);
+        }
+    }
+}
+
+void AsyncEngine::FinalizeQueue(napi_env, void *data, void *)
+{
+    SharedState *shared = (SharedState *)data;
+
+    {
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        shared->closed = true;
+    }
+
+    shared->Unref();
+}
+
+static std::mutex threaded_mutex;
+static HashMap<Size, ThreadedCallback *> threaded_callbacks;
+static std::atomic_int threaded_count {0};
+static uint32_t threaded_trampolines = 0; // Static trampolines only
+
+ThreadedCallback *ThreadedCallback::Create(Napi::Env env, InstanceData *instance, Size idx,
+                                           const FunctionInfo *proto, bool blocking)
+{
+    RG_ASSERT(idx >= MaxTrampolines);
+
+    std::lock_guard<std::mutex> lock(threaded_mutex);
+
+    // Foreign threads cannot tell instances apart, so each static trampoline can only
+    // be used by one thread-safe callback at a time. Dynamic ones are allocated process-wide.
+    if (RG_UNLIKELY(idx < MaxTrampolines * 2 && (threaded_trampolines & (1u << (idx - MaxTrampolines))))) {
+        ThrowError<Napi::Error>(env, "Too many registered callbacks are in use (max = %1)", MaxTrampolines);
+        return nullptr;
+    }
+
+    ThreadedCallback *cb = new ThreadedCallback();
+
+    cb->instance = instance;
+    cb->idx = idx;
+    cb->proto = proto;
+    cb->blocking = blocking;
+    cb->thread = std::this_thread::get_id();
+
+    napi_value name = Napi::String::New(env, "Koffi");
+    napi_status status = napi_create_threadsafe_function(env, nullptr, nullptr, name, 0, 1,
+                                                         cb, FinalizeQueue, cb,
+                                                         DispatchJobs, &cb->tsfn);
+    RG_ASSERT(status == napi_ok);
+
+    threaded_callbacks.Set(idx, cb);
+    threaded_count++;
+    if (idx < MaxTrampolines * 2) {
+        threaded_trampolines |= 1u << (idx - MaxTrampolines);
+    }
+
+    return cb;
+}
+
+void ThreadedCallback::Close(bool abort)
+{
+    {
+        std::lock_guard<std::mutex> lock(threaded_mutex);
+
+        threaded_callbacks.Remove(idx);
+        threaded_count--;
+        if (idx < MaxTrampolines * 2) {
+            threaded_trampolines &= ~(1u << (idx - MaxTrampolines));
+        }
+    }
+
+    // The trampoline may be registered again right away, make sure
+    // late jobs don't end up calling the new function.
+    active = false;
+
+    HeapArray<Job *> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (!closed) {
+            closed = true;
+            napi_release_threadsafe_function(tsfn, abort ? napi_tsfn_abort : napi_tsfn_release);
+        }
+        std::swap(pending, jobs);
+    }
+
+    // Don't leave native threads hanging, the environment may be going away
+    for (Job *job: pending) {
+        memset(job->out_reg, 0, (size_t)job->out_size);
+        Complete(job);
+    }
+
+    Unref();
+}
+
+bool ThreadedCallback::Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, void *out_reg, Size out_size)
+{
+    // Fast path for normal registered callbacks
+    if (!threaded_count.load(std::memory_order_relaxed))
+        return false;
+
+    ThreadedCallback *cb;
+    {
+        std::lock_guard<std::mutex> lock(threaded_mutex);
+
+        cb = threaded_callbacks.FindValue(idx, nullptr);
+
+        if (!cb || cb->thread == std::this_thread::get_id())
+            return false;
+
+        cb->refcount++;
+    }
+
+    cb->Run(own_sp, caller_sp, out_reg, out_size);
+    cb->Unref();
+
+    return true;
+}
+
+uint32_t ThreadedCallback::GetTrampolines()
+{
+    std::lock_guard<std::mutex> lock(threaded_mutex);
+    return threaded_trampolines;
+}
+
+void ThreadedCallback::Run(uint8_t *own_sp, uint8_t *caller_sp, void *out_reg, Size out_size)
+{
+    if (blocking) {
+        // The registers and the stack of this thread stay valid while we wait
+        Job job = {};
+
+        job.own_sp = own_sp;
+        job.caller_sp = caller_sp;
+        job.out_reg = (uint8_t *)out_reg;
+        job.out_size = out_size;
+
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (RG_UNLIKELY(closed)) {
+            memset(out_reg, 0, (size_t)out_size);
+            return;
+        }
+
+        // Only wake up the JS thread once for each batch of jobs
+        if (!jobs.len) {
+            napi_call_threadsafe_function(tsfn, nullptr, napi_tsfn_nonblocking);
+        }
+        jobs.Append(&job);
+
+        while (!job.done) {
+            cv.wait(lock);
+        }
+    } else {
+        // Copy the saved registers, which sit right below the output registers, and the
+        // stack arguments. The relay code expects the same relative 16-byte alignment.
+        Size regs_len = (uint8_t *)out_reg - own_sp;
+        Size out_offset = AlignLen(RG_SIZE(Job), 16) + regs_len;
+        Size stack_offset = AlignLen(out_offset + out_size, 16);
+        Size total_len = stack_offset + proto->stack_size;
+
+        RG_ASSERT(regs_len >= 0);
+
+        uint8_t *ptr = (uint8_t *)Allocator::Allocate(nullptr, total_len);
+        Job *job = (Job *)ptr;
+
+        job->own_sp = ptr + out_offset - regs_len;
+        job->caller_sp = ptr + stack_offset;
+        job->out_reg = ptr + out_offset;
+        job->out_size = out_size;
+        job->len = total_len;
+        job->done = false;
+
+        memcpy(job->own_sp, own_sp, (size_t)regs_len);
+        memcpy(job->caller_sp, caller_sp, (size_t)proto->stack_size);
+
+        // Fire and forget, only void callbacks are allowed in this mode
+        memset(out_reg, 0, (size_t)out_size);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (RG_UNLIKELY(closed)) {
+            Allocator::Release(nullptr, ptr, total_len);
+            return;
+        }
+
+        if (!jobs.len) {
+            napi_call_threadsafe_function(tsfn, nullptr, napi_tsfn_nonblocking);
+        }
+        jobs.Append(job);
+    }
+}
+
+void ThreadedCallback::Complete(Job *job)
+{
+    if (blocking) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        job->done = true;
+        cv.notify_all();
+    } else {
+        Allocator::Release(nullptr, job, job->len);
+    }
+}
+
+void ThreadedCallback::Unref()
+{
+    if (!--refcount) {
+        delete this;
+    }
+}
+
+void ThreadedCallback::DispatchJobs(napi_env env, napi_value, void *ctx, void *)
+{
+    ThreadedCallback *cb = (ThreadedCallback *)ctx;
+
+    HeapArray<Job *> jobs;
+    {
+        std::lock_guard<std::mutex> lock(cb->mutex);
+        std::swap(jobs, cb->jobs);
+    }
+
+    for (Job *job: jobs) {
+        memset(job->out_reg, 0, (size_t)job->out_size);
+
+        // Teardown or unregistration, let the native code go on with zeroed results
+        if (env && cb->active) {
+            InstanceData *instance = cb->instance;
+            RG_ASSERT(instance->memories.len);
+
+            {
+                Napi::HandleScope scope(env);
+
+                CallData call(env, instance, cb->proto, instance->memories[0]);
+                call.Relay(cb->idx, job->own_sp, job->caller_sp, (BackRegisters *)job->out_reg);
+            }
+
+            bool pending;
+            napi_is_exception_pending(env, &pending);
+
+            // Nobody can catch this exception, report it the same way Node does for
+            // exceptions thrown inside asynchronous callbacks.
+            if (RG_UNLIKELY(pending)) {
+                napi_value err;
+
+                napi_get_and_clear_last_exception(env, &err);
+                napi_fatal_exception(env, err);
+            }
+        }
+
+        cb->Complete(job);
+    }
+}
+
+void ThreadedCallback::FinalizeQueue(napi_env, void *data, void *)
+{
+    ThreadedCallback *cb = (ThreadedCallback *)data;
+
+    HeapArray<Job *> jobs;
+    {
+        std::lock_guard<std::mutex> lock(cb->mutex);
+
+        cb->closed = true;
+        std::swap(jobs, cb->jobs);
+    }
+
+    for (Job *job: jobs) {
+        memset(job->out_reg, 0, (size_t)job->out_size);
+        cb->Complete(job);
+    }
+
+    cb->Unref();
+}
+
+}
@@ -0,0 +1,164 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+#pragma once
+
+#include "vendor/libcc/libcc.hh"
+#include "call.hh"
+#include "ffi.hh"
+#include "trace.hh"
+
+#include <napi.h>
+#include <condition_variable>
+#include <thread>
+
+namespace RG {
+
+class AsyncCall {
+    Napi::Env env;
+    const FunctionInfo *func;
+
+    CallData call;
+    bool prepared = false;
+
+    // One or the other
+    napi_ref callback = nullptr;
+    napi_deferred deferred = nullptr;
+
+    napi_ref error = nullptr;
+
+    // Keep pinned buffers alive until the call is over
+    LocalArray<napi_ref, MaxParameters> pins;
+
+    // Filled when statistics or tracing are enabled
+    bool measured = false;
+    TraceRecord trace = {};
+
+public:
+    AsyncCall(Napi::Env env, InstanceData *instance, const FunctionInfo *func,
+              InstanceMemory *mem, Napi::Function callback);
+    AsyncCall(Napi::Env env, InstanceData *instance, const FunctionInfo *func,
+              InstanceMemory *mem, napi_deferred deferred);
+    ~AsyncCall();
+
+    Napi::Env Env() const { return env; }
+
+    bool Prepare(const napi_value *args);
+    void DumpForward() { call.DumpForward(); }
+
+    // Runs on one of the Koffi worker threads
+    void Execute();
+
+    // Back on the JS thread, calls the JS callback with (err, result) or settles the promise
+    void Finish();
+
+private:
+    napi_value Complete();
+    void RecordTrace();
+};
+
+class AsyncEngine {
+    struct SharedState {
+        std::mutex mutex;
+        HeapArray<AsyncCall *> done;
+        bool closed = false;
+
+        napi_threadsafe_function tsfn = nullptr;
+        int running = 0; // JS thread only
+
+        // Owned by the engine and by the threadsafe function
+        std::atomic_int refcount {2};
+
+        void Unref();
+    };
+
+    Napi::Env env;
+    SharedState *shared;
+
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    BucketArray<AsyncCall *> queue;
+    bool stop = false;
+
+    int max_threads;
+    int idle_threads = 0;
+    LocalArray<std::thread, MaxAsyncThreads> workers;
+
+public:
+    AsyncEngine(Napi::Env env, int threads);
+    ~AsyncEngine();
+
+    void Queue(AsyncCall *call);
+
+private:
+    void RunWorker();
+
+    static void DispatchCompletions(napi_env env, napi_value, void *ctx, void *);
+    static void FinalizeQueue(napi_env, void *data, void *);
+};
+
+class ThreadedCallback {
+    struct Job {
+        uint8_t *own_sp;
+        uint8_t *caller_sp;
+        uint8_t *out_reg;
+        Size out_size;
+
+        Size len; // Non-blocking mode only
+        bool done; // Blocking mode only
+    };
+
+    InstanceData *instance;
+    Size idx;
+    const FunctionInfo *proto;
+    bool blocking;
+    std::thread::id thread;
+
+    napi_threadsafe_function tsfn = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    HeapArray<Job *> jobs;
+    bool closed = false;
+
+    bool active = true; // JS thread only
+
+    // Owned by the registration, by the threadsafe function and by running relays
+    std::atomic_int refcount {2};
+
+public:
+    static ThreadedCallback *Create(Napi::Env env, InstanceData *instance, Size idx,
+                                    const FunctionInfo *proto, bool blocking);
+
+    // Called on the JS thread, jobs that are still queued are completed with zeroed results
+    void Close(bool abort);
+
+    // Returns false if the calling thread is the JS thread, and the callback should run directly
+    static bool Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, void *out_reg, Size out_size);
+
+    // Static trampolines used by thread-safe callbacks, shared by all instances
+    static uint32_t GetTrampolines();
+
+private:
+    ThreadedCallback() = default;
+
+    void Run(uint8_t *own_sp, uint8_t *caller_sp, void *out_reg, Size out_size);
+    void Complete(Job *job);
+
+    void Unref();
+
+    static void DispatchJobs(napi_env env, napi_value, void *ctx, void *);
+    static void FinalizeQueue(napi_env, void *data, void *);
+};
+
+}
@@ -14,12 +14,18 @@
 #include "vendor/libcc/libcc.hh"
 #include "call.hh"
 #include "ffi.hh"
+#include "records.hh"
 #include "util.hh"
 
 #include <napi.h>
+#if NODE_WANT_INTERNALS
+    #include <js_native_api_v8.h>
+#endif
 
 namespace RG {
 
+RG_THREAD_LOCAL bool missed_relay = false;
+
 CallData::CallData(Napi::Env env, InstanceData *instance, const FunctionInfo *func, InstanceMemory *mem)
     : env(env), instance(instance), func(func),
       mem(mem), old_stack_mem(mem->stack), old_heap_mem(mem->heap)
@@ -36,6 +42,12 @@ CallData::~CallData()
     for (const OutArgument &out: out_arguments) {
         napi_delete_reference(env, out.ref);
     }
+    for (const SpanArgument &arg: span_arguments) {
+        napi_delete_reference(env, arg.ref);
+        if (arg.buffer) {
+            napi_delete_reference(env, arg.buffer);
+        }
+    }
 
     mem->stack = old_stack_mem;
     mem->heap = old_heap_mem;
@@ -48,6 +60,24 @@ CallData::~CallData()
     }
 }
 
+// Only valid for return types that map to a TypedArray, see GetTypedArrayType()
+void CallData::CompleteRaw(void *dest)
+{
+    RG_ASSERT(GetTypedArrayType(func->ret.type) >= 0);
+
+    PopOutArguments();
+    memcpy(dest, &result, (size_t)func->ret.type->size);
+}
+
+// Only valid for record return types, target is an object or a TypedArray
+Napi::Value CallData::CompleteInto(Napi::Object target)
+{
+    RG_ASSERT(func->ret.type->primitive == PrimitiveKind::Record);
+
+    return_target = target;
+    return Complete();
+}
+
 const char *CallData::PushString(Napi::Value value)
 {
     RG_ASSERT(value.IsString());
@@ -61,6 +91,27 @@ const char *CallData::PushString(Napi::Value value)
     buf.ptr = (char *)mem->heap.ptr;
     buf.len = std::max((Size)0, mem->heap.len - Kibibytes(32));
 
+#if NODE_WANT_INTERNALS
+    // One-byte strings that only contain ASCII characters are valid UTF-8 as is
+    {
+        v8::Isolate *isolate = v8::Isolate::GetCurrent();
+        v8::Local<v8::String> str8 = v8impl::V8LocalValueFromJsValue(value).As<v8::String>();
+
+        if (str8->IsOneByte() && str8->Length() < buf.len) {
+            Size len8 = (Size)str8->WriteOneByte(isolate, (uint8_t *)buf.ptr, 0, -1, v8::String::NO_NULL_TERMINATION);
+
+            if (RG_LIKELY(IsAsciiString(MakeSpan(buf.ptr, len8)))) {
+                buf.ptr[len8] = 0;
+
+                mem->heap.ptr += len8 + 1;
+                mem->heap.len -= len8 + 1;
+
+                return buf.ptr;
+            }
+        }
+    }
+#endif
+
     status = napi_get_value_string_utf8(env, value, buf.ptr, (size_t)buf.len, &len);
     RG_ASSERT(status == napi_ok);
 
@@ -78,6 +129,10 @@ const char *CallData::PushString(Napi::Value value)
         buf.ptr = (char *)Allocator::Allocate(&call_alloc, (Size)len);
         buf.len = (Size)len;
 
+        if (RG_UNLIKELY(instance->stats)) {
+            instance->heap_overflows++;
+        }
+
         status = napi_get_value_string_utf8(env, value, buf.ptr, (size_t)buf.len, &len);
         RG_ASSERT(status == napi_ok);
     }
@@ -115,6 +170,10 @@ const char16_t *CallData::PushString16(Napi::Value value)
         buf.ptr = (char16_t *)Allocator::Allocate(&call_alloc, (Size)len * 2);
         buf.len = (Size)len;
 
+        if (RG_UNLIKELY(instance->stats)) {
+            instance->heap_overflows++;
+        }
+
         status = napi_get_value_string_utf16(env, value, buf.ptr, (size_t)buf.len, &len);
         RG_ASSERT(status == napi_ok);
     }
@@ -122,6 +181,58 @@ const char16_t *CallData::PushString16(Napi::Value value)
     return buf.ptr;
 }
 
+#if NODE_WANT_INTERNALS
+
+static Napi::Value GetMember(Napi::Object obj, const RecordMember &member)
+{
+    Napi::Env env = obj.Env();
+
+    v8::Isolate *isolate = v8::Isolate::GetCurrent();
+    v8::Local<v8::Context> context = isolate->GetCurrentContext();
+    v8::Local<v8::Object> obj8 = v8impl::V8LocalValueFromJsValue(obj).As<v8::Object>();
+
+    v8::TryCatch try_catch(isolate);
+    v8::Local<v8::Value> value;
+
+    if (RG_UNLIKELY(!obj8->Get(context, member.key.Get(isolate)).ToLocal(&value))) {
+        napi_throw(env, v8impl::JsValueFromV8LocalValue(try_catch.Exception()));
+        return Napi::Value();
+    }
+
+    return Napi::Value(env, v8impl::JsValueFromV8LocalValue(value));
+}
+
+static void SetMember(Napi::Object obj, const RecordMember &member, napi_value value)
+{
+    v8::Isolate *isolate = v8::Isolate::GetCurrent();
+    v8::Local<v8::Context> context = isolate->GetCurrentContext();
+    v8::Local<v8::Object> obj8 = v8impl::V8LocalValueFromJsValue(obj).As<v8::Object>();
+
+    v8::TryCatch try_catch(isolate);
+
+    if (RG_UNLIKELY(obj8->Set(context, member.key.Get(isolate), v8impl::V8LocalValueFromJsValue(value)).IsNothing())) {
+        napi_throw(obj.Env(), v8impl::JsValueFromV8LocalValue(try_catch.Exception()));
+    }
+}
+
+#else
+
+// N-API already internalizes names given to napi_get/set_named_property. Going through
+// a persistent array of keys instead is slower, because each element access is a full
+// property lookup.
+
+static inline Napi::Value GetMember(Napi::Object obj, const RecordMember &member)
+{
+    return obj.Get(member.name);
+}
+
+static inline void SetMember(Napi::Object obj, const RecordMember &member, napi_value value)
+{
+    obj.Set(member.name, value);
+}
+
+#endif
+
 bool CallData::PushObject(Napi::Object obj, const TypeInfo *type, uint8_t *origin, int16_t realign)
 {
     RG_ASSERT(IsObject(obj));
@@ -129,7 +240,7 @@ bool CallData::PushObject(Napi::Object obj, const TypeInfo *type, uint8_t *origi
 
     for (Size i = 0; i < type->members.len; i++) {
         const RecordMember &member = type->members[i];
-        Napi::Value value = obj.Get(member.name);
+        Napi::Value value = GetMember(obj, member);
 
         if (RG_UNLIKELY(value.IsUndefined())) {
             ThrowError<Napi::TypeError>(env, "Missing expected object property '%1'", member.name);
@@ -337,6 +448,7 @@ bool CallData::PushObject(Napi::Object obj, const TypeInfo *type, uint8_t *origi
             } break;
 
             case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
         }
     }
 
@@ -551,6 +663,7 @@ bool CallData::PushNormalArray(Napi::Array array, Size len, const TypeInfo *ref,
         } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
 #undef PUSH_ARRAY
@@ -625,6 +738,9 @@ bool CallData::PushStringArray(Napi::Value obj, const TypeInfo *type, uint8_t *o
 
 bool CallData::PushPointer(Napi::Value value, const ParameterInfo &param, void **out_ptr)
 {
+    if (RG_UNLIKELY(param.span && (param.directions & 2)))
+        return PushSpan(value, param, out_ptr);
+
     switch (value.Type()) {
         case napi_undefined:
         case napi_null: {
@@ -645,6 +761,14 @@ bool CallData::PushPointer(Napi::Value value, const ParameterInfo &param, void *
         case napi_object: {
             uint8_t *ptr = nullptr;
 
+            // Record arrays made by koffi.records() are given to C code as-is, without any copy
+            if (param.type->ref.type->primitive == PrimitiveKind::Record &&
+                    CheckValueTag(instance, value, param.type->ref.marker))
+                return GetRecordArrayMemory(env, value.As<Napi::Object>(), param.type->ref.type, (uint8_t **)out_ptr);
+
+            if (param.directions & 4)
+                return PushPinned(value, param, out_ptr);
+
             if (value.IsArray()) {
                 Napi::Array array = value.As<Napi::Array>();
 
@@ -716,6 +840,215 @@ unexpected:
     return false;
 }
 
+bool CallData::PushPinned(Napi::Value value, const ParameterInfo &param, void **out_ptr)
+{
+    if (value.IsTypedArray()) {
+        napi_typedarray_type type;
+        void *ptr;
+
+        napi_status status = napi_get_typedarray_info(env, value, &type, nullptr, &ptr, nullptr, nullptr);
+        RG_ASSERT(status == napi_ok);
+
+        int expected = GetTypedArrayType(param.type->ref.type);
+
+        if (RG_UNLIKELY(expected >= 0 && (int)type != expected)) {
+            ThrowError<Napi::TypeError>(env, "Cannot use %1 value for %2 array", GetValueType(instance, value), param.type->ref.type->name);
+            return false;
+        }
+
+        *out_ptr = ptr;
+        return true;
+    } else if (value.IsArrayBuffer()) {
+        *out_ptr = value.As<Napi::ArrayBuffer>().Data();
+        return true;
+    } else if (value.IsDataView()) {
+        void *ptr;
+
+        napi_status status = napi_get_dataview_info(env, value, nullptr, &ptr, nullptr, nullptr);
+        RG_ASSERT(status == napi_ok);
+
+        *out_ptr = ptr;
+        return true;
+    }
+
+    ThrowError<Napi::TypeError>(env, "Unexpected %1 value for pinned argument %2, expected TypedArray, ArrayBuffer or DataView", GetValueType(instance, value), param.offset + 1);
+    return false;
+}
+
+// Length is counted in elements, or in bytes for void spans
+static bool GetSpanMemory(Napi::Env env, Napi::Value value, const TypeInfo *span, int argument,
+                          void **out_ptr, Size *out_len)
+{
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    const TypeInfo *ref = span->ref.type;
+    Size bytes;
+
+    if (IsNullOrUndefined(value)) {
+        *out_ptr = nullptr;
+        *out_len = 0;
+
+        return true;
+    } else if (value.IsTypedArray()) {
+        Napi::TypedArray array = value.As<Napi::TypedArray>();
+        int expected = GetTypedArrayType(ref);
+
+        if (RG_UNLIKELY(expected >= 0 && (int)array.TypedArrayType() != expected)) {
+            ThrowError<Napi::TypeError>(env, "Cannot use %1 value for %2", GetValueType(instance, value), span->name);
+            return false;
+        }
+
+        napi_status status = napi_get_typedarray_info(env, value, nullptr, nullptr, out_ptr, nullptr, nullptr);
+        RG_ASSERT(status == napi_ok);
+
+        bytes = (Size)array.ByteLength();
+    } else if (value.IsArrayBuffer()) {
+        Napi::ArrayBuffer buffer = value.As<Napi::ArrayBuffer>();
+
+        *out_ptr = buffer.Data();
+        bytes = (Size)buffer.ByteLength();
+    } else if (value.IsDataView()) {
+        size_t len;
+
+        napi_status status = napi_get_dataview_info(env, value, &len, out_ptr, nullptr, nullptr);
+        RG_ASSERT(status == napi_ok);
+
+        bytes = (Size)len;
+    } else {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value for argument %2, expected TypedArray, ArrayBuffer or DataView", GetValueType(instance, value), argument);
+        return false;
+    }
+
+    *out_len = ref->size ? bytes / ref->size : bytes;
+    return true;
+}
+
+static Size ReadSpanLength(const uint64_t *ptr, const TypeInfo *type)
+{
+    int64_t len = 0;
+
+    switch (type->primitive) {
+        case PrimitiveKind::Int8: { len = *(const int8_t *)ptr; } break;
+        case PrimitiveKind::UInt8: { len = *(const uint8_t *)ptr; } break;
+        case PrimitiveKind::Int16: { len = *(const int16_t *)ptr; } break;
+        case PrimitiveKind::UInt16: { len = *(const uint16_t *)ptr; } break;
+        case PrimitiveKind::Int32: { len = *(const int32_t *)ptr; } break;
+        case PrimitiveKind::UInt32: { len = *(const uint32_t *)ptr; } break;
+        case PrimitiveKind::Int64: { len = *(const int64_t *)ptr; } break;
+        case PrimitiveKind::UInt64: { len = (int64_t)std::min(*(const uint64_t *)ptr, (uint64_t)INT64_MAX); } break;
+
+        default: { RG_UNREACHABLE(); } break;
+    }
+
+    return (Size)std::max(len, (int64_t)0);
+}
+
+static void WriteSpanLength(uint64_t *ptr, const TypeInfo *type, Size len)
+{
+    switch (type->primitive) {
+        case PrimitiveKind::Int8: { *(int8_t *)ptr = (int8_t)std::min(len, (Size)INT8_MAX); } break;
+        case PrimitiveKind::UInt8: { *(uint8_t *)ptr = (uint8_t)std::min(len, (Size)UINT8_MAX); } break;
+        case PrimitiveKind::Int16: { *(int16_t *)ptr = (int16_t)std::min(len, (Size)INT16_MAX); } break;
+        case PrimitiveKind::UInt16: { *(uint16_t *)ptr = (uint16_t)std::min(len, (Size)UINT16_MAX); } break;
+        case PrimitiveKind::Int32: { *(int32_t *)ptr = (int32_t)std::min(len, (Size)INT32_MAX); } break;
+        case PrimitiveKind::UInt32: { *(uint32_t *)ptr = (uint32_t)std::min((int64_t)len, (int64_t)UINT32_MAX); } break;
+        case PrimitiveKind::Int64: { *(int64_t *)ptr = (int64_t)len; } break;
+        case PrimitiveKind::UInt64: { *(uint64_t *)ptr = (uint64_t)len; } break;
+
+        default: { RG_UNREACHABLE(); } break;
+    }
+}
+
+bool ExpandSpans(Napi::Env env, const FunctionInfo *func, const napi_value *args, napi_value *out_args)
+{
+    for (const ParameterInfo &param: func->parameters) {
+        if (RG_LIKELY(param.offset < MaxParameters * 2)) {
+            out_args[param.offset] = args[param.offset];
+            continue;
+        }
+
+        RG_ASSERT(param.span && param.span_length);
+
+        Size idx = param.offset - MaxParameters * 2;
+        Napi::Value value(env, args[idx]);
+
+        void *ptr;
+        Size len;
+        if (RG_UNLIKELY(!GetSpanMemory(env, value, param.span, (int)idx + 1, &ptr, &len)))
+            return false;
+
+        // Clamp the length to the range of its type, just like inout spans do
+        uint64_t raw = 0;
+        WriteSpanLength(&raw, param.span->length, len);
+        len = ReadSpanLength(&raw, param.span->length);
+
+        out_args[param.offset] = Napi::Number::New(env, (double)len);
+    }
+
+    return true;
+}
+
+// Output spans are given as an array, the first element is replaced by a copy of the C memory
+// for output spans, and by a view of the given TypedArray (resized to the length) for inout spans.
+// Both parameters (pointer and length) come here, the first one seen prepares the slots.
+bool CallData::PushSpan(Napi::Value value, const ParameterInfo &param, void **out_ptr)
+{
+    SpanArgument *arg = nullptr;
+
+    for (SpanArgument &it: span_arguments) {
+        if (it.offset == param.offset) {
+            arg = &it;
+            break;
+        }
+    }
+
+    if (!arg) {
+        if (RG_UNLIKELY(!value.IsArray())) {
+            ThrowError<Napi::TypeError>(env, "Unexpected %1 value for argument %2, expected array", GetValueType(instance, value), param.offset + 1);
+            return false;
+        }
+
+        arg = span_arguments.AppendDefault();
+
+        arg->offset = param.offset;
+        arg->type = param.span;
+
+        if (param.directions & 1) {
+            Napi::Value buffer = value.As<Napi::Array>().Get(0u);
+
+            if (RG_UNLIKELY(!buffer.IsTypedArray() && !IsNullOrUndefined(buffer))) {
+                ThrowError<Napi::TypeError>(env, "Unexpected %1 value for argument %2, expected array with TypedArray", GetValueType(instance, buffer), param.offset + 1);
+                span_arguments.RemoveLast(1);
+                return false;
+            }
+            if (RG_UNLIKELY(!GetSpanMemory(env, buffer, param.span, param.offset + 1, &arg->ptr, &arg->capacity))) {
+                span_arguments.RemoveLast(1);
+                return false;
+            }
+
+            WriteSpanLength(&arg->len, param.span->length, arg->capacity);
+
+            if (arg->ptr) {
+                napi_status status = napi_create_reference(env, buffer, 1, &arg->buffer);
+                RG_ASSERT(status == napi_ok);
+            }
+        }
+
+        napi_status status = napi_create_reference(env, value, 1, &arg->ref);
+        RG_ASSERT(status == napi_ok);
+    }
+
+    if (param.span_length) {
+        *out_ptr = &arg->len;
+    } else if (param.directions & 1) {
+        *out_ptr = arg->ptr;
+    } else {
+        *out_ptr = &arg->ptr;
+    }
+
+    return true;
+}
+
 static inline Napi::Value GetReferenceValue(Napi::Env env, napi_ref ref)
 {
     napi_value value;
@@ -726,6 +1059,55 @@ static inline Napi::Value GetReferenceValue(Napi::Env env, napi_ref ref)
     return Napi::Value(env, value);
 }
 
+// Realigned records (such as HFA values) put each scalar element in its own slot
+static Size CopyRealigned(uint8_t *dest, const uint8_t *origin, const TypeInfo *type, Size idx, int16_t realign)
+{
+    if (type->primitive == PrimitiveKind::Record) {
+        for (const RecordMember &member: type->members) {
+            idx = CopyRealigned(dest + member.offset, origin, member.type, idx, realign);
+        }
+    } else if (type->primitive == PrimitiveKind::Array) {
+        const TypeInfo *ref = type->ref.type;
+        Size len = type->size / ref->size;
+
+        for (Size i = 0; i < len; i++) {
+            idx = CopyRealigned(dest + i * ref->size, origin, ref, idx, realign);
+        }
+    } else {
+        memcpy(dest, origin + idx * realign, (size_t)type->size);
+        idx++;
+    }
+
+    return idx;
+}
+
+Napi::Object CallData::PopReturnObject(const uint8_t *origin, int16_t realign)
+{
+    const TypeInfo *type = func->ret.type;
+
+    if (RG_LIKELY(!return_target))
+        return DecodeObject(env, origin, type, realign);
+
+    Napi::Object target(env, return_target);
+
+    if (target.IsTypedArray()) {
+        uint8_t *dest;
+
+        napi_status status = napi_get_typedarray_info(env, target, nullptr, nullptr, (void **)&dest, nullptr, nullptr);
+        RG_ASSERT(status == napi_ok);
+
+        if (realign) {
+            CopyRealigned(dest, origin, type, 0, realign);
+        } else {
+            memcpy(dest, origin, (size_t)type->size);
+        }
+    } else {
+        DecodeObject(target, origin, type, realign);
+    }
+
+    return target;
+}
+
 void CallData::PopOutArguments()
 {
     for (const OutArgument &out: out_arguments) {
@@ -734,19 +1116,60 @@ void CallData::PopOutArguments()
 
         if (value.IsArray()) {
             Napi::Array array(env, value);
-            PopNormalArray(array, out.ptr, out.type);
+            DecodeNormalArray(array, out.ptr, out.type);
         } else if (value.IsTypedArray()) {
             Napi::TypedArray array(env, value);
-            PopTypedArray(array, out.ptr, out.type);
+            DecodeTypedArray(array, out.ptr, out.type);
         } else {
             Napi::Object obj(env, value);
-            PopObject(obj, out.ptr, out.type);
+            DecodeObject(obj, out.ptr, out.type);
         }
 
         if (out.type->dispose) {
             out.type->dispose(env, out.type, out.ptr);
         }
     }
+
+    for (const SpanArgument &arg: span_arguments) {
+        Napi::Array array = GetReferenceValue(env, arg.ref).As<Napi::Array>();
+
+        const TypeInfo *ref = arg.type->ref.type;
+        Size len = ReadSpanLength(&arg.len, arg.type->length);
+
+        if (arg.buffer) {
+            Napi::Object buffer = GetReferenceValue(env, arg.buffer).As<Napi::Object>();
+            Napi::Function subarray = buffer.Get("subarray").As<Napi::Function>();
+
+            // Keep the original class (such as Buffer) and memory
+            len = std::min(len, arg.capacity);
+
+            // Void spans count bytes, but subarray() takes elements
+            if (!ref->size) {
+                Size element_size = (Size)buffer.As<Napi::TypedArray>().ElementSize();
+                len /= element_size;
+            }
+
+            Napi::Value view = subarray.Call(buffer, { Napi::Number::New(env, 0), Napi::Number::New(env, (double)len) });
+
+            array.Set(0u, view);
+        } else if (!arg.ptr) {
+            array.Set(0u, env.Null());
+        } else if (ref->primitive == PrimitiveKind::Void || ref->primitive == PrimitiveKind::UInt8) {
+            Size size = len * std::max(ref->size, (int16_t)1);
+            Napi::Buffer<uint8_t> buffer = Napi::Buffer<uint8_t>::Copy(env, (const uint8_t *)arg.ptr, (size_t)size);
+
+            array.Set(0u, buffer);
+        } else {
+            Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, (size_t)(len * ref->size));
+            memcpy(buffer.Data(), arg.ptr, (size_t)(len * ref->size));
+
+            napi_value typed;
+            napi_status status = napi_create_typedarray(env, (napi_typedarray_type)GetTypedArrayType(ref), (size_t)len, buffer, 0, &typed);
+            RG_ASSERT(status == napi_ok);
+
+            array.Set(0u, typed);
+        }
+    }
 }
 
 void *CallData::ReserveTrampoline(const FunctionInfo *proto, Napi::Function func)
@@ -772,7 +1195,7 @@ void *CallData::ReserveTrampoline(const FunctionInfo *proto, Napi::Function func
     return ptr;
 }
 
-void CallData::PopObject(Napi::Object obj, const uint8_t *origin, const TypeInfo *type, int16_t realign)
+void DecodeObject(Napi::Object obj, const uint8_t *origin, const TypeInfo *type, int16_t realign)
 {
     Napi::Env env = obj.Env();
     InstanceData *instance = env.GetInstanceData<InstanceData>();
@@ -790,43 +1213,43 @@ void CallData::PopObject(Napi::Object obj, const uint8_t *origin, const TypeInfo
 
             case PrimitiveKind::Bool: {
                 bool b = *(bool *)src;
-                obj.Set(member.name, Napi::Boolean::New(env, b));
+                SetMember(obj, member, Napi::Boolean::New(env, b));
             } break;
             case PrimitiveKind::Int8: {
                 double d = (double)*(int8_t *)src;
-                obj.Set(member.name, Napi::Number::New(env, d));
+                SetMember(obj, member, Napi::Number::New(env, d));
             } break;
             case PrimitiveKind::UInt8: {
                 double d = (double)*(uint8_t *)src;
-                obj.Set(member.name, Napi::Number::New(env, d));
+                SetMember(obj, member, Napi::Number::New(env, d));
             } break;
             case PrimitiveKind::Int16: {
                 double d = (double)*(int16_t *)src;
-                obj.Set(member.name, Napi::Number::New(env, d));
+                SetMember(obj, member, Napi::Number::New(env, d));
             } break;
             case PrimitiveKind::UInt16: {
                 double d = (double)*(uint16_t *)src;
-                obj.Set(member.name, Napi::Number::New(env, d));
+                SetMember(obj, member, Napi::Number::New(env, d));
             } break;
             case PrimitiveKind::Int32: {
                 double d = (double)*(int32_t *)src;
-                obj.Set(member.name, Napi::Number::New(env, d));
+                SetMember(obj, member, Napi::Number::New(env, d));
             } break;
             case PrimitiveKind::UInt32: {
                 double d = (double)*(uint32_t *)src;
-                obj.Set(member.name, Napi::Number::New(env, d));
+                SetMember(obj, member, Napi::Number::New(env, d));
             } break;
             case PrimitiveKind::Int64: {
                 int64_t v = *(int64_t *)src;
-                obj.Set(member.name, NewBigInt(env, v));
+                SetMember(obj, member, NewBigInt(env, v));
             } break;
             case PrimitiveKind::UInt64: {
                 uint64_t v = *(uint64_t *)src;
-                obj.Set(member.name, NewBigInt(env, v));
+                SetMember(obj, member, NewBigInt(env, v));
             } break;
             case PrimitiveKind::String: {
                 const char *str = *(const char **)src;
-                obj.Set(member.name, str ? Napi::String::New(env, str) : env.Null());
+                SetMember(obj, member, str ? NewString(env, str) : env.Null());
 
                 if (member.type->dispose) {
                     member.type->dispose(env, member.type, str);
@@ -834,7 +1257,7 @@ void CallData::PopObject(Napi::Object obj, const uint8_t *origin, const TypeInfo
             } break;
             case PrimitiveKind::String16: {
                 const char16_t *str16 = *(const char16_t **)src;
-                obj.Set(member.name, str16 ? Napi::String::New(env, str16) : env.Null());
+                SetMember(obj, member, str16 ? Napi::String::New(env, str16) : env.Null());
 
                 if (member.type->dispose) {
                     member.type->dispose(env, member.type, str16);
@@ -848,9 +1271,9 @@ void CallData::PopObject(Napi::Object obj, const uint8_t *origin, const TypeInfo
                     Napi::External<void> external = Napi::External<void>::New(env, ptr2);
                     SetValueTag(instance, external, member.type->ref.marker);
 
-                    obj.Set(member.name, external);
+                    SetMember(obj, member, external);
                 } else {
-                    obj.Set(member.name, env.Null());
+                    SetMember(obj, member, env.Null());
                 }
 
                 if (member.type->dispose) {
@@ -858,31 +1281,41 @@ void CallData::PopObject(Napi::Object obj, const uint8_t *origin, const TypeInfo
                 }
             } break;
             case PrimitiveKind::Record: {
-                Napi::Object obj2 = PopObject(src, member.type, realign);
-                obj.Set(member.name, obj2);
+                Napi::Object obj2 = DecodeObject(env, src, member.type, realign);
+                SetMember(obj, member, obj2);
             } break;
             case PrimitiveKind::Array: {
-                Napi::Value value = PopArray(src, member.type, realign);
-                obj.Set(member.name, value);
+                Napi::Value value = DecodeArray(env, src, member.type, realign);
+                SetMember(obj, member, value);
             } break;
             case PrimitiveKind::Float32: {
                 float f = *(float *)src;
-                obj.Set(member.name, Napi::Number::New(env, (double)f));
+                SetMember(obj, member, Napi::Number::New(env, (double)f));
             } break;
             case PrimitiveKind::Float64: {
                 double d = *(double *)src;
-                obj.Set(member.name, Napi::Number::New(env, d));
+                SetMember(obj, member, Napi::Number::New(env, d));
             } break;
 
             case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+            case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
         }
     }
 }
 
-Napi::Object CallData::PopObject(const uint8_t *origin, const TypeInfo *type, int16_t realign)
+Napi::Object DecodeObject(Napi::Env env, const uint8_t *origin, const TypeInfo *type, int16_t realign)
 {
+    // Realigned values (HFA in registers) are rare enough to be decoded eagerly
+    if (type->lazy && !realign) {
+        InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+        // Lazy objects need JS code, which cannot run on the Koffi stack
+        if (!instance->relaying)
+            return DecodeLazyObject(env, origin, type);
+    }
+
     Napi::Object obj = Napi::Object::New(env);
-    PopObject(obj, origin, type, realign);
+    DecodeObject(obj, origin, type, realign);
     return obj;
 }
 
@@ -897,10 +1330,13 @@ static Size WideStringLength(const char16_t *str16, Size max)
     return len;
 }
 
-void CallData::PopNormalArray(Napi::Array array, const uint8_t *origin, const TypeInfo *ref, int16_t realign)
+void DecodeNormalArray(Napi::Array array, const uint8_t *origin, const TypeInfo *ref, int16_t realign)
 {
     RG_ASSERT(array.IsArray());
 
+    Napi::Env env = array.Env();
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
     Size offset = 0;
     uint32_t len = array.Length();
 
@@ -955,7 +1391,7 @@ void CallData::PopNormalArray(Napi::Array array, const uint8_t *origin, const Ty
         case PrimitiveKind::String: {
             POP_ARRAY({
                 const char *str = *(const char **)src;
-                array.Set(i, str ? Napi::String::New(env, str) : env.Null());
+                array.Set(i, str ? NewString(env, str) : env.Null());
 
                 if (ref->dispose) {
                     ref->dispose(env, ref, str);
@@ -993,13 +1429,13 @@ void CallData::PopNormalArray(Napi::Array array, const uint8_t *origin, const Ty
         } break;
         case PrimitiveKind::Record: {
             POP_ARRAY({
-                Napi::Object obj = PopObject(src, ref, realign);
+                Napi::Object obj = DecodeObject(env, src, ref, realign);
                 array.Set(i, obj);
             });
         } break;
         case PrimitiveKind::Array: {
             POP_ARRAY({
-                Napi::Value value = PopArray(src, ref, realign);
+                Napi::Value value = DecodeArray(env, src, ref, realign);
                 array.Set(i, value);
             });
         } break;
@@ -1007,13 +1443,14 @@ void CallData::PopNormalArray(Napi::Array array, const uint8_t *origin, const Ty
         case PrimitiveKind::Float64: { POP_NUMBER_ARRAY(double); } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
 #undef POP_NUMBER_ARRAY
 #undef POP_ARRAY
 }
 
-void CallData::PopTypedArray(Napi::TypedArray array, const uint8_t *origin, const TypeInfo *ref, int16_t realign)
+void DecodeTypedArray(Napi::TypedArray array, const uint8_t *origin, const TypeInfo *ref, int16_t realign)
 {
     RG_ASSERT(array.IsTypedArray());
     RG_ASSERT(GetTypedArrayType(ref) == array.TypedArrayType());
@@ -1040,10 +1477,12 @@ void CallData::PopTypedArray(Napi::TypedArray array, const uint8_t *origin, cons
     }
 }
 
-Napi::Value CallData::PopArray(const uint8_t *origin, const TypeInfo *type, int16_t realign)
+Napi::Value DecodeArray(Napi::Env env, const uint8_t *origin, const TypeInfo *type, int16_t realign)
 {
     RG_ASSERT(type->primitive == PrimitiveKind::Array);
 
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
     uint32_t len = type->size / type->ref.type->size;
     Size offset = 0;
 
@@ -1073,7 +1512,7 @@ Napi::Value CallData::PopArray(const uint8_t *origin, const TypeInfo *type, int1
                 }); \
             } else { \
                 Napi::TypedArrayType array = Napi::TypedArrayType::New(env, len); \
-                PopTypedArray(array, origin, type->ref.type, realign); \
+                DecodeTypedArray(array, origin, type->ref.type, realign); \
                  \
                 return array; \
             } \
@@ -1095,7 +1534,7 @@ Napi::Value CallData::PopArray(const uint8_t *origin, const TypeInfo *type, int1
                 const char *ptr = (const char *)origin;
                 size_t count = strnlen(ptr, (size_t)len);
 
-                Napi::String str = Napi::String::New(env, ptr, count);
+                Napi::String str = NewString(env, ptr, (Size)count);
                 return str;
             }
 
@@ -1133,7 +1572,7 @@ Napi::Value CallData::PopArray(const uint8_t *origin, const TypeInfo *type, int1
         case PrimitiveKind::String: {
             POP_ARRAY({
                 const char *str = *(const char **)src;
-                array.Set(i, str ? Napi::String::New(env, str) : env.Null());
+                array.Set(i, str ? NewString(env, str) : env.Null());
             });
         } break;
         case PrimitiveKind::String16: {
@@ -1159,13 +1598,13 @@ Napi::Value CallData::PopArray(const uint8_t *origin, const TypeInfo *type, int1
         } break;
         case PrimitiveKind::Record: {
             POP_ARRAY({
-                Napi::Object obj = PopObject(src, type->ref.type, realign);
+                Napi::Object obj = DecodeObject(env, src, type->ref.type, realign);
                 array.Set(i, obj);
             });
         } break;
         case PrimitiveKind::Array: {
             POP_ARRAY({
-                Napi::Value value = PopArray(src, type->ref.type, realign);
+                Napi::Value value = DecodeArray(env, src, type->ref.type, realign);
                 array.Set(i, value);
             });
         } break;
@@ -1173,6 +1612,7 @@ Napi::Value CallData::PopArray(const uint8_t *origin, const TypeInfo *type, int1
         case PrimitiveKind::Float64: { POP_NUMBER_ARRAY(Float64Array, double); } break;
 
         case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
     }
 
 #undef POP_NUMBER_ARRAY
@@ -1181,6 +1621,208 @@ Napi::Value CallData::PopArray(const uint8_t *origin, const TypeInfo *type, int1
     RG_UNREACHABLE();
 }
 
+Napi::Value Decode(Napi::Env env, const uint8_t *origin, const TypeInfo *type)
+{
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    switch (type->primitive) {
+        case PrimitiveKind::Void: { RG_UNREACHABLE(); } break;
+
+        case PrimitiveKind::Bool: return Napi::Boolean::New(env, *(bool *)origin);
+        case PrimitiveKind::Int8: return Napi::Number::New(env, (double)*(int8_t *)origin);
+        case PrimitiveKind::UInt8: return Napi::Number::New(env, (double)*(uint8_t *)origin);
+        case PrimitiveKind::Int16: return Napi::Number::New(env, (double)*(int16_t *)origin);
+        case PrimitiveKind::UInt16: return Napi::Number::New(env, (double)*(uint16_t *)origin);
+        case PrimitiveKind::Int32: return Napi::Number::New(env, (double)*(int32_t *)origin);
+        case PrimitiveKind::UInt32: return Napi::Number::New(env, (double)*(uint32_t *)origin);
+        case PrimitiveKind::Int64: return NewBigInt(env, *(int64_t *)origin);
+        case PrimitiveKind::UInt64: return NewBigInt(env, *(uint64_t *)origin);
+        case PrimitiveKind::String: {
+            const char *str = *(const char **)origin;
+            Napi::Value value = str ? NewString(env, str) : env.Null();
+
+            if (type->dispose) {
+                type->dispose(env, type, str);
+            }
+
+            return value;
+        } break;
+        case PrimitiveKind::String16: {
+            const char16_t *str16 = *(const char16_t **)origin;
+            Napi::Value value = str16 ? Napi::String::New(env, str16) : env.Null();
+
+            if (type->dispose) {
+                type->dispose(env, type, str16);
+            }
+
+            return value;
+        } break;
+        case PrimitiveKind::Pointer:
+        case PrimitiveKind::Callback: {
+            void *ptr = *(void **)origin;
+            Napi::Value value = env.Null();
+
+            if (ptr) {
+                Napi::External<void> external = Napi::External<void>::New(env, ptr);
+                SetValueTag(instance, external, type->ref.marker);
+
+                value = external;
+            }
+
+            if (type->dispose) {
+                type->dispose(env, type, ptr);
+            }
+
+            return value;
+        } break;
+        case PrimitiveKind::Record: return DecodeObject(env, origin, type);
+        case PrimitiveKind::Array: return DecodeArray(env, origin, type);
+        case PrimitiveKind::Float32: return Napi::Number::New(env, (double)*(float *)origin);
+        case PrimitiveKind::Float64: return Napi::Number::New(env, *(double *)origin);
+
+        case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
+    }
+
+    RG_UNREACHABLE();
+}
+
+bool NeedsTemporaryMemory(const TypeInfo *type)
+{
+    switch (type->primitive) {
+        case PrimitiveKind::String:
+        case PrimitiveKind::String16: return true;
+
+        case PrimitiveKind::Record: {
+            for (const RecordMember &member: type->members) {
+                if (NeedsTemporaryMemory(member.type))
+                    return true;
+            }
+            return false;
+        } break;
+        case PrimitiveKind::Array: return NeedsTemporaryMemory(type->ref.type);
+
+        default: return false;
+    }
+}
+
+bool Encode(Napi::Env env, uint8_t *origin, Napi::Value value, const TypeInfo *type)
+{
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    // Nothing would own the converted strings once we're done
+    if (RG_UNLIKELY(NeedsTemporaryMemory(type))) {
+        ThrowError<Napi::TypeError>(env, "Cannot encode type %1 which contains string pointers", type->name);
+        return false;
+    }
+
+#define PUSH_NUMBER(CType) \
+        do { \
+            if (RG_UNLIKELY(!value.IsNumber() && !value.IsBigInt())) { \
+                ThrowError<Napi::TypeError>(env, "Unexpected %1 value, expected number", GetValueType(instance, value)); \
+                return false; \
+            } \
+             \
+            CType v = CopyNumber<CType>(value); \
+            *(CType *)origin = v; \
+        } while (false)
+
+    switch (type->primitive) {
+        case PrimitiveKind::Void: { RG_UNREACHABLE(); } break;
+
+        case PrimitiveKind::Bool: {
+            if (RG_UNLIKELY(!value.IsBoolean())) {
+                ThrowError<Napi::TypeError>(env, "Unexpected %1 value, expected boolean", GetValueType(instance, value));
+                return false;
+            }
+
+            bool b = value.As<Napi::Boolean>();
+            *(bool *)origin = b;
+        } break;
+        case PrimitiveKind::Int8: { PUSH_NUMBER(int8_t); } break;
+        case PrimitiveKind::UInt8: { PUSH_NUMBER(uint8_t); } break;
+        case PrimitiveKind::Int16: { PUSH_NUMBER(int16_t); } break;
+        case PrimitiveKind::UInt16: { PUSH_NUMBER(uint16_t); } break;
+        case PrimitiveKind::Int32: { PUSH_NUMBER(int32_t); } break;
+        case PrimitiveKind::UInt32: { PUSH_NUMBER(uint32_t); } break;
+        case PrimitiveKind::Int64: { PUSH_NUMBER(int64_t); } break;
+        case PrimitiveKind::UInt64: { PUSH_NUMBER(uint64_t); } break;
+        case PrimitiveKind::String:
+        case PrimitiveKind::String16: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Pointer:
+        case PrimitiveKind::Callback: {
+            void *ptr;
+
+            if (CheckValueTag(instance, value, type->ref.marker)) {
+                ptr = value.As<Napi::External<void>>().Data();
+            } else if (IsNullOrUndefined(value)) {
+                ptr = nullptr;
+            } else {
+                ThrowError<Napi::TypeError>(env, "Unexpected %1 value, expected %2", GetValueType(instance, value), type->name);
+                return false;
+            }
+
+            *(void **)origin = ptr;
+        } break;
+        case PrimitiveKind::Record:
+        case PrimitiveKind::Array: {
+            // Reuse the marshalling code, it does not need any memory for these types
+            InstanceMemory mem = {};
+            CallData call(env, instance, nullptr, &mem);
+
+            return call.EncodeAggregate(value, type, origin);
+        } break;
+        case PrimitiveKind::Float32: { PUSH_NUMBER(float); } break;
+        case PrimitiveKind::Float64: { PUSH_NUMBER(double); } break;
+
+        case PrimitiveKind::Prototype: { RG_UNREACHABLE(); } break;
+        case PrimitiveKind::Span: { RG_UNREACHABLE(); } break;
+    }
+
+#undef PUSH_NUMBER
+
+    return true;
+}
+
+bool CallData::EncodeAggregate(Napi::Value value, const TypeInfo *type, uint8_t *origin)
+{
+    if (type->primitive == PrimitiveKind::Record) {
+        if (RG_UNLIKELY(!IsObject(value))) {
+            ThrowError<Napi::TypeError>(env, "Unexpected %1 value, expected object", GetValueType(instance, value));
+            return false;
+        }
+
+        if (!PushObject(value.As<Napi::Object>(), type, origin))
+            return false;
+    } else {
+        RG_ASSERT(type->primitive == PrimitiveKind::Array);
+
+        Size len = (Size)type->size / type->ref.type->size;
+
+        if (value.IsArray()) {
+            if (!PushNormalArray(value.As<Napi::Array>(), len, type->ref.type, origin))
+                return false;
+        } else if (value.IsTypedArray()) {
+            if (!PushTypedArray(value.As<Napi::TypedArray>(), len, type->ref.type, origin))
+                return false;
+        } else if (value.IsString()) {
+            if (!PushStringArray(value, type, origin))
+                return false;
+        } else {
+            ThrowError<Napi::TypeError>(env, "Unexpected %1 value, expected array", GetValueType(instance, value));
+            return false;
+        }
+    }
+
+    // Temporary trampolines die with this CallData
+    if (RG_UNLIKELY(used_trampolines)) {
+        ThrowError<Napi::TypeError>(env, "Cannot encode JS functions, use registered callbacks");
+        return false;
+    }
+
+    return true;
+}
+
 void CallData::DumpForward() const
 {
     PrintLn(stderr, "%!..+---- %1 (%2) ----%!0", func->name, CallConventionNames[(int)func->convention]);
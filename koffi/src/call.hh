@@ -23,8 +23,27 @@ namespace RG {
 
 bool AnalyseFunction(Napi::Env env, InstanceData *instance, FunctionInfo *func);
 
+// Conversion from C memory to JS values, these don't need a running call
+void DecodeObject(Napi::Object obj, const uint8_t *origin, const TypeInfo *type, int16_t realign = 0);
+Napi::Object DecodeObject(Napi::Env env, const uint8_t *origin, const TypeInfo *type, int16_t realign = 0);
+void DecodeNormalArray(Napi::Array array, const uint8_t *origin, const TypeInfo *ref, int16_t realign = 0);
+void DecodeTypedArray(Napi::TypedArray array, const uint8_t *origin, const TypeInfo *ref, int16_t realign = 0);
+Napi::Value DecodeArray(Napi::Env env, const uint8_t *origin, const TypeInfo *type, int16_t realign = 0);
+Napi::Value Decode(Napi::Env env, const uint8_t *origin, const TypeInfo *type);
+
+bool NeedsTemporaryMemory(const TypeInfo *type);
+
+// Writes a JS value to C memory, types that need temporary memory (strings) are refused
+bool Encode(Napi::Env env, uint8_t *origin, Napi::Value value, const TypeInfo *type);
+
+// Copies JS arguments and adds the length of input spans, out_args needs MaxExpandedArguments slots
+bool ExpandSpans(Napi::Env env, const FunctionInfo *func, const napi_value *args, napi_value *out_args);
+
 struct BackRegisters;
 
+// Set when a trampoline runs outside of any generic call, call stubs check it and throw
+extern RG_THREAD_LOCAL bool missed_relay;
+
 // I'm not sure why the alignas(8), because alignof(CallData) is 8 without it.
 // But on Windows i386, without it, the alignment may not be correct (compiler bug?).
 class alignas(8) CallData {
@@ -34,6 +53,17 @@ class alignas(8) CallData {
         const TypeInfo *type;
     };
 
+    struct SpanArgument {
+        napi_ref ref;
+        napi_ref buffer; // Inout only
+        int8_t offset;
+        const TypeInfo *type;
+
+        void *ptr;
+        uint64_t len;
+        Size capacity; // Inout only
+    };
+
     Napi::Env env;
     InstanceData *instance;
     const FunctionInfo *func;
@@ -45,9 +75,10 @@ class alignas(8) CallData {
     int16_t used_trampolines = 0;
 
     LocalArray<OutArgument, MaxOutParameters> out_arguments;
+    LocalArray<SpanArgument, MaxOutParameters> span_arguments;
 
     uint8_t *new_sp;
-    uint8_t *old_sp;
+    uint8_t *old_sp = nullptr; // Set by Execute()
 
     union {
         int8_t i8;
@@ -64,6 +95,7 @@ class alignas(8) CallData {
         uint8_t buf[32];
     } result;
     uint8_t *return_ptr = nullptr;
+    napi_value return_target = nullptr; // Set by CompleteInto()
 
     LinkedAllocator call_alloc;
 
@@ -71,14 +103,19 @@ public:
     CallData(Napi::Env env, InstanceData *instance, const FunctionInfo *func, InstanceMemory *mem);
     ~CallData();
 
-    bool Prepare(const Napi::CallbackInfo &info);
+    bool Prepare(const napi_value *args);
     void Execute();
     Napi::Value Complete();
+    void CompleteRaw(void *dest);
+    Napi::Value CompleteInto(Napi::Object target);
 
     void Relay(Size idx, uint8_t *own_sp, uint8_t *caller_sp, BackRegisters *out_reg);
 
     void DumpForward() const;
 
+    // Used by Encode() for records and arrays, outside of any call
+    bool EncodeAggregate(Napi::Value value, const TypeInfo *type, uint8_t *origin);
+
 private:
     template <typename T>
     bool AllocStack(Size size, Size align, T **out_ptr);
@@ -92,14 +129,11 @@ private:
     bool PushTypedArray(Napi::TypedArray array, Size len, const TypeInfo *ref, uint8_t *origin, int16_t realign = 0);
     bool PushStringArray(Napi::Value value, const TypeInfo *type, uint8_t *origin);
     bool PushPointer(Napi::Value value, const ParameterInfo &param, void **out_ptr);
-
-    void PopObject(Napi::Object obj, const uint8_t *origin, const TypeInfo *type, int16_t realign = 0);
-    Napi::Object PopObject(const uint8_t *origin, const TypeInfo *type, int16_t realign = 0);
-    void PopNormalArray(Napi::Array array, const uint8_t *origin, const TypeInfo *ref, int16_t realign = 0);
-    void PopTypedArray(Napi::TypedArray array, const uint8_t *origin, const TypeInfo *ref, int16_t realign = 0);
-    Napi::Value PopArray(const uint8_t *origin, const TypeInfo *type, int16_t realign = 0);
+    bool PushPinned(Napi::Value value, const ParameterInfo &param, void **out_ptr);
+    bool PushSpan(Napi::Value value, const ParameterInfo &param, void **out_ptr);
 
     void PopOutArguments();
+    Napi::Object PopReturnObject(const uint8_t *origin, int16_t realign = 0);
 
     void *ReserveTrampoline(const FunctionInfo *proto, Napi::Function func);
 };
@@ -152,6 +186,10 @@ inline T *CallData::AllocHeap(Size size, Size align)
         ptr = (uint8_t *)Allocator::Allocate(&call_alloc, size + align, flags);
         ptr = AlignUp(ptr, align);
 
+        if (RG_UNLIKELY(instance->stats)) {
+            instance->heap_overflows++;
+        }
+
         return ptr;
     }
 }
@@ -13,8 +13,12 @@
 
 #include "vendor/libcc/libcc.hh"
 #include "ffi.hh"
+#include "async.hh"
 #include "call.hh"
 #include "parser.hh"
+#include "records.hh"
+#include "trampolines.hh"
+#include "trace.hh"
 #include "util.hh"
 
 #ifdef _WIN32
@@ -36,6 +40,7 @@
 #if NODE_WANT_INTERNALS
     #include <env-inl.h>
     #include <js_native_api_v8.h>
+    #include <v8-fast-api-calls.h>
 #endif
 
 namespace RG {
@@ -112,6 +117,9 @@ static Napi::Value GetSetConfig(const Napi::CallbackInfo &info)
         Size async_heap_size = instance->async_heap_size;
         int resident_async_pools = instance->resident_async_pools;
         int max_async_calls = resident_async_pools + instance->max_temporaries;
+        int async_threads = instance->async_threads;
+        bool jit = instance->jit;
+        bool stats = instance->stats;
 
         Napi::Object obj = info[0].As<Napi::Object>();
         Napi::Array keys = obj.GetPropertyNames();
@@ -138,6 +146,23 @@ static Napi::Value GetSetConfig(const Napi::CallbackInfo &info)
             } else if (key == "max_async_calls") {
                 if (!ChangeAsyncLimit(key.c_str(), value, MaxAsyncCalls, &max_async_calls))
                     return env.Null();
+            } else if (key == "async_threads") {
+                if (!ChangeAsyncLimit(key.c_str(), value, MaxAsyncThreads, &async_threads))
+                    return env.Null();
+            } else if (key == "jit") {
+                if (!value.IsBoolean()) {
+                    ThrowError<Napi::TypeError>(env, "Unexpected %1 value for %2, expected boolean", GetValueType(instance, value), key.c_str());
+                    return env.Null();
+                }
+
+                jit = value.As<Napi::Boolean>();
+            } else if (key == "stats") {
+                if (!value.IsBoolean()) {
+                    ThrowError<Napi::TypeError>(env, "Unexpected %1 value for %2, expected boolean", GetValueType(instance, value), key.c_str());
+                    return env.Null();
+                }
+
+                stats = value.As<Napi::Boolean>();
             } else {
                 ThrowError<Napi::Error>(env, "Unexpected config member '%1'", key.c_str());
                 return env.Null();
@@ -148,6 +173,10 @@ static Napi::Value GetSetConfig(const Napi::CallbackInfo &info)
             ThrowError<Napi::Error>(env, "Setting max_async_calls must be >= to resident_async_pools");
             return env.Null();
         }
+        if (async_threads < 1) {
+            ThrowError<Napi::Error>(env, "Setting async_threads must be >= 1");
+            return env.Null();
+        }
 
         instance->sync_stack_size = sync_stack_size;
         instance->sync_heap_size = sync_heap_size;
@@ -155,6 +184,9 @@ static Napi::Value GetSetConfig(const Napi::CallbackInfo &info)
         instance->async_heap_size = async_heap_size;
         instance->resident_async_pools = resident_async_pools;
         instance->max_temporaries = max_async_calls - resident_async_pools;
+        instance->async_threads = async_threads;
+        instance->jit = jit;
+        instance->stats = stats;
     }
 
     Napi::Object obj = Napi::Object::New(env);
@@ -165,6 +197,9 @@ static Napi::Value GetSetConfig(const Napi::CallbackInfo &info)
     obj.Set("async_heap_size", instance->async_heap_size);
     obj.Set("resident_async_pools", instance->resident_async_pools);
     obj.Set("max_async_calls", instance->resident_async_pools + instance->max_temporaries);
+    obj.Set("async_threads", instance->async_threads);
+    obj.Set("jit", instance->jit);
+    obj.Set("stats", instance->stats);
 
     return obj;
 }
@@ -211,11 +246,20 @@ static Napi::Value CreateStructType(const Napi::CallbackInfo &info, bool pad)
         Napi::Value value = obj[key];
 
         member.name = DuplicateString(key.c_str(), &instance->str_alloc).ptr;
+#if NODE_WANT_INTERNALS
+        {
+            v8::Isolate *isolate = v8::Isolate::GetCurrent();
+            v8::Local<v8::String> str = v8::String::NewFromUtf8(isolate, member.name, v8::NewStringType::kInternalized).ToLocalChecked();
+
+            member.key.Set(isolate, str);
+        }
+#endif
         member.type = ResolveType(value);
         if (!member.type)
             return env.Null();
         if (member.type->primitive == PrimitiveKind::Void ||
-                member.type->primitive == PrimitiveKind::Prototype) {
+                member.type->primitive == PrimitiveKind::Prototype ||
+                member.type->primitive == PrimitiveKind::Span) {
             ThrowError<Napi::TypeError>(env, "Type %1 cannot be used as a member (maybe try %1 *)", member.type->name);
             return env.Null();
         }
@@ -326,6 +370,10 @@ static Napi::Value CreatePointerType(const Napi::CallbackInfo &info)
         ThrowError<Napi::TypeError>(env, "Cannot create pointer to disposable type '%1'", type->name);
         return env.Null();
     }
+    if (type->primitive == PrimitiveKind::Span) {
+        ThrowError<Napi::TypeError>(env, "Cannot create pointer to span type '%1'", type->name);
+        return env.Null();
+    }
 
     int count = 0;
     if (info.Length() >= 2u + named) {
@@ -372,7 +420,7 @@ static Napi::Value CreatePointerType(const Napi::CallbackInfo &info)
 
 static Napi::Value EncodePointerDirection(const Napi::CallbackInfo &info, int directions)
 {
-    RG_ASSERT(directions >= 1 && directions <= 3);
+    RG_ASSERT(directions >= 1 && directions <= 4);
 
     Napi::Env env = info.Env();
     InstanceData *instance = env.GetInstanceData<InstanceData>();
@@ -386,7 +434,8 @@ static Napi::Value EncodePointerDirection(const Napi::CallbackInfo &info, int di
     if (!type)
         return env.Null();
 
-    if (type->primitive != PrimitiveKind::Pointer) {
+    if (type->primitive != PrimitiveKind::Pointer &&
+            (type->primitive != PrimitiveKind::Span || directions == 4)) {
         ThrowError<Napi::TypeError>(env, "Unexpected %1 type, expected pointer type", PrimitiveKindNames[(int)type->primitive]);
         return env.Null();
     }
@@ -415,6 +464,11 @@ static Napi::Value MarkInOut(const Napi::CallbackInfo &info)
     return EncodePointerDirection(info, 3);
 }
 
+static Napi::Value MarkPinned(const Napi::CallbackInfo &info)
+{
+    return EncodePointerDirection(info, 4);
+}
+
 static Napi::Value CreateDisposableType(const Napi::CallbackInfo &info)
 {
     Napi::Env env = info.Env();
@@ -462,15 +516,19 @@ static Napi::Value CreateDisposableType(const Napi::CallbackInfo &info)
             InstanceData *instance = env.GetInstanceData<InstanceData>();
             const Napi::FunctionReference &ref = type->dispose_ref;
 
-            Napi::External<void> external = Napi::External<void>::New(env, (void *)ptr);
-            SetValueTag(instance, external, type->ref.marker);
+            // Use the raw N-API calls, the C++ wrappers abort when JS cannot run anymore,
+            // which happens when views are finalized on exit. Skip disposal in this case.
+            napi_value external;
+            if (napi_create_external(env, (void *)ptr, nullptr, nullptr, &external) != napi_ok)
+                return;
+            SetValueTag(instance, Napi::Value(env, external), type->ref.marker);
 
-            Napi::Value self = env.Null();
+            napi_value self = env.Null();
             napi_value args[] = {
                 external
             };
 
-            ref.Call(self, RG_LEN(args), args);
+            napi_call_function(env, self, ref.Value(), RG_LEN(args), args, nullptr);
         };
         dispose_func = func;
     } else {
@@ -499,6 +557,70 @@ static Napi::Value CreateDisposableType(const Napi::CallbackInfo &info)
     return external;
 }
 
+static Napi::Value CreateLazyType(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    if (info.Length() < 1) {
+        ThrowError<Napi::TypeError>(env, "Expected 1 or 2 arguments, got %1", info.Length());
+        return env.Null();
+    }
+
+    bool named = (info.Length() >= 2);
+
+    if (named && !info[0].IsString()) {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value for name, expected string", GetValueType(instance, info[0]));
+        return env.Null();
+    }
+
+    const TypeInfo *src = ResolveType(info[named]);
+    if (!src)
+        return env.Null();
+    if (src->primitive != PrimitiveKind::Record) {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 type, expected struct or union type", PrimitiveKindNames[(int)src->primitive]);
+        return env.Null();
+    }
+    if (src->lazy) {
+        ThrowError<Napi::TypeError>(env, "Type '%1' is already lazy", src->name);
+        return env.Null();
+    }
+
+    // Lazy objects read members after the call, strings may not be valid anymore
+    if (NeedsTemporaryMemory(src)) {
+        ThrowError<Napi::TypeError>(env, "Lazy type '%1' cannot contain string members", src->name);
+        return env.Null();
+    }
+
+    std::string name = named ? info[0].As<Napi::String>() : std::string(src->name);
+
+    TypeInfo *type = instance->types.AppendDefault();
+    RG_DEFER_N(err_guard) { instance->types.RemoveLast(1); };
+
+    type->name = DuplicateString(name.c_str(), &instance->str_alloc).ptr;
+    type->primitive = src->primitive;
+    type->size = src->size;
+    type->align = src->align;
+    type->members.Append(src->members);
+    type->lazy = true;
+
+    // Generate accessors now, so that problems show up here instead of on first use
+    if (GetRecordView(env, type).IsEmpty())
+        return env.Null();
+
+    // If the insert succeeds, we cannot fail anymore
+    if (named && !instance->types_map.TrySet(type->name, type).second) {
+        ThrowError<Napi::Error>(env, "Duplicate type name '%1'", type->name);
+        return env.Null();
+    }
+    err_guard.Disable();
+
+    Napi::External<TypeInfo> external = Napi::External<TypeInfo>::New(env, type);
+    SetValueTag(instance, external, &TypeInfoMarker);
+
+    return external;
+}
+
 static Napi::Value CallFree(const Napi::CallbackInfo &info)
 {
     Napi::Env env = info.Env();
@@ -540,6 +662,10 @@ static Napi::Value CreateArrayType(const Napi::CallbackInfo &info)
 
     if (!ref)
         return env.Null();
+    if (ref->primitive == PrimitiveKind::Span) {
+        ThrowError<Napi::TypeError>(env, "Cannot create array of span type '%1'", ref->name);
+        return env.Null();
+    }
     if (len <= 0) {
         ThrowError<Napi::TypeError>(env, "Array length must be positive and non-zero");
         return env.Null();
@@ -596,6 +722,123 @@ static Napi::Value CreateArrayType(const Napi::CallbackInfo &info)
     return external;
 }
 
+static Napi::Value CreateSpanType(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    if (info.Length() < 1) {
+        ThrowError<Napi::TypeError>(env, "Expected 1 or 2 arguments, got %1", info.Length());
+        return env.Null();
+    }
+
+    const TypeInfo *ref = ResolveType(info[0]);
+    if (!ref)
+        return env.Null();
+    if (ref->primitive != PrimitiveKind::Void && GetTypedArrayType(ref) < 0) {
+        ThrowError<Napi::TypeError>(env, "Span elements must be void or a type compatible with TypedArray, not %1", ref->name);
+        return env.Null();
+    }
+
+    const TypeInfo *length;
+    if (info.Length() >= 2 && !IsNullOrUndefined(info[1])) {
+        length = ResolveType(info[1]);
+        if (!length)
+            return env.Null();
+        if (!IsInteger(length)) {
+            ThrowError<Napi::TypeError>(env, "Span length must be an integer type, not %1", length->name);
+            return env.Null();
+        }
+    } else {
+        length = instance->types_map.FindValue("size_t", nullptr);
+        RG_ASSERT(length);
+    }
+
+    const TypeInfo *type = MakeSpanType(instance, ref, length);
+
+    Napi::External<TypeInfo> external = Napi::External<TypeInfo>::New(env, (TypeInfo *)type);
+    SetValueTag(instance, external, &TypeInfoMarker);
+
+    return external;
+}
+
+static Napi::Value CreateRecordArray(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    if (info.Length() < 2) {
+        ThrowError<Napi::TypeError>(env, "Expected 2 arguments, got %1", info.Length());
+        return env.Null();
+    }
+
+    const TypeInfo *type = ResolveType(info[0]);
+    if (!type)
+        return env.Null();
+    if (type->primitive != PrimitiveKind::Record || !type->size) {
+        ThrowError<Napi::TypeError>(env, "Record arrays can only be made of non-empty struct or union types, not %1", type->name);
+        return env.Null();
+    }
+
+    Napi::ArrayBuffer buffer;
+    int64_t offset;
+    int64_t len;
+
+    if (info[1].IsNumber()) {
+        len = info[1].As<Napi::Number>().Int64Value();
+
+        if (len < 0 || len > INT32_MAX / type->size) {
+            ThrowError<Napi::Error>(env, "Record array length must be between 0 and %1", INT32_MAX / type->size);
+            return env.Null();
+        }
+
+        buffer = Napi::ArrayBuffer::New(env, (size_t)(len * type->size));
+        offset = 0;
+    } else if (info[1].IsArrayBuffer()) {
+        buffer = info[1].As<Napi::ArrayBuffer>();
+        offset = 0;
+        len = (int64_t)buffer.ByteLength() / type->size;
+    } else if (info[1].IsTypedArray() || info[1].IsDataView()) {
+        void *ptr;
+        size_t size;
+        napi_value raw;
+        size_t start;
+
+        if (info[1].IsTypedArray()) {
+            napi_status status = napi_get_typedarray_info(env, info[1], nullptr, nullptr, &ptr, &raw, &start);
+            RG_ASSERT(status == napi_ok);
+
+            size = info[1].As<Napi::TypedArray>().ByteLength();
+        } else {
+            napi_status status = napi_get_dataview_info(env, info[1], &size, &ptr, &raw, &start);
+            RG_ASSERT(status == napi_ok);
+        }
+
+        buffer = Napi::ArrayBuffer(env, raw);
+        offset = (int64_t)start;
+        len = (int64_t)size / type->size;
+    } else {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value for length, expected integer or buffer", GetValueType(instance, info[1]));
+        return env.Null();
+    }
+
+    if (offset % type->align) {
+        ThrowError<Napi::Error>(env, "Buffer offset must be aligned to %1 bytes for type %2", type->align, type->name);
+        return env.Null();
+    }
+
+    Napi::Function cls = GetRecordArray(env, type);
+    if (cls.IsEmpty())
+        return env.Null();
+
+    Napi::Object obj = cls.New({ buffer, Napi::Number::New(env, (double)offset), Napi::Number::New(env, (double)len) });
+    if (obj.IsEmpty())
+        return env.Null();
+    SetValueTag(instance, obj, type);
+
+    return obj;
+}
+
 static bool ParseClassicFunction(Napi::Env env, Napi::String name, Napi::Value ret,
                                  Napi::Array parameters, FunctionInfo *func)
 {
@@ -622,6 +865,10 @@ static bool ParseClassicFunction(Napi::Env env, Napi::String name, Napi::Value r
         ThrowError<Napi::Error>(env, "You are not allowed to directly return fixed-size arrays");
         return false;
     }
+    if (func->ret.type->primitive == PrimitiveKind::Span) {
+        ThrowError<Napi::Error>(env, "Spans cannot be returned, use an output span parameter instead");
+        return false;
+    }
 
     if (!parameters.IsArray()) {
         ThrowError<Napi::TypeError>(env, "Unexpected %1 value for parameters of '%2', expected an array", GetValueType(instance, parameters), func->name);
@@ -652,7 +899,9 @@ static bool ParseClassicFunction(Napi::Env env, Napi::String name, Napi::Value r
             return false;
         }
 
-        if (func->parameters.len >= MaxParameters) {
+        bool span = (param.type->primitive == PrimitiveKind::Span);
+
+        if (func->parameters.len + span >= MaxParameters) {
             ThrowError<Napi::TypeError>(env, "Functions cannot have more than %1 parameters", MaxParameters);
             return false;
         }
@@ -663,7 +912,11 @@ static bool ParseClassicFunction(Napi::Env env, Napi::String name, Napi::Value r
 
         param.offset = (int8_t)j;
 
-        func->parameters.Append(param);
+        if (span) {
+            AppendSpanParameters(instance, param, func);
+        } else {
+            func->parameters.Append(param);
+        }
     }
 
     return true;
@@ -698,6 +951,10 @@ static Napi::Value CreateCallbackType(const Napi::CallbackInfo &info)
         LogError("Variadic callbacks are not supported");
         return env.Null();
     }
+    if (func->hidden_parameters) {
+        ThrowError<Napi::TypeError>(env, "Span parameters are not supported in callbacks");
+        return env.Null();
+    }
 
     if (!AnalyseFunction(env, instance, func))
         return env.Null();
@@ -776,128 +1033,374 @@ static Napi::Value GetTypeSize(const Napi::CallbackInfo &info)
     return Napi::Number::New(env, type->size);
 }
 
-static Napi::Value GetTypeAlign(const Napi::CallbackInfo &info)
+// Raw pointers can't be checked, buffers are bounded by their length
+static bool ResolveMemory(Napi::Value value, int64_t offset, Size need, uint8_t **out_ptr)
 {
-    Napi::Env env = info.Env();
+    Napi::Env env = value.Env();
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
 
-    if (info.Length() < 1) {
-        ThrowError<Napi::TypeError>(env, "Expected 1 argument, got %1", info.Length());
-        return env.Null();
+    uint8_t *ptr;
+    Size len;
+
+    if (value.IsExternal() && !CheckValueTag(instance, value, &TypeInfoMarker)) {
+        Napi::External<void> external = value.As<Napi::External<void>>();
+
+        ptr = (uint8_t *)external.Data();
+        len = -1;
+
+        if (RG_UNLIKELY(!ptr)) {
+            ThrowError<Napi::Error>(env, "Cannot access memory through NULL pointer");
+            return false;
+        }
+    } else if (value.IsArrayBuffer()) {
+        Napi::ArrayBuffer buffer = value.As<Napi::ArrayBuffer>();
+
+        ptr = (uint8_t *)buffer.Data();
+        len = (Size)buffer.ByteLength();
+    } else if (value.IsTypedArray()) {
+        Napi::TypedArray array = value.As<Napi::TypedArray>();
+
+        ptr = (uint8_t *)array.ArrayBuffer().Data() + array.ByteOffset();
+        len = (Size)array.ByteLength();
+    } else {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value for ptr, expected external or buffer", GetValueType(instance, value));
+        return false;
     }
 
-    const TypeInfo *type = ResolveType(info[0]);
-    if (!type)
-        return env.Null();
+    if (RG_UNLIKELY(offset < 0 || (len >= 0 && (offset > len || need > len - offset)))) {
+        ThrowError<Napi::Error>(env, "Cannot access %1 bytes at offset %2 (buffer size is %3)", need, offset, len);
+        return false;
+    }
 
-    return Napi::Number::New(env, type->align);
+    *out_ptr = ptr + offset;
+    return true;
 }
 
-static Napi::Value GetResolvedType(const Napi::CallbackInfo &info)
+static const TypeInfo *ResolveConcreteType(Napi::Value value)
 {
-    Napi::Env env = info.Env();
-    InstanceData *instance = env.GetInstanceData<InstanceData>();
-
-    if (info.Length() < 1) {
-        ThrowError<Napi::TypeError>(env, "Expected 1 argument, got %1", info.Length());
-        return env.Null();
-    }
+    Napi::Env env = value.Env();
 
-    const TypeInfo *type = ResolveType(info[0]);
+    const TypeInfo *type = ResolveType(value);
     if (!type)
-        return env.Null();
+        return nullptr;
 
-    Napi::External<TypeInfo> external = Napi::External<TypeInfo>::New(env, (TypeInfo *)type);
-    SetValueTag(instance, external, &TypeInfoMarker);
+    if (RG_UNLIKELY(type->primitive == PrimitiveKind::Void ||
+                    type->primitive == PrimitiveKind::Prototype ||
+                    type->primitive == PrimitiveKind::Span)) {
+        ThrowError<Napi::TypeError>(env, "Cannot access memory as %1", type->name);
+        return nullptr;
+    }
 
-    return external;
+    return type;
 }
 
-static Napi::Value GetTypeDefinition(const Napi::CallbackInfo &info)
+static Napi::Value DecodeValue(const Napi::CallbackInfo &info)
 {
     Napi::Env env = info.Env();
     InstanceData *instance = env.GetInstanceData<InstanceData>();
 
-    if (info.Length() < 1) {
-        ThrowError<Napi::TypeError>(env, "Expected 1 argument, got %1", info.Length());
+    if (info.Length() < 3) {
+        ThrowError<Napi::TypeError>(env, "Expected 3 or 4 arguments, got %1", info.Length());
+        return env.Null();
+    }
+    if (!info[1].IsNumber()) {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value for offset, expected number", GetValueType(instance, info[1]));
+        return env.Null();
+    }
+    if (info.Length() >= 4 && !info[3].IsNumber()) {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value for count, expected number", GetValueType(instance, info[3]));
         return env.Null();
     }
 
-    const TypeInfo *type = ResolveType(info[0]);
+    const TypeInfo *type = ResolveConcreteType(info[2]);
     if (!type)
         return env.Null();
 
-    if (type->defn.IsEmpty()) {
-        Napi::Object defn = Napi::Object::New(env);
+    int64_t offset = info[1].As<Napi::Number>().Int64Value();
 
-        defn.Set("name", Napi::String::New(env, type->name));
-        defn.Set("primitive", PrimitiveKindNames[(int)type->primitive]);
-        defn.Set("size", Napi::Number::New(env, (double)type->size));
-        defn.Set("alignment", Napi::Number::New(env, (double)type->align));
+    if (info.Length() >= 4) {
+        int64_t count = info[3].As<Napi::Number>().Int64Value();
 
-        switch (type->primitive) {
-            case PrimitiveKind::Void:
-            case PrimitiveKind::Bool:
-            case PrimitiveKind::Int8:
-            case PrimitiveKind::UInt8:
-            case PrimitiveKind::Int16:
-            case PrimitiveKind::UInt16:
-            case PrimitiveKind::Int32:
-            case PrimitiveKind::UInt32:
-            case PrimitiveKind::Int64:
-            case PrimitiveKind::UInt64:
-            case PrimitiveKind::String:
-            case PrimitiveKind::String16:
-            case PrimitiveKind::Float32:
-            case PrimitiveKind::Float64:
-            case PrimitiveKind::Prototype:
-            case PrimitiveKind::Callback: {} break;
+        if (RG_UNLIKELY(count < 0 || count > UINT32_MAX / std::max(type->size, (int16_t)1))) {
+            ThrowError<Napi::Error>(env, "Invalid count value %1", count);
+            return env.Null();
+        }
 
-            case PrimitiveKind::Array: {
-                uint32_t len = type->size / type->ref.type->size;
-                defn.Set("length", Napi::Number::New(env, (double)len));
-            } [[fallthrough]];
-            case PrimitiveKind::Pointer: {
-                Napi::External<TypeInfo> external = Napi::External<TypeInfo>::New(env, (TypeInfo *)type->ref.type);
-                SetValueTag(instance, external, &TypeInfoMarker);
+        uint8_t *ptr;
+        if (!ResolveMemory(info[0], offset, (Size)count * type->size, &ptr))
+            return env.Null();
 
-                defn.Set("ref", external);
-            } break;
-            case PrimitiveKind::Record: {
-                Napi::Object members = Napi::Object::New(env);
+        int typed = GetTypedArrayType(type);
 
-                for (const RecordMember &member: type->members) {
-                    Napi::External<TypeInfo> external = Napi::External<TypeInfo>::New(env, (TypeInfo *)member.type);
-                    SetValueTag(instance, external, &TypeInfoMarker);
+        if (typed >= 0) {
+            Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, (size_t)count * type->size);
+            memcpy(buffer.Data(), ptr, (size_t)count * type->size);
 
-                    members.Set(member.name, external);
-                }
+            napi_value array;
+            napi_status status = napi_create_typedarray(env, (napi_typedarray_type)typed, (size_t)count, buffer, 0, &array);
+            RG_ASSERT(status == napi_ok);
 
-                defn.Set("members", members);
-            } break;
+            return Napi::Value(env, array);
+        } else {
+            Napi::Array array = Napi::Array::New(env, (size_t)count);
+            DecodeNormalArray(array, ptr, type);
+
+            return array;
         }
+    } else {
+        uint8_t *ptr;
+        if (!ResolveMemory(info[0], offset, type->size, &ptr))
+            return env.Null();
 
-        defn.Freeze();
-        type->defn.Reset(defn, 1);
+        return Decode(env, ptr, type);
     }
-
-    return type->defn.Value();
 }
 
-static InstanceMemory *AllocateMemory(InstanceData *instance, Size stack_size, Size heap_size)
+static Napi::Value EncodeValue(const Napi::CallbackInfo &info)
 {
-    for (Size i = 1; i < instance->memories.len; i++) {
-        InstanceMemory *mem = instance->memories[i];
+    Napi::Env env = info.Env();
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
 
-        if (!mem->depth)
-            return mem;
+    if (info.Length() < 4) {
+        ThrowError<Napi::TypeError>(env, "Expected 4 arguments, got %1", info.Length());
+        return env.Null();
+    }
+    if (!info[1].IsNumber()) {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value for offset, expected number", GetValueType(instance, info[1]));
+        return env.Null();
     }
 
-    if (RG_UNLIKELY(instance->temporaries >= instance->max_temporaries))
-        return nullptr;
+    const TypeInfo *type = ResolveConcreteType(info[2]);
+    if (!type)
+        return env.Null();
 
-    InstanceMemory *mem = new InstanceMemory();
+    int64_t offset = info[1].As<Napi::Number>().Int64Value();
 
-    mem->stack.len = stack_size;
+    uint8_t *ptr;
+    if (!ResolveMemory(info[0], offset, type->size, &ptr))
+        return env.Null();
+    if (!Encode(env, ptr, info[3], type))
+        return env.Null();
+
+    return env.Undefined();
+}
+
+static Napi::Value CreateView(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    if (info.Length() < 2) {
+        ThrowError<Napi::TypeError>(env, "Expected 2 or 3 arguments, got %1", info.Length());
+        return env.Null();
+    }
+    if (!info[0].IsExternal() || CheckValueTag(instance, info[0], &TypeInfoMarker)) {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value for ptr, expected external", GetValueType(instance, info[0]));
+        return env.Null();
+    }
+    if (!info[1].IsNumber()) {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value for length, expected number", GetValueType(instance, info[1]));
+        return env.Null();
+    }
+
+    void *ptr = info[0].As<Napi::External<void>>().Data();
+    int64_t len = info[1].As<Napi::Number>().Int64Value();
+
+    if (RG_UNLIKELY(!ptr)) {
+        ThrowError<Napi::Error>(env, "Cannot create view of NULL pointer");
+        return env.Null();
+    }
+    if (RG_UNLIKELY(len < 0)) {
+        ThrowError<Napi::Error>(env, "Invalid length value %1", len);
+        return env.Null();
+    }
+
+    const TypeInfo *type = nullptr;
+    if (info.Length() >= 3 && !IsNullOrUndefined(info[2])) {
+        type = ResolveType(info[2]);
+        if (!type)
+            return env.Null();
+
+        if (RG_UNLIKELY(!type->dispose)) {
+            ThrowError<Napi::TypeError>(env, "Type %1 is not a disposable type", type->name);
+            return env.Null();
+        }
+    }
+
+    // The disposable type is called once the ArrayBuffer is garbage collected
+    napi_finalize finalize = nullptr;
+    if (type) {
+        finalize = [](napi_env env, void *data, void *hint) {
+            const TypeInfo *type = (const TypeInfo *)hint;
+            type->dispose(env, type, data);
+        };
+    }
+
+    napi_value buffer;
+    napi_status status = napi_create_external_arraybuffer(env, ptr, (size_t)len, finalize, (void *)type, &buffer);
+
+    if (RG_UNLIKELY(status != napi_ok)) {
+        ThrowError<Napi::Error>(env, "Failed to create external ArrayBuffer, external buffers may not be allowed by this runtime");
+        return env.Null();
+    }
+
+    return Napi::Value(env, buffer);
+}
+
+static Napi::Value GetTypeAlign(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+
+    if (info.Length() < 1) {
+        ThrowError<Napi::TypeError>(env, "Expected 1 argument, got %1", info.Length());
+        return env.Null();
+    }
+
+    const TypeInfo *type = ResolveType(info[0]);
+    if (!type)
+        return env.Null();
+
+    return Napi::Number::New(env, type->align);
+}
+
+static Napi::Value GetResolvedType(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    if (info.Length() < 1) {
+        ThrowError<Napi::TypeError>(env, "Expected 1 argument, got %1", info.Length());
+        return env.Null();
+    }
+
+    const TypeInfo *type = ResolveType(info[0]);
+    if (!type)
+        return env.Null();
+
+    Napi::External<TypeInfo> external = Napi::External<TypeInfo>::New(env, (TypeInfo *)type);
+    SetValueTag(instance, external, &TypeInfoMarker);
+
+    return external;
+}
+
+static Napi::Value GetTypeDefinition(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    if (info.Length() < 1) {
+        ThrowError<Napi::TypeError>(env, "Expected 1 argument, got %1", info.Length());
+        return env.Null();
+    }
+
+    const TypeInfo *type = ResolveType(info[0]);
+    if (!type)
+        return env.Null();
+
+    if (type->defn.IsEmpty()) {
+        Napi::Object defn = Napi::Object::New(env);
+
+        defn.Set("name", Napi::String::New(env, type->name));
+        defn.Set("primitive", PrimitiveKindNames[(int)type->primitive]);
+        defn.Set("size", Napi::Number::New(env, (double)type->size));
+        defn.Set("alignment", Napi::Number::New(env, (double)type->align));
+
+        switch (type->primitive) {
+            case PrimitiveKind::Void:
+            case PrimitiveKind::Bool:
+            case PrimitiveKind::Int8:
+            case PrimitiveKind::UInt8:
+            case PrimitiveKind::Int16:
+            case PrimitiveKind::UInt16:
+            case PrimitiveKind::Int32:
+            case PrimitiveKind::UInt32:
+            case PrimitiveKind::Int64:
+            case PrimitiveKind::UInt64:
+            case PrimitiveKind::String:
+            case PrimitiveKind::String16:
+            case PrimitiveKind::Float32:
+            case PrimitiveKind::Float64:
+            case PrimitiveKind::Callback: {} break;
+
+            case PrimitiveKind::Prototype: {
+                const FunctionInfo *proto = type->ref.proto;
+
+                Napi::External<TypeInfo> result = Napi::External<TypeInfo>::New(env, (TypeInfo *)proto->ret.type);
+                SetValueTag(instance, result, &TypeInfoMarker);
+
+                Napi::Array parameters = Napi::Array::New(env, proto->parameters.len);
+
+                for (Size i = 0; i < proto->parameters.len; i++) {
+                    const ParameterInfo &param = proto->parameters[i];
+
+                    static const char *const DirectionNames[] = { nullptr, "in", "out", "inout", "pinned" };
+
+                    Napi::Object obj = Napi::Object::New(env);
+                    Napi::External<TypeInfo> external = Napi::External<TypeInfo>::New(env, (TypeInfo *)param.type);
+                    SetValueTag(instance, external, &TypeInfoMarker);
+
+                    obj.Set("type", external);
+                    obj.Set("direction", DirectionNames[param.directions]);
+
+                    parameters.Set((uint32_t)i, obj);
+                }
+
+                defn.Set("convention", CallConventionNames[(int)proto->convention]);
+                defn.Set("result", result);
+                defn.Set("parameters", parameters);
+            } break;
+
+            case PrimitiveKind::Array: {
+                uint32_t len = type->size / type->ref.type->size;
+                defn.Set("length", Napi::Number::New(env, (double)len));
+            } [[fallthrough]];
+            case PrimitiveKind::Span:
+            case PrimitiveKind::Pointer: {
+                Napi::External<TypeInfo> external = Napi::External<TypeInfo>::New(env, (TypeInfo *)type->ref.type);
+                SetValueTag(instance, external, &TypeInfoMarker);
+
+                defn.Set("ref", external);
+            } break;
+            case PrimitiveKind::Record: {
+                Napi::Object members = Napi::Object::New(env);
+
+                for (const RecordMember &member: type->members) {
+                    Napi::External<TypeInfo> external = Napi::External<TypeInfo>::New(env, (TypeInfo *)member.type);
+                    SetValueTag(instance, external, &TypeInfoMarker);
+
+                    members.Set(member.name, external);
+                }
+
+                defn.Set("members", members);
+            } break;
+        }
+
+        defn.Freeze();
+        type->defn.Reset(defn, 1);
+    }
+
+    return type->defn.Value();
+}
+
+static InstanceMemory *AllocateMemory(InstanceData *instance, Size stack_size, Size heap_size)
+{
+    for (Size i = 1; i < instance->memories.len; i++) {
+        InstanceMemory *mem = instance->memories[i];
+
+        if (!mem->depth)
+            return mem;
+    }
+
+    if (RG_UNLIKELY(instance->stats)) {
+        instance->async_pool_misses++;
+    }
+
+    if (RG_UNLIKELY(instance->temporaries >= instance->max_temporaries))
+        return nullptr;
+
+    InstanceMemory *mem = new InstanceMemory();
+
+    mem->stack.len = stack_size;
 #if defined(_WIN32)
     mem->stack.ptr = (uint8_t *)VirtualAlloc(nullptr, mem->stack.len, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
 #elif defined(__APPLE__)
@@ -920,196 +1423,990 @@ static InstanceMemory *AllocateMemory(InstanceData *instance, Size stack_size, S
 #endif
     RG_CRITICAL(mem->heap.ptr, "Failed to allocate %1 of memory", mem->heap.len);
 
-    mem->depth = 0;
+    mem->depth = 0;
+
+    if (instance->memories.len <= instance->resident_async_pools) {
+        instance->memories.Append(mem);
+        mem->temporary = false;
+    } else {
+        instance->temporaries++;
+        mem->temporary = true;
+    }
+
+    return mem;
+}
+
+// Slow path of RunCall(), used when statistics or tracing are enabled
+template <typename CompleteFunc>
+static bool RunMeasuredCall(Napi::Env env, InstanceData *instance, CallData *call, const FunctionInfo *func,
+                            const napi_value *args, CompleteFunc complete)
+{
+    FunctionStats *stats = func->stats;
+    CallTracer *tracer = instance->tracer;
+
+    int64_t start = GetStatsTime();
+    int64_t prepared = 0;
+    int64_t executed = 0;
+    napi_value ret = nullptr;
+    bool ready = call->Prepare(args);
+    bool success = ready;
+
+    if (RG_LIKELY(ready)) {
+        if (instance->debug) {
+            call->DumpForward();
+        }
+
+        prepared = GetStatsTime();
+        call->Execute();
+        executed = GetStatsTime();
+        ret = complete();
+
+        // Exceptions can be thrown by JS callbacks
+        success = !env.IsExceptionPending();
+    } else {
+        prepared = GetStatsTime();
+        executed = prepared;
+    }
+
+    int64_t completed = GetStatsTime();
+
+    if (stats) {
+        stats->calls++;
+        stats->errors += !success;
+        stats->prepare_time += prepared - start;
+        stats->execute_time += executed - prepared;
+        stats->complete_time += completed - executed;
+    }
+
+    if (tracer) {
+        TraceRecord rec = {};
+
+        rec.kind = TraceKind::Call;
+        rec.flags = !success;
+        rec.u.call.start = start;
+        rec.u.call.end = completed;
+        rec.u.call.native_time = executed - prepared;
+
+        CallTracer::SummarizeArguments(env, func, args, &rec);
+        rec.types[2] = ret ? CallTracer::SummarizeValue(env, ret, &rec.u.call.ret) : TraceValue::None;
+
+        tracer->Record(func, &rec);
+    }
+
+    // Only preparation errors are reported to the caller, other exceptions propagate by themselves
+    return ready;
+}
+
+// Runs the Prepare/Execute/Complete sequence, and measures each step if stats or tracing are enabled
+template <typename CompleteFunc>
+static inline bool RunDirectCall(Napi::Env env, InstanceData *instance, CallData *call, const FunctionInfo *func,
+                                 const napi_value *args, CompleteFunc complete)
+{
+    if (RG_UNLIKELY(func->stats || instance->tracer))
+        return RunMeasuredCall(env, instance, call, func, args, complete);
+
+    if (!RG_UNLIKELY(call->Prepare(args)))
+        return false;
+
+    if (instance->debug) {
+        call->DumpForward();
+    }
+    call->Execute();
+
+    complete();
+    return true;
+}
+
+template <typename CompleteFunc>
+static bool RunSpanCall(Napi::Env env, InstanceData *instance, CallData *call, const FunctionInfo *func,
+                        const napi_value *args, CompleteFunc complete)
+{
+    napi_value expanded[MaxExpandedArguments];
+
+    if (!RG_UNLIKELY(ExpandSpans(env, func, args, expanded)))
+        return false;
+
+    return RunDirectCall(env, instance, call, func, expanded, complete);
+}
+
+template <typename CompleteFunc>
+static inline bool RunCall(Napi::Env env, InstanceData *instance, CallData *call, const FunctionInfo *func,
+                           const napi_value *args, CompleteFunc complete)
+{
+    if (RG_UNLIKELY(func->hidden_parameters))
+        return RunSpanCall(env, instance, call, func, args, complete);
+
+    return RunDirectCall(env, instance, call, func, args, complete);
+}
+
+static Napi::Value PerformNormalCall(Napi::Env env, const FunctionInfo *func, const napi_value *args, Size argc)
+{
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    Size arity = func->parameters.len - func->hidden_parameters;
+
+    if (RG_UNLIKELY(argc < arity)) {
+        ThrowError<Napi::TypeError>(env, "Expected %1 arguments, got %2", arity, argc);
+        return env.Null();
+    }
+
+    InstanceMemory *mem = instance->memories[0];
+    CallData call(env, instance, func, mem);
+
+    Napi::Value ret;
+    if (!RunCall(env, instance, &call, func, args, [&]() { ret = call.Complete(); return (napi_value)ret; }))
+        return env.Null();
+
+    return ret;
+}
+
+static napi_value TranslateNormalCall(napi_env env, napi_callback_info info)
+{
+    napi_value args[MaxParameters];
+    size_t argc = RG_LEN(args);
+    void *data;
+
+    napi_get_cb_info(env, info, &argc, args, nullptr, &data);
+
+    return PerformNormalCall(env, (const FunctionInfo *)data, args, (Size)argc);
+}
+
+// Same as a normal call, but the struct return value is decoded into the first argument
+static napi_value TranslateIntoCall(napi_env env_napi, napi_callback_info info)
+{
+    Napi::Env env(env_napi);
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    napi_value args[MaxParameters + 1];
+    size_t argc = RG_LEN(args);
+    void *data;
+
+    napi_get_cb_info(env, info, &argc, args, nullptr, &data);
+
+    const FunctionInfo *func = (const FunctionInfo *)data;
+    Size arity = func->parameters.len - func->hidden_parameters;
+
+    if (RG_UNLIKELY((Size)argc < arity + 1)) {
+        ThrowError<Napi::TypeError>(env, "Expected %1 arguments, got %2", arity + 1, argc);
+        return env.Null();
+    }
+
+    Napi::Value target(env, args[0]);
+
+    if (target.IsTypedArray()) {
+        Napi::TypedArray array = target.As<Napi::TypedArray>();
+
+        if (RG_UNLIKELY((Size)array.ByteLength() < func->ret.type->size)) {
+            ThrowError<Napi::Error>(env, "Target %1 is too small for %2 (%3 bytes)", GetValueType(instance, target), func->ret.type->name, func->ret.type->size);
+            return env.Null();
+        }
+    } else if (RG_UNLIKELY(!IsObject(target))) {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value for target, expected object or TypedArray", GetValueType(instance, target));
+        return env.Null();
+    }
+
+    InstanceMemory *mem = instance->memories[0];
+    CallData call(env, instance, func, mem);
+
+    Napi::Value ret;
+    if (!RunCall(env, instance, &call, func, args + 1, [&]() { ret = call.CompleteInto(target.As<Napi::Object>()); return (napi_value)ret; }))
+        return env.Null();
+
+    return ret;
+}
+
+static const FunctionInfo *FindVariadicVariant(const FunctionInfo *func, Span<const ParameterInfo> extra)
+{
+    for (const FunctionInfo *variant: func->variants) {
+        if (variant->parameters.len != func->parameters.len + extra.len)
+            continue;
+
+        const ParameterInfo *params = variant->parameters.ptr + func->parameters.len;
+        bool match = true;
+
+        for (Size i = 0; i < extra.len; i++) {
+            if (params[i].type != extra[i].type || params[i].directions != extra[i].directions) {
+                match = false;
+                break;
+            }
+        }
+
+        if (match)
+            return variant;
+    }
+
+    return nullptr;
+}
+
+static napi_value TranslateVariadicCall(napi_env env_napi, napi_callback_info info)
+{
+    Napi::Env env(env_napi);
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    napi_value args[MaxParameters * 2];
+    size_t argc = RG_LEN(args);
+    void *data;
+
+    napi_get_cb_info(env, info, &argc, args, nullptr, &data);
+
+    const FunctionInfo *base = (const FunctionInfo *)data;
+    Size arity = base->parameters.len - base->hidden_parameters;
+
+    if (RG_UNLIKELY(argc < (size_t)arity)) {
+        ThrowError<Napi::TypeError>(env, "Expected %1 arguments or more, got %2", arity, argc);
+        return env.Null();
+    }
+    if (RG_UNLIKELY((argc - arity) % 2)) {
+        ThrowError<Napi::Error>(env, "Missing value argument for variadic call");
+        return env.Null();
+    }
+    if (RG_UNLIKELY(argc > RG_LEN(args))) {
+        ThrowError<Napi::TypeError>(env, "Functions cannot have more than %1 parameters", MaxParameters);
+        return env.Null();
+    }
+
+    LocalArray<ParameterInfo, MaxParameters> extra;
+    int out_parameters = base->out_parameters;
+
+    for (Size i = arity; i < (Size)argc; i += 2) {
+        ParameterInfo param = {};
+
+        param.type = ResolveType(Napi::Value(env, args[i]), &param.directions);
+        if (RG_UNLIKELY(!param.type))
+            return env.Null();
+        if (RG_UNLIKELY(param.type->primitive == PrimitiveKind::Void ||
+                        param.type->primitive == PrimitiveKind::Array ||
+                        param.type->primitive == PrimitiveKind::Prototype ||
+                        param.type->primitive == PrimitiveKind::Span)) {
+            ThrowError<Napi::TypeError>(env, "Type %1 cannot be used as a parameter (maybe try %1 *)", PrimitiveKindNames[(int)param.type->primitive]);
+            return env.Null();
+        }
+
+        if (RG_UNLIKELY(base->parameters.len + extra.len >= MaxParameters)) {
+            ThrowError<Napi::TypeError>(env, "Functions cannot have more than %1 parameters", MaxParameters);
+            return env.Null();
+        }
+        if (RG_UNLIKELY((param.directions & 2) && ++out_parameters >= MaxOutParameters)) {
+            ThrowError<Napi::TypeError>(env, "Functions cannot have more than out %1 parameters", MaxOutParameters);
+            return env.Null();
+        }
+
+        param.variadic = true;
+        param.offset = (int8_t)(i + 1);
+
+        extra.Append(param);
+    }
+
+    const FunctionInfo *func = FindVariadicVariant(base, extra);
+    const FunctionInfo *uncached = nullptr;
+    RG_DEFER {
+        if (uncached) {
+            uncached->Unref();
+        }
+    };
+
+    if (!func) {
+        FunctionInfo *variant = new FunctionInfo();
+        uncached = variant;
+
+        variant->name = base->name;
+        variant->decorated_name = base->decorated_name;
+        variant->func = base->func;
+        variant->convention = base->convention;
+        variant->ret = base->ret;
+        variant->parameters.Append(base->parameters);
+        variant->parameters.Append(extra);
+        variant->out_parameters = (int8_t)out_parameters;
+        variant->hidden_parameters = base->hidden_parameters;
+        variant->variadic = true;
+        variant->stats = base->stats;
+
+        if (RG_UNLIKELY(!AnalyseFunction(env, instance, variant)))
+            return env.Null();
+
+        // Past this limit, the variant is only used for this call
+        if (base->variants.len < MaxVariadicVariants) {
+            base->variants.Append(variant);
+            uncached = nullptr;
+        }
+
+        func = variant;
+    }
+
+    InstanceMemory *mem = instance->memories[0];
+    CallData call(env, instance, func, mem);
+
+    Napi::Value ret;
+    if (!RunCall(env, instance, &call, func, args, [&]() { ret = call.Complete(); return (napi_value)ret; }))
+        return env.Null();
+
+    return ret;
+}
+
+static void QueueAsyncCall(InstanceData *instance, AsyncCall *async, const napi_value *args)
+{
+    if (!instance->async_engine) {
+        instance->async_engine = new AsyncEngine(async->Env(), instance->async_threads);
+    }
+
+    if (async->Prepare(args) && instance->debug) {
+        async->DumpForward();
+    }
+    instance->async_engine->Queue(async);
+}
+
+static napi_value TranslateAsyncCall(napi_env env_napi, napi_callback_info info)
+{
+    Napi::Env env(env_napi);
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    napi_value args[MaxParameters + 1];
+    size_t argc = RG_LEN(args);
+    void *data;
+
+    napi_get_cb_info(env, info, &argc, args, nullptr, &data);
+
+    const FunctionInfo *func = (const FunctionInfo *)data;
+    Size arity = func->parameters.len - func->hidden_parameters;
+
+    if (argc <= (size_t)arity) {
+        ThrowError<Napi::TypeError>(env, "Expected %1 arguments, got %2", arity + 1, argc);
+        return env.Null();
+    }
+
+    Napi::Function callback(env, args[arity]);
+
+    if (!callback.IsFunction()) {
+        ThrowError<Napi::TypeError>(env, "Expected callback function as last argument, got %1", GetValueType(instance, callback));
+        return env.Null();
+    }
+
+    InstanceMemory *mem = AllocateMemory(instance, instance->async_stack_size, instance->async_heap_size);
+    if (RG_UNLIKELY(!mem)) {
+        ThrowError<Napi::Error>(env, "Too many asynchronous calls are running");
+        return env.Null();
+    }
+
+    AsyncCall *async = new AsyncCall(env, instance, func, mem, callback);
+    QueueAsyncCall(instance, async, args);
+
+    return env.Undefined();
+}
+
+static napi_value TranslatePromiseCall(napi_env env_napi, napi_callback_info info)
+{
+    Napi::Env env(env_napi);
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    napi_value args[MaxParameters];
+    size_t argc = RG_LEN(args);
+    void *data;
+
+    napi_get_cb_info(env, info, &argc, args, nullptr, &data);
+
+    const FunctionInfo *func = (const FunctionInfo *)data;
+    Size arity = func->parameters.len - func->hidden_parameters;
+
+    if (argc < (size_t)arity) {
+        ThrowError<Napi::TypeError>(env, "Expected %1 arguments, got %2", arity, argc);
+        return env.Null();
+    }
+
+    InstanceMemory *mem = AllocateMemory(instance, instance->async_stack_size, instance->async_heap_size);
+    if (RG_UNLIKELY(!mem)) {
+        ThrowError<Napi::Error>(env, "Too many asynchronous calls are running");
+        return env.Null();
+    }
+
+    napi_deferred deferred;
+    napi_value promise;
+
+    napi_status status = napi_create_promise(env, &deferred, &promise);
+    RG_ASSERT(status == napi_ok);
+
+    AsyncCall *async = new AsyncCall(env, instance, func, mem, deferred);
+    QueueAsyncCall(instance, async, args);
+
+    return promise;
+}
+
+struct BatchColumn {
+    napi_value value; // Passed as-is for each call if ptr is null
+    const uint8_t *ptr;
+    napi_typedarray_type type;
+};
+
+static napi_value GetBatchValue(napi_env env, const BatchColumn &col, Size idx)
+{
+    napi_value value = col.value;
+
+    if (col.ptr) {
+        switch (col.type) {
+            case napi_int8_array: { napi_create_int32(env, ((const int8_t *)col.ptr)[idx], &value); } break;
+            case napi_uint8_array:
+            case napi_uint8_clamped_array: { napi_create_uint32(env, col.ptr[idx], &value); } break;
+            case napi_int16_array: { napi_create_int32(env, ((const int16_t *)col.ptr)[idx], &value); } break;
+            case napi_uint16_array: { napi_create_uint32(env, ((const uint16_t *)col.ptr)[idx], &value); } break;
+            case napi_int32_array: { napi_create_int32(env, ((const int32_t *)col.ptr)[idx], &value); } break;
+            case napi_uint32_array: { napi_create_uint32(env, ((const uint32_t *)col.ptr)[idx], &value); } break;
+            case napi_float32_array: { napi_create_double(env, ((const float *)col.ptr)[idx], &value); } break;
+            case napi_float64_array: { napi_create_double(env, ((const double *)col.ptr)[idx], &value); } break;
+            case napi_bigint64_array: { napi_create_bigint_int64(env, ((const int64_t *)col.ptr)[idx], &value); } break;
+            case napi_biguint64_array: { napi_create_bigint_uint64(env, ((const uint64_t *)col.ptr)[idx], &value); } break;
+        }
+    }
+
+    return value;
+}
+
+static napi_value TranslateBatchCall(napi_env env_napi, napi_callback_info info)
+{
+    Napi::Env env(env_napi);
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    napi_value args[2];
+    size_t argc = RG_LEN(args);
+    void *data;
+
+    napi_get_cb_info(env, info, &argc, args, nullptr, &data);
+
+    const FunctionInfo *func = (const FunctionInfo *)data;
+    Size arity = func->parameters.len - func->hidden_parameters;
+
+    if (RG_UNLIKELY(argc < 1)) {
+        ThrowError<Napi::TypeError>(env, "Expected 1 or 2 arguments, got %1", argc);
+        return env.Null();
+    }
+
+    Napi::Value calls(env, args[0]);
+    Napi::Value results = (argc >= 2) ? Napi::Value(env, args[1]) : Napi::Value();
+
+    // Rows are given as an array of argument arrays, while columns are given as an object
+    // with one TypedArray (or a single value shared by all calls) per parameter.
+    LocalArray<BatchColumn, MaxParameters> columns;
+    Size len = -1;
+
+    if (calls.IsArray()) {
+        len = calls.As<Napi::Array>().Length();
+    } else if (IsObject(calls)) {
+        Napi::Array keys = calls.As<Napi::Object>().GetPropertyNames();
+
+        if (RG_UNLIKELY(keys.Length() != (uint32_t)arity)) {
+            ThrowError<Napi::TypeError>(env, "Expected %1 columns, got %2", arity, keys.Length());
+            return env.Null();
+        }
+
+        columns.AppendDefault(arity);
+
+        // Columns are matched to parameters by name, or by index
+        uint64_t assigned = 0;
+        RG_STATIC_ASSERT(MaxParameters <= 64);
+
+        for (uint32_t i = 0; i < keys.Length(); i++) {
+            Napi::Value key = keys.Get(i);
+            std::string name = key.ToString();
+
+            Size idx = -1;
+            for (const ParameterInfo &param: func->parameters) {
+                if (param.span_length)
+                    continue;
+
+                if (param.name && name == param.name) {
+                    idx = param.offset;
+                    break;
+                }
+            }
+            if (idx < 0) {
+                char *end;
+                unsigned long value = strtoul(name.c_str(), &end, 10);
+
+                if (name.length() && !end[0] && value < (unsigned long)arity) {
+                    idx = (Size)value;
+                }
+            }
+
+            if (RG_UNLIKELY(idx < 0)) {
+                ThrowError<Napi::TypeError>(env, "Unknown batch column '%1'", name.c_str());
+                return env.Null();
+            }
+            if (RG_UNLIKELY(assigned & (1ull << idx))) {
+                ThrowError<Napi::TypeError>(env, "Duplicate batch column for parameter %1", idx + 1);
+                return env.Null();
+            }
+            assigned |= 1ull << idx;
+
+            Napi::Value value = calls.As<Napi::Object>().Get(key);
+            BatchColumn *col = &columns[idx];
+
+            if (value.IsTypedArray()) {
+                Napi::TypedArray array = value.As<Napi::TypedArray>();
+
+                if (RG_UNLIKELY(len >= 0 && len != (Size)array.ElementLength())) {
+                    ThrowError<Napi::Error>(env, "All batch columns must have the same length");
+                    return env.Null();
+                }
+                len = (Size)array.ElementLength();
+
+                col->ptr = (const uint8_t *)array.ArrayBuffer().Data() + array.ByteOffset();
+                col->type = array.TypedArrayType();
+            } else {
+                col->value = value;
+            }
+        }
+
+        if (RG_UNLIKELY(len < 0)) {
+            ThrowError<Napi::TypeError>(env, "At least one batch column must be a TypedArray");
+            return env.Null();
+        }
+    } else {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value for calls, expected array or object", GetValueType(instance, calls));
+        return env.Null();
+    }
+
+    uint8_t *raw = nullptr;
+
+    if (results.IsEmpty() || results.IsUndefined()) {
+        results = Napi::Array::New(env, (size_t)len);
+    } else if (results.IsTypedArray()) {
+        Napi::TypedArray array = results.As<Napi::TypedArray>();
+
+        if (RG_UNLIKELY(GetTypedArrayType(func->ret.type) != array.TypedArrayType())) {
+            ThrowError<Napi::TypeError>(env, "Cannot store %1 values in %2", func->ret.type->name, GetValueType(instance, array));
+            return env.Null();
+        }
+        if (RG_UNLIKELY((Size)array.ElementLength() < len)) {
+            ThrowError<Napi::Error>(env, "Expected results array of at least %1 elements, got %2", len, array.ElementLength());
+            return env.Null();
+        }
+
+        raw = (uint8_t *)array.ArrayBuffer().Data() + array.ByteOffset();
+    } else if (!results.IsArray()) {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value for results, expected array or TypedArray", GetValueType(instance, results));
+        return env.Null();
+    }
+
+    InstanceMemory *mem = instance->memories[0];
+
+    // Handles created in the scope are invalid once it is closed, so errors
+    // below return nullptr instead of env.Null() (same result for JS code).
+    napi_handle_scope scope = nullptr;
+    RG_DEFER {
+        if (scope) {
+            napi_close_handle_scope(env, scope);
+        }
+    };
+
+    for (Size i = 0; i < len; i++) {
+        // Release handles regularly, but not after each call because it is not free
+        if (!(i % 64)) {
+            if (scope) {
+                napi_close_handle_scope(env, scope);
+            }
+            napi_open_handle_scope(env, &scope);
+        }
+
+        napi_value call_args[MaxParameters];
+
+        if (columns.len) {
+            for (Size j = 0; j < columns.len; j++) {
+                call_args[j] = GetBatchValue(env, columns[j], i);
+            }
+        } else {
+            napi_value row;
+            napi_get_element(env, calls, (uint32_t)i, &row);
+
+            bool is_array = false;
+            uint32_t row_len = 0;
+
+            napi_is_array(env, row, &is_array);
+            if (RG_UNLIKELY(!is_array)) {
+                ThrowError<Napi::TypeError>(env, "Unexpected %1 value for call %2, expected array", GetValueType(instance, Napi::Value(env, row)), i);
+                return nullptr;
+            }
+            napi_get_array_length(env, row, &row_len);
+            if (RG_UNLIKELY(row_len < (uint32_t)arity)) {
+                ThrowError<Napi::TypeError>(env, "Expected %1 arguments for call %2, got %3", arity, i, row_len);
+                return nullptr;
+            }
+
+            for (Size j = 0; j < arity; j++) {
+                napi_get_element(env, row, (uint32_t)j, &call_args[j]);
+            }
+        }
+
+        // Each iteration reuses the same stack and heap, the CallData
+        // destructor rewinds them at the end of each call.
+        CallData call(env, instance, func, mem);
+
+        bool success = RunCall(env, instance, &call, func, call_args, [&]() {
+            if (raw) {
+                call.CompleteRaw(raw + i * func->ret.type->size);
+                return (napi_value)nullptr;
+            } else {
+                Napi::Value ret = call.Complete();
+                results.As<Napi::Array>().Set((uint32_t)i, ret);
+
+                return (napi_value)ret;
+            }
+        });
+        if (!success)
+            return nullptr;
+    }
+
+    return results;
+}
+
+static Napi::Function WrapFunction(Napi::Env env, const FunctionInfo *func, napi_callback call)
+{
+    napi_value value;
+    napi_status status = napi_create_function(env, func->name, NAPI_AUTO_LENGTH, call, (void *)func->Ref(), &value);
+    RG_ASSERT(status == napi_ok);
+
+    Napi::Function wrapper(env, value);
+    wrapper.AddFinalizer([](Napi::Env, FunctionInfo *func) { func->Unref(); }, (FunctionInfo *)func);
+
+    return wrapper;
+}
+
+#if NODE_WANT_INTERNALS
+
+// Keep this small, the number of instantiated call stubs grows exponentially
+static const Size MaxFastParameters = 3;
+
+struct FastFunction {
+    napi_env env;
+    InstanceData *instance;
+    const FunctionInfo *func;
+
+    v8::CTypeInfo types[MaxFastParameters + 2];
+    v8::CFunctionInfo info;
+    v8::CFunction cfunc;
+
+    FastFunction(napi_env env, InstanceData *instance, const FunctionInfo *func, const void *address,
+                 v8::CTypeInfo::Type ret, const v8::CTypeInfo::Type kinds[MaxFastParameters + 2])
+        : env(env), instance(instance), func(func->Ref()),
+          types { v8::CTypeInfo(kinds[0]), v8::CTypeInfo(kinds[1]), v8::CTypeInfo(kinds[2]),
+                  v8::CTypeInfo(kinds[3]), v8::CTypeInfo(kinds[4]) },
+          info(v8::CTypeInfo(ret), (unsigned int)func->parameters.len + 2, types),
+          cfunc(address, &info) {}
+    ~FastFunction() { func->Unref(); }
+};
+RG_STATIC_ASSERT(MaxFastParameters + 2 == 5);
+
+template <typename T> struct FastReturn { typedef T Type; };
+template <> struct FastReturn<int8_t> { typedef int32_t Type; };
+template <> struct FastReturn<uint8_t> { typedef uint32_t Type; };
+template <> struct FastReturn<int16_t> { typedef int32_t Type; };
+template <> struct FastReturn<uint16_t> { typedef uint32_t Type; };
+
+template <typename R, typename... Args>
+static typename FastReturn<R>::Type CallFast(v8::Local<v8::Object>, Args... args, v8::FastApiCallbackOptions &options)
+{
+    typedef typename FastReturn<R>::Type ReturnType;
+
+    const FastFunction *fast = (const FastFunction *)v8::External::Cast(&options.data)->Value();
 
-    if (instance->memories.len <= instance->resident_async_pools) {
-        instance->memories.Append(mem);
-        mem->temporary = false;
-    } else {
-        instance->temporaries++;
-        mem->temporary = true;
+    // Callbacks may run during the call, and need the slow path (as does tracing)
+    if (RG_UNLIKELY(fast->instance->NeedsGenericCalls())) {
+        options.fallback = true;
+        return ReturnType();
     }
 
-    return mem;
+    return (ReturnType)((R (*)(Args...))fast->func->func)(args...);
 }
 
-static Napi::Value TranslateNormalCall(const Napi::CallbackInfo &info)
+template <typename R, typename... Args>
+static const void *FindFastCall(const FunctionInfo *func, v8::CTypeInfo::Type *out_kinds)
 {
-    Napi::Env env = info.Env();
-    InstanceData *instance = env.GetInstanceData<InstanceData>();
-    FunctionInfo *func = (FunctionInfo *)info.Data();
+    Size idx = (Size)sizeof...(Args);
 
-    if (RG_UNLIKELY(info.Length() < (uint32_t)func->parameters.len)) {
-        ThrowError<Napi::TypeError>(env, "Expected %1 arguments, got %2", func->parameters.len, info.Length());
-        return env.Null();
+    if (idx == func->parameters.len)
+        return (const void *)&CallFast<R, Args...>;
+
+    if constexpr (sizeof...(Args) < MaxFastParameters) {
+        const ParameterInfo &param = func->parameters[idx];
+
+        switch (param.type->primitive) {
+            case PrimitiveKind::Int8:
+            case PrimitiveKind::Int16:
+            case PrimitiveKind::Int32: {
+                out_kinds[idx + 1] = v8::CTypeInfo::Type::kInt32;
+                return FindFastCall<R, Args..., int32_t>(func, out_kinds);
+            } break;
+            case PrimitiveKind::UInt8:
+            case PrimitiveKind::UInt16:
+            case PrimitiveKind::UInt32: {
+                out_kinds[idx + 1] = v8::CTypeInfo::Type::kUint32;
+                return FindFastCall<R, Args..., uint32_t>(func, out_kinds);
+            } break;
+            case PrimitiveKind::Float32: {
+                out_kinds[idx + 1] = v8::CTypeInfo::Type::kFloat32;
+                return FindFastCall<R, Args..., float>(func, out_kinds);
+            } break;
+            case PrimitiveKind::Float64: {
+                out_kinds[idx + 1] = v8::CTypeInfo::Type::kFloat64;
+                return FindFastCall<R, Args..., double>(func, out_kinds);
+            } break;
+
+            default: return nullptr;
+        }
     }
 
-    InstanceMemory *mem = instance->memories[0];
-    CallData call(env, instance, func, mem);
+    return nullptr;
+}
 
-    if (!RG_UNLIKELY(call.Prepare(info)))
-        return env.Null();
+static void TranslateFastFallback(const v8::FunctionCallbackInfo<v8::Value> &info)
+{
+    const FastFunction *fast = (const FastFunction *)info.Data().As<v8::External>()->Value();
 
-    if (instance->debug) {
-        call.DumpForward();
+    napi_value args[MaxFastParameters];
+    for (Size i = 0; i < RG_LEN(args); i++) {
+        args[i] = v8impl::JsValueFromV8LocalValue(info[(int)i]);
     }
-    call.Execute();
 
-    return call.Complete();
+    fast->env->CallIntoModule([&](napi_env env) {
+        Napi::Value ret = PerformNormalCall(env, fast->func, args, (Size)info.Length());
+        info.GetReturnValue().Set(v8impl::V8LocalValueFromJsValue(ret));
+    });
 }
 
-static Napi::Value TranslateVariadicCall(const Napi::CallbackInfo &info)
+// Returns an empty function if the signature cannot use the V8 fast API
+static Napi::Function WrapFastFunction(Napi::Env env, InstanceData *instance, const FunctionInfo *func)
 {
-    Napi::Env env = info.Env();
-    InstanceData *instance = env.GetInstanceData<InstanceData>();
+    if (func->variadic || func->convention != CallConvention::Cdecl)
+        return Napi::Function();
+    if (func->parameters.len > MaxFastParameters || func->hidden_parameters || instance->debug)
+        return Napi::Function();
 
-    FunctionInfo func;
-    memcpy((void *)&func, info.Data(), RG_SIZE(FunctionInfo));
-    func.lib = nullptr;
+    v8::CTypeInfo::Type kinds[MaxFastParameters + 2] = {};
+    v8::CTypeInfo::Type ret;
+    const void *address;
 
-    // This makes variadic calls non-reentrant
-    RG_DEFER_C(len = func.parameters.len) {
-        func.parameters.RemoveFrom(len);
-        func.parameters.Leak();
-    };
+    kinds[0] = v8::CTypeInfo::Type::kV8Value;
 
-    if (RG_UNLIKELY(info.Length() < (uint32_t)func.parameters.len)) {
-        ThrowError<Napi::TypeError>(env, "Expected %1 arguments or more, got %2", func.parameters.len, info.Length());
-        return env.Null();
-    }
-    if (RG_UNLIKELY((info.Length() - func.parameters.len) % 2)) {
-        ThrowError<Napi::Error>(env, "Missing value argument for variadic call");
-        return env.Null();
+    switch (func->ret.type->primitive) {
+        case PrimitiveKind::Void: { ret = v8::CTypeInfo::Type::kVoid; address = FindFastCall<void>(func, kinds); } break;
+        case PrimitiveKind::Bool: { ret = v8::CTypeInfo::Type::kBool; address = FindFastCall<bool>(func, kinds); } break;
+        case PrimitiveKind::Int8: { ret = v8::CTypeInfo::Type::kInt32; address = FindFastCall<int8_t>(func, kinds); } break;
+        case PrimitiveKind::UInt8: { ret = v8::CTypeInfo::Type::kUint32; address = FindFastCall<uint8_t>(func, kinds); } break;
+        case PrimitiveKind::Int16: { ret = v8::CTypeInfo::Type::kInt32; address = FindFastCall<int16_t>(func, kinds); } break;
+        case PrimitiveKind::UInt16: { ret = v8::CTypeInfo::Type::kUint32; address = FindFastCall<uint16_t>(func, kinds); } break;
+        case PrimitiveKind::Int32: { ret = v8::CTypeInfo::Type::kInt32; address = FindFastCall<int32_t>(func, kinds); } break;
+        case PrimitiveKind::UInt32: { ret = v8::CTypeInfo::Type::kUint32; address = FindFastCall<uint32_t>(func, kinds); } break;
+        case PrimitiveKind::Float32: { ret = v8::CTypeInfo::Type::kFloat32; address = FindFastCall<float>(func, kinds); } break;
+        case PrimitiveKind::Float64: { ret = v8::CTypeInfo::Type::kFloat64; address = FindFastCall<double>(func, kinds); } break;
+
+        default: return Napi::Function();
     }
+    if (!address)
+        return Napi::Function();
 
-    for (Size i = func.parameters.len; i < (Size)info.Length(); i += 2) {
-        ParameterInfo param = {};
+    kinds[func->parameters.len + 1] = v8::CTypeInfo::kCallbackOptionsType;
 
-        param.type = ResolveType(info[i], &param.directions);
-        if (RG_UNLIKELY(!param.type))
-            return env.Null();
-        if (RG_UNLIKELY(param.type->primitive == PrimitiveKind::Void ||
-                        param.type->primitive == PrimitiveKind::Array ||
-                        param.type->primitive == PrimitiveKind::Prototype)) {
-            ThrowError<Napi::TypeError>(env, "Type %1 cannot be used as a parameter (maybe try %1 *)", PrimitiveKindNames[(int)param.type->primitive]);
-            return env.Null();
-        }
+    napi_env env_napi = env;
+    v8::Isolate *isolate = env_napi->isolate;
+    v8::Local<v8::Context> context = env_napi->context();
 
-        if (RG_UNLIKELY(func.parameters.len >= MaxParameters)) {
-            ThrowError<Napi::TypeError>(env, "Functions cannot have more than %1 parameters", MaxParameters);
-            return env.Null();
-        }
-        if (RG_UNLIKELY((param.directions & 2) && ++func.out_parameters >= MaxOutParameters)) {
-            ThrowError<Napi::TypeError>(env, "Functions cannot have more than out %1 parameters", MaxOutParameters);
-            return env.Null();
-        }
+    FastFunction *fast = new FastFunction(env, instance, func, address, ret, kinds);
 
-        param.variadic = true;
-        param.offset = (int8_t)(i + 1);
+    v8::Local<v8::External> data = v8::External::New(isolate, fast);
+    v8::Local<v8::FunctionTemplate> tpl = v8::FunctionTemplate::New(isolate, TranslateFastFallback, data,
+                                                                    v8::Local<v8::Signature>(), (int)func->parameters.len,
+                                                                    v8::ConstructorBehavior::kThrow,
+                                                                    v8::SideEffectType::kHasSideEffect, &fast->cfunc);
+    v8::Local<v8::Function> fn = tpl->GetFunction(context).ToLocalChecked();
 
-        func.parameters.Append(param);
-    }
+    v8::NewStringType str_type = v8::NewStringType::kInternalized;
+    fn->SetName(v8::String::NewFromUtf8(isolate, func->name, str_type).ToLocalChecked());
 
-    if (RG_UNLIKELY(!AnalyseFunction(env, instance, &func)))
-        return env.Null();
+    Napi::Function wrapper(env, v8impl::JsValueFromV8LocalValue(fn));
+    wrapper.AddFinalizer([](Napi::Env, FastFunction *fast) { delete fast; }, fast);
 
-    InstanceMemory *mem = instance->memories[0];
-    CallData call(env, instance, &func, mem);
+    return wrapper;
+}
 
-    if (!RG_UNLIKELY(call.Prepare(info)))
-        return env.Null();
+#endif
 
-    if (instance->debug) {
-        call.DumpForward();
-    }
-    call.Execute();
+// Keep this small too, there are 4 return kinds and 3 parameter kinds
+static const Size MaxStubParameters = 4;
 
-    return call.Complete();
+static inline bool GetStubValue(napi_env env, InstanceData *, const ParameterInfo &, napi_value value, int32_t *out_value)
+{
+    return napi_get_value_int32(env, value, out_value) == napi_ok;
 }
 
-class AsyncCall: public Napi::AsyncWorker {
-    Napi::Env env;
-    const FunctionInfo *func;
+static inline bool GetStubValue(napi_env env, InstanceData *, const ParameterInfo &, napi_value value, double *out_value)
+{
+    return napi_get_value_double(env, value, out_value) == napi_ok;
+}
 
-    CallData call;
-    bool prepared = false;
+static inline bool GetStubValue(napi_env env, InstanceData *instance, const ParameterInfo &param, napi_value value, void **out_value)
+{
+    napi_valuetype type;
+    napi_typeof(env, value, &type);
 
-public:
-    AsyncCall(Napi::Env env, InstanceData *instance, const FunctionInfo *func,
-              InstanceMemory *mem, Napi::Function &callback)
-        : Napi::AsyncWorker(callback), env(env), func(func->Ref()),
-          call(env, instance, func, mem) {}
-    ~AsyncCall() { func->Unref(); }
+    switch (type) {
+        case napi_undefined:
+        case napi_null: {
+            *out_value = nullptr;
+            return true;
+        } break;
 
-    bool Prepare(const Napi::CallbackInfo &info) {
-        prepared = call.Prepare(info);
+        case napi_external: {
+            if (!CheckValueTag(instance, Napi::Value(env, value), param.type->ref.marker))
+                return false;
 
-        if (!prepared) {
-            Napi::Error err = env.GetAndClearPendingException();
-            SetError(err.Message());
-        }
+            napi_get_value_external(env, value, out_value);
+            return true;
+        } break;
 
-        return prepared;
+        default: return false;
     }
-    void DumpForward() { call.DumpForward(); }
-
-    void Execute() override;
-    void OnOK() override;
-};
+}
 
-void AsyncCall::Execute()
+// Integer results are truncated here, so that the upper bits of smaller types don't matter
+static inline napi_value NewStubValue(napi_env env, InstanceData *, const FunctionInfo *func, int32_t value)
 {
-    if (prepared) {
-        call.Execute();
+    napi_value ret;
+
+    switch (func->ret.type->primitive) {
+        case PrimitiveKind::Bool: { napi_get_boolean(env, (uint8_t)value, &ret); } break;
+        case PrimitiveKind::Int8: { napi_create_int32(env, (int8_t)value, &ret); } break;
+        case PrimitiveKind::UInt8: { napi_create_uint32(env, (uint8_t)value, &ret); } break;
+        case PrimitiveKind::Int16: { napi_create_int32(env, (int16_t)value, &ret); } break;
+        case PrimitiveKind::UInt16: { napi_create_uint32(env, (uint16_t)value, &ret); } break;
+        case PrimitiveKind::Int32: { napi_create_int32(env, value, &ret); } break;
+        case PrimitiveKind::UInt32: { napi_create_uint32(env, (uint32_t)value, &ret); } break;
+
+        default: { RG_UNREACHABLE(); } break;
     }
+
+    return ret;
 }
 
-void AsyncCall::OnOK()
+static inline napi_value NewStubValue(napi_env env, InstanceData *, const FunctionInfo *, double value)
 {
-    RG_ASSERT(prepared);
+    napi_value ret;
+    napi_create_double(env, value, &ret);
+    return ret;
+}
 
-    Napi::FunctionReference &callback = Callback();
+static inline napi_value NewStubValue(napi_env env, InstanceData *instance, const FunctionInfo *func, void *value)
+{
+    napi_value ret;
 
-    Napi::Value self = env.Null();
-    napi_value args[] = {
-        env.Null(),
-        call.Complete()
-    };
+    if (value) {
+        napi_create_external(env, value, nullptr, nullptr, &ret);
+        SetValueTag(instance, Napi::Value(env, ret), func->ret.type->ref.marker);
+    } else {
+        napi_get_null(env, &ret);
+    }
 
-    callback.Call(self, RG_LEN(args), args);
+    return ret;
 }
 
-static Napi::Value TranslateAsyncCall(const Napi::CallbackInfo &info)
+template <typename R, typename... Args, size_t... Indices>
+static napi_value RunCallStub(napi_env env, InstanceData *instance, const FunctionInfo *func,
+                              const napi_value *args, std::index_sequence<Indices...>)
 {
-    Napi::Env env = info.Env();
-    InstanceData *instance = env.GetInstanceData<InstanceData>();
-    FunctionInfo *func = (FunctionInfo *)info.Data();
+    std::tuple<Args...> values;
 
-    if (info.Length() <= (uint32_t)func->parameters.len) {
-        ThrowError<Napi::TypeError>(env, "Expected %1 arguments, got %2", func->parameters.len + 1, info.Length());
-        return env.Null();
-    }
+    bool valid = (GetStubValue(env, instance, func->parameters[Indices], args[Indices], &std::get<Indices>(values)) && ...);
+    if (RG_UNLIKELY(!valid))
+        return nullptr;
 
-    Napi::Function callback = info[(uint32_t)func->parameters.len].As<Napi::Function>();
+    if constexpr (std::is_void<R>::value) {
+        ((R (*)(Args...))func->func)(std::get<Indices>(values)...);
 
-    if (!callback.IsFunction()) {
-        ThrowError<Napi::TypeError>(env, "Expected callback function as last argument, got %1", GetValueType(instance, callback));
-        return env.Null();
+        napi_value ret;
+        napi_get_undefined(env, &ret);
+        return ret;
+    } else {
+        R ret = ((R (*)(Args...))func->func)(std::get<Indices>(values)...);
+        return NewStubValue(env, instance, func, ret);
     }
+}
 
-    InstanceMemory *mem = AllocateMemory(instance, instance->async_stack_size, instance->async_heap_size);
-    if (RG_UNLIKELY(!mem)) {
-        ThrowError<Napi::Error>(env, "Too many asynchronous calls are running");
-        return env.Null();
+// Calls the C function directly, and uses the generic path for anything unusual (other
+// JS value types, callbacks or tracing), see InstanceData::NeedsGenericCalls().
+template <typename R, typename... Args>
+static napi_value CallStub(napi_env env, napi_callback_info info)
+{
+    napi_value args[MaxStubParameters];
+    size_t argc = RG_LEN(args);
+    void *data;
+
+    napi_get_cb_info(env, info, &argc, args, nullptr, &data);
+
+    const FunctionInfo *func = (const FunctionInfo *)data;
+    InstanceData *instance = Napi::Env(env).GetInstanceData<InstanceData>();
+
+    if (RG_LIKELY(argc >= sizeof...(Args) && !instance->NeedsGenericCalls())) {
+        missed_relay = false;
+
+        napi_value ret = RunCallStub<R, Args...>(env, instance, func, args, std::index_sequence_for<Args...>());
+
+        if (RG_UNLIKELY(missed_relay)) {
+            ThrowError<Napi::Error>(env, "Cannot use non-registered callback beyond FFI call");
+            return nullptr;
+        }
+        if (RG_LIKELY(ret))
+            return ret;
     }
-    AsyncCall *async = new AsyncCall(env, instance, func, mem, callback);
 
-    if (async->Prepare(info) && instance->debug) {
-        async->DumpForward();
+    return PerformNormalCall(env, func, args, (Size)argc);
+}
+
+template <typename R, typename... Args>
+static napi_callback FindCallStub(const FunctionInfo *func)
+{
+    Size idx = (Size)sizeof...(Args);
+
+    if (idx == func->parameters.len)
+        return &CallStub<R, Args...>;
+
+    if constexpr (sizeof...(Args) < MaxStubParameters) {
+        const ParameterInfo &param = func->parameters[idx];
+
+        switch (param.type->primitive) {
+            case PrimitiveKind::Int8:
+            case PrimitiveKind::UInt8:
+            case PrimitiveKind::Int16:
+            case PrimitiveKind::UInt16:
+            case PrimitiveKind::Int32:
+            case PrimitiveKind::UInt32: return FindCallStub<R, Args..., int32_t>(func);
+            case PrimitiveKind::Float64: return FindCallStub<R, Args..., double>(func);
+            case PrimitiveKind::Pointer: return FindCallStub<R, Args..., void *>(func);
+
+            default: return nullptr;
+        }
     }
-    async->Queue();
 
-    return env.Undefined();
+    return nullptr;
+}
+
+// Returns nullptr if no call stub matches the signature
+static napi_callback SelectCallStub(InstanceData *instance, const FunctionInfo *func)
+{
+    if (func->variadic || func->convention != CallConvention::Cdecl)
+        return nullptr;
+    if (func->parameters.len > MaxStubParameters || func->hidden_parameters || instance->debug || instance->stats)
+        return nullptr;
+
+    switch (func->ret.type->primitive) {
+        case PrimitiveKind::Void: return FindCallStub<void>(func);
+        case PrimitiveKind::Bool:
+        case PrimitiveKind::Int8:
+        case PrimitiveKind::UInt8:
+        case PrimitiveKind::Int16:
+        case PrimitiveKind::UInt16:
+        case PrimitiveKind::Int32:
+        case PrimitiveKind::UInt32: return FindCallStub<int32_t>(func);
+        case PrimitiveKind::Float64: return FindCallStub<double>(func);
+        case PrimitiveKind::Pointer: return !func->ret.type->dispose ? FindCallStub<void *>(func) : nullptr;
+
+        default: return nullptr;
+    }
 }
 
 static Napi::Value FindLibraryFunction(const Napi::CallbackInfo &info, CallConvention convention)
@@ -1149,9 +2446,12 @@ static Napi::Value FindLibraryFunction(const Napi::CallbackInfo &info, CallConve
 
     if (!AnalyseFunction(env, instance, func))
         return env.Null();
-    if (func->variadic) {
-        // Minimize reallocations
-        func->parameters.Grow(32);
+
+    if (instance->stats) {
+        FunctionStats *stats = instance->function_stats.AppendDefault();
+
+        stats->name = DuplicateString(func->name, &instance->str_alloc).ptr;
+        func->stats = stats;
     }
 
 #ifdef _WIN32
@@ -1181,19 +2481,124 @@ static Napi::Value FindLibraryFunction(const Napi::CallbackInfo &info, CallConve
         return env.Null();
     }
 
-    Napi::Function::Callback call = func->variadic ? TranslateVariadicCall : TranslateNormalCall;
-    Napi::Function wrapper = Napi::Function::New(env, call, func->name, (void *)func->Ref());
-    wrapper.AddFinalizer([](Napi::Env, FunctionInfo *func) { func->Unref(); }, func);
+    napi_callback stub = SelectCallStub(instance, func);
+    napi_callback translate = stub ? stub : (func->variadic ? TranslateVariadicCall : TranslateNormalCall);
+
+#if NODE_WANT_INTERNALS
+    // Fast calls cannot be measured
+    Napi::Function wrapper = !instance->stats ? WrapFastFunction(env, instance, func) : Napi::Function();
+    if (wrapper.IsEmpty()) {
+        wrapper = WrapFunction(env, func, translate);
+    }
+#else
+    Napi::Function wrapper = WrapFunction(env, func, translate);
+#endif
 
     if (!func->variadic) {
-        Napi::Function async = Napi::Function::New(env, TranslateAsyncCall, func->name, (void *)func->Ref());
-        async.AddFinalizer([](Napi::Env, FunctionInfo *func) { func->Unref(); }, func);
+        Napi::Function async = WrapFunction(env, func, TranslateAsyncCall);
+        Napi::Function promise = WrapFunction(env, func, TranslatePromiseCall);
+        Napi::Function batch = WrapFunction(env, func, TranslateBatchCall);
+
         wrapper.Set("async", async);
+        wrapper.Set("promise", promise);
+        wrapper.Set("batch", batch);
+
+        if (func->ret.type->primitive == PrimitiveKind::Record) {
+            Napi::Function into = WrapFunction(env, func, TranslateIntoCall);
+            wrapper.Set("into", into);
+        }
     }
 
     return wrapper;
 }
 
+static Napi::Value GetStats(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    if (!instance->stats) {
+        ThrowError<Napi::Error>(env, "Statistics are not enabled, use koffi.config({ stats: true })");
+        return env.Null();
+    }
+
+    bool reset = (info.Length() >= 1 && info[0].ToBoolean());
+
+    Napi::Object obj = Napi::Object::New(env);
+    Napi::Array functions = Napi::Array::New(env, instance->function_stats.len);
+
+    for (Size i = 0; i < instance->function_stats.len; i++) {
+        FunctionStats &stats = instance->function_stats[i];
+        Napi::Object entry = Napi::Object::New(env);
+
+        entry.Set("name", stats.name);
+        entry.Set("calls", (double)stats.calls);
+        entry.Set("errors", (double)stats.errors);
+        entry.Set("prepare_time", (double)stats.prepare_time);
+        entry.Set("execute_time", (double)stats.execute_time);
+        entry.Set("complete_time", (double)stats.complete_time);
+
+        functions.Set((uint32_t)i, entry);
+
+        if (reset) {
+            stats.calls = 0;
+            stats.errors = 0;
+            stats.prepare_time = 0;
+            stats.execute_time = 0;
+            stats.complete_time = 0;
+        }
+    }
+
+    obj.Set("functions", functions);
+    obj.Set("heap_overflows", (double)instance->heap_overflows);
+    obj.Set("async_pool_misses", (double)instance->async_pool_misses);
+
+    if (reset) {
+        instance->heap_overflows = 0;
+        instance->async_pool_misses = 0;
+    }
+
+    return obj;
+}
+
+static Napi::Value StartStopTrace(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    if (info.Length() < 1) {
+        ThrowError<Napi::TypeError>(env, "Expected 1 argument, got %1", info.Length());
+        return env.Null();
+    }
+
+    if (IsNullOrUndefined(info[0])) {
+        // Flushes remaining records
+        delete instance->tracer;
+        instance->tracer = nullptr;
+
+        return env.Undefined();
+    }
+
+    if (!info[0].IsString()) {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value for filename, expected string", GetValueType(instance, info[0]));
+        return env.Null();
+    }
+    if (instance->tracer) {
+        ThrowError<Napi::Error>(env, "Tracing is already running, call koffi.trace(null) to stop it");
+        return env.Null();
+    }
+
+    std::string filename = info[0].As<Napi::String>();
+
+    instance->tracer = CallTracer::Open(filename.c_str());
+    if (!instance->tracer) {
+        ThrowError<Napi::Error>(env, "Failed to open trace file '%1'", filename.c_str());
+        return env.Null();
+    }
+
+    return env.Undefined();
+}
+
 static Napi::Value LoadSharedLibrary(const Napi::CallbackInfo &info)
 {
     Napi::Env env = info.Env();
@@ -1281,7 +2686,7 @@ static Napi::Value RegisterCallback(const Napi::CallbackInfo &info)
     InstanceData *instance = env.GetInstanceData<InstanceData>();
 
     if (info.Length() < 2) {
-        ThrowError<Napi::TypeError>(env, "Expected 2 arguments, got %1", info.Length());
+        ThrowError<Napi::TypeError>(env, "Expected 2 or 3 arguments, got %1", info.Length());
         return env.Null();
     }
     if (!info[0].IsFunction()) {
@@ -1299,23 +2704,118 @@ static Napi::Value RegisterCallback(const Napi::CallbackInfo &info)
         return env.Null();
     }
 
-    int idx = CountTrailingZeros(~instance->registered_trampolines);
+    const FunctionInfo *proto = type->ref.proto;
 
-    if (RG_UNLIKELY(idx >= MaxTrampolines)) {
-        ThrowError<Napi::Error>(env, "Too many registered callbacks are in use (max = %1)", MaxTrampolines);
-        return env.Null();
+    bool threaded = false;
+    bool blocking = false;
+    if (info.Length() >= 3 && !IsNullOrUndefined(info[2])) {
+        if (!info[2].IsString()) {
+            ThrowError<Napi::TypeError>(env, "Unexpected %1 value for mode, expected string", GetValueType(instance, info[2]));
+            return env.Null();
+        }
+
+        std::string mode = info[2].As<Napi::String>();
+
+        if (mode == "blocking") {
+            blocking = true;
+        } else if (mode != "nonblocking") {
+            ThrowError<Napi::Error>(env, "Unknown callback mode '%1', expected 'blocking' or 'nonblocking'", mode.c_str());
+            return env.Null();
+        }
+
+        // Strings are converted in the call memory, which gets reused as soon as the JS callback returns
+        if (blocking && (proto->ret.type->primitive == PrimitiveKind::String ||
+                         proto->ret.type->primitive == PrimitiveKind::String16)) {
+            ThrowError<Napi::TypeError>(env, "Thread-safe callbacks cannot return strings");
+            return env.Null();
+        }
+        if (!blocking && proto->ret.type->primitive != PrimitiveKind::Void) {
+            ThrowError<Napi::TypeError>(env, "Non-blocking callbacks must return void");
+            return env.Null();
+        }
+        if (!blocking && proto->convention == CallConvention::Stdcall) {
+            ThrowError<Napi::TypeError>(env, "Non-blocking callbacks cannot use __stdcall");
+            return env.Null();
+        }
+
+        // Only argument registers and stack slots are copied, the memory they point to may be gone by the time the JS function runs
+        if (!blocking) {
+            for (const ParameterInfo &param: proto->parameters) {
+                bool scalar = (param.type->primitive != PrimitiveKind::String &&
+                               param.type->primitive != PrimitiveKind::String16 &&
+                               param.type->primitive != PrimitiveKind::Record &&
+                               (param.type->primitive != PrimitiveKind::Pointer ||
+                                param.type->ref.type->primitive == PrimitiveKind::Void));
+
+                if (!scalar) {
+                    ThrowError<Napi::TypeError>(env, "Non-blocking callbacks cannot take %1 parameters, use void * or a blocking callback", param.type->name);
+                    return env.Null();
+                }
+            }
+        }
+
+        threaded = true;
+    }
+
+    // Use a runtime-generated trampoline if possible, or one of the few static ones
+    Size idx = AllocateDynamicTrampoline();
+    bool dynamic = (idx >= 0);
+
+    if (!dynamic) {
+        uint32_t used = instance->registered_trampolines;
+        if (threaded) {
+            used |= ThreadedCallback::GetTrampolines();
+        }
+
+        int i = CountTrailingZeros(~used);
+
+        if (RG_UNLIKELY(i >= MaxTrampolines)) {
+            ThrowError<Napi::Error>(env, "Too many registered callbacks are in use (max = %1)", MaxTrampolines);
+            return env.Null();
+        }
+
+        idx = i + MaxTrampolines;
+    }
+
+    ThreadedCallback *cb = nullptr;
+    if (threaded) {
+        // Thread-safe callbacks run outside of any call, using the synchronous memory
+        if (!instance->memories.len) {
+            AllocateMemory(instance, instance->sync_stack_size, instance->sync_heap_size);
+            RG_ASSERT(instance->memories.len);
+        }
+
+        cb = ThreadedCallback::Create(env, instance, idx, proto, blocking);
+
+        if (RG_UNLIKELY(!cb)) {
+            if (dynamic) {
+                ReleaseDynamicTrampoline(idx);
+            }
+            return env.Null();
+        }
     }
 
-    instance->registered_trampolines |= 1u << idx;
-    idx += MaxTrampolines;
+    TrampolineInfo *trampoline;
+    if (dynamic) {
+        Size slot = idx - MaxTrampolines * 2;
 
-    TrampolineInfo *trampoline = &instance->trampolines[idx];
+        while (instance->dynamic_trampolines.len <= slot) {
+            instance->dynamic_trampolines.AppendDefault();
+        }
+
+        trampoline = &instance->dynamic_trampolines[slot];
+        instance->dynamic_callbacks++;
+    } else {
+        trampoline = &instance->trampolines[idx];
+        instance->registered_trampolines |= 1u << (idx - MaxTrampolines);
+    }
 
-    trampoline->proto = type->ref.proto;
+    trampoline->proto = proto;
     trampoline->func.Reset(func, 1);
     trampoline->generation = -1;
+    trampoline->threaded = cb;
 
-    void *ptr = GetTrampoline(idx, type->ref.proto);
+    void *ptr = GetTrampoline(idx, proto);
 
     Napi::External<void> external = Napi::External<void>::New(env, ptr);
     SetValueTag(instance, external, type->ref.marker);
@@ -1340,15 +2840,41 @@ static Napi::Value UnregisterCallback(const Napi::CallbackInfo &info)
     Napi::External<void> external = info[0].As<Napi::External<void>>();
     void *ptr = external.Data();
 
+    // Runtime-generated trampoline?
+    {
+        Size idx = FindDynamicTrampoline(ptr);
+        TrampolineInfo *trampoline = (idx >= 0) ? instance->GetTrampolineInfo(idx) : nullptr;
+
+        if (trampoline) {
+            if (trampoline->threaded) {
+                trampoline->threaded->Close(false);
+                trampoline->threaded = nullptr;
+            }
+
+            trampoline->proto = nullptr;
+            trampoline->func.Reset();
+
+            ReleaseDynamicTrampoline(idx);
+            instance->dynamic_callbacks--;
+
+            return env.Undefined();
+        }
+    }
+
     for (Size i = 0; i < MaxTrampolines; i++) {
         Size idx = i + MaxTrampolines;
 
         if (!(instance->registered_trampolines & (1u << i)))
             continue;
 
-        const TrampolineInfo &trampoline = instance->trampolines[idx];
+        TrampolineInfo *trampoline = &instance->trampolines[idx];
+
+        if (GetTrampoline(idx, trampoline->proto) == ptr) {
+            if (trampoline->threaded) {
+                trampoline->threaded->Close(false);
+                trampoline->threaded = nullptr;
+            }
 
-        if (GetTrampoline(idx, trampoline.proto) == ptr) {
             instance->registered_trampolines &= ~(1u << i);
             return env.Undefined();
         }
@@ -1455,6 +2981,7 @@ static Napi::Object InitBaseTypes(Napi::Env env)
     RegisterPrimitiveType(env, types, {"uint64_t", "uint64"}, PrimitiveKind::UInt64, 8, alignof(int64_t));
     RegisterPrimitiveType(env, types, {"intptr_t", "intptr"}, GetIntegerPrimitive(RG_SIZE(intptr_t), true), RG_SIZE(intptr_t), alignof(intptr_t));
     RegisterPrimitiveType(env, types, {"uintptr_t", "uintptr"}, GetIntegerPrimitive(RG_SIZE(intptr_t), false), RG_SIZE(intptr_t), alignof(intptr_t));
+    RegisterPrimitiveType(env, types, {"size_t"}, GetIntegerPrimitive(RG_SIZE(size_t), false), RG_SIZE(size_t), alignof(size_t));
     RegisterPrimitiveType(env, types, {"long"}, GetIntegerPrimitive(RG_SIZE(long), true), RG_SIZE(long), alignof(long));
     RegisterPrimitiveType(env, types, {"unsigned long", "ulong"}, GetIntegerPrimitive(RG_SIZE(long), false), RG_SIZE(long), alignof(long));
     RegisterPrimitiveType(env, types, {"long long", "longlong"}, PrimitiveKind::Int64, RG_SIZE(int64_t), alignof(int64_t));
@@ -1464,6 +2991,21 @@ static Napi::Object InitBaseTypes(Napi::Env env)
     RegisterPrimitiveType(env, types, {"char *", "str", "string"}, PrimitiveKind::String, RG_SIZE(void *), alignof(void *), "char");
     RegisterPrimitiveType(env, types, {"char16_t *", "char16 *", "str16", "string16"}, PrimitiveKind::String16, RG_SIZE(void *), alignof(void *), "char16_t");
 
+    // Byte span with a size_t length, use koffi.span() for other spans
+    {
+        InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+        const TypeInfo *ref = instance->types_map.FindValue("void", nullptr);
+        const TypeInfo *length = instance->types_map.FindValue("size_t", nullptr);
+        const TypeInfo *type = MakeSpanType(instance, ref, length);
+
+        Napi::External<TypeInfo> external = Napi::External<TypeInfo>::New(env, (TypeInfo *)type);
+        SetValueTag(instance, external, &TypeInfoMarker);
+
+        instance->types_map.Set("span", type);
+        types.Set("span", external);
+    }
+
     types.Freeze();
 
     return types;
@@ -1471,6 +3013,10 @@ static Napi::Object InitBaseTypes(Napi::Env env)
 
 FunctionInfo::~FunctionInfo()
 {
+    for (const FunctionInfo *variant: variants) {
+        variant->Unref();
+    }
+
     if (lib) {
         lib->Unref();
     }
@@ -1510,6 +3056,32 @@ InstanceMemory::~InstanceMemory()
 
 InstanceData::~InstanceData()
 {
+    // Release native threads blocked in thread-safe callbacks first, asynchronous
+    // calls may be waiting for them.
+    for (Size i = 0; i < MaxTrampolines; i++) {
+        const TrampolineInfo &trampoline = trampolines[i + MaxTrampolines];
+
+        if ((registered_trampolines & (1u << i)) && trampoline.threaded) {
+            trampoline.threaded->Close(true);
+        }
+    }
+    for (Size i = 0; i < dynamic_trampolines.len; i++) {
+        TrampolineInfo *trampoline = &dynamic_trampolines[i];
+
+        if (!trampoline->proto)
+            continue;
+
+        if (trampoline->threaded) {
+            trampoline->threaded->Close(true);
+        }
+        ReleaseDynamicTrampoline(i + MaxTrampolines * 2);
+    }
+
+    // Wait for running asynchronous calls, they use the memories below
+    delete async_engine;
+
+    delete tracer;
+
     for (InstanceMemory *mem: memories) {
         delete mem;
     }
@@ -1519,12 +3091,16 @@ template <typename Func>
 static void SetExports(Napi::Env env, Func func)
 {
     func("config", Napi::Function::New(env, GetSetConfig));
+    func("stats", Napi::Function::New(env, GetStats));
+    func("trace", Napi::Function::New(env, StartStopTrace));
 
     func("struct", Napi::Function::New(env, CreatePaddedStructType));
     func("pack", Napi::Function::New(env, CreatePackedStructType));
     func("handle", Napi::Function::New(env, CreateHandleType));
     func("pointer", Napi::Function::New(env, CreatePointerType));
     func("array", Napi::Function::New(env, CreateArrayType));
+    func("span", Napi::Function::New(env, CreateSpanType));
+    func("records", Napi::Function::New(env, CreateRecordArray));
     func("callback", Napi::Function::New(env, CreateCallbackType));
     func("alias", Napi::Function::New(env, CreateTypeAlias));
 
@@ -1533,13 +3109,19 @@ static void SetExports(Napi::Env env, Func func)
     func("resolve", Napi::Function::New(env, GetResolvedType));
     func("introspect", Napi::Function::New(env, GetTypeDefinition));
 
+    func("decode", Napi::Function::New(env, DecodeValue));
+    func("encode", Napi::Function::New(env, EncodeValue));
+    func("view", Napi::Function::New(env, CreateView));
+
     func("load", Napi::Function::New(env, LoadSharedLibrary));
 
     func("in", Napi::Function::New(env, MarkIn));
     func("out", Napi::Function::New(env, MarkOut));
     func("inout", Napi::Function::New(env, MarkInOut));
+    func("pinned", Napi::Function::New(env, MarkPinned));
 
     func("disposable", Napi::Function::New(env, CreateDisposableType));
+    func("lazy", Napi::Function::New(env, CreateLazyType));
     func("free", Napi::Function::New(env, CallFree));
 
     func("register", Napi::Function::New(env, RegisterCallback));
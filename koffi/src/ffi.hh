@@ -16,6 +16,11 @@
 #include "vendor/libcc/libcc.hh"
 
 #include <napi.h>
+#include <atomic>
+#include <chrono>
+#if NODE_WANT_INTERNALS
+    #include <v8.h>
+#endif
 
 namespace RG {
 
@@ -25,11 +30,16 @@ static const Size DefaultAsyncStackSize = Kibibytes(256);
 static const Size DefaultAsyncHeapSize = Kibibytes(512);
 static const int DefaultResidentAsyncPools = 2;
 static const int DefaultMaxAsyncCalls = 64;
+static const int DefaultAsyncThreads = 4;
 
 static const int MaxAsyncCalls = 256;
+static const int MaxAsyncThreads = 64;
 static const Size MaxParameters = 32;
 static const Size MaxOutParameters = 4;
+static const Size MaxExpandedArguments = MaxParameters * 3; // See ExpandSpans()
 static const Size MaxTrampolines = 16;
+static const Size MaxDynamicTrampolines = 16384;
+static const Size MaxVariadicVariants = 64;
 
 extern const int TypeInfoMarker;
 
@@ -52,7 +62,8 @@ enum class PrimitiveKind {
     Float32,
     Float64,
     Prototype,
-    Callback
+    Callback,
+    Span
 };
 static const char *const PrimitiveKindNames[] = {
     "Void",
@@ -73,7 +84,8 @@ static const char *const PrimitiveKindNames[] = {
     "Float32",
     "Float64",
     "Prototype",
-    "Callback"
+    "Callback",
+    "Span"
 };
 
 struct TypeInfo;
@@ -99,15 +111,21 @@ struct TypeInfo {
     Napi::FunctionReference dispose_ref;
 
     HeapArray<RecordMember> members; // Record only
+    bool lazy; // Record only, see koffi.lazy()
     union {
         const void *marker;
-        const TypeInfo *type; // Pointer or array
+        const TypeInfo *type; // Pointer, array or span
         const FunctionInfo *proto; // Callback only
     } ref;
     ArrayHint hint; // Array only
+    const TypeInfo *length; // Span only
 
     mutable Napi::ObjectReference defn;
 
+    // Record only, generated on first use by records.cc
+    mutable Napi::FunctionReference view_class;
+    mutable Napi::FunctionReference array_class;
+
     RG_HASHTABLE_HANDLER(TypeInfo, name);
 };
 
@@ -115,6 +133,11 @@ struct RecordMember {
     const char *name;
     const TypeInfo *type;
     int16_t offset;
+
+#if NODE_WANT_INTERNALS
+    // Internalized once, so that PushObject/DecodeObject don't create a new string for each access
+    v8::Eternal<v8::String> key;
+#endif
 };
 
 struct LibraryHolder {
@@ -143,10 +166,15 @@ static const char *const CallConventionNames[] = {
 
 struct ParameterInfo {
     const TypeInfo *type;
+    const char *name; // Only known for C-like prototypes
     int directions;
     bool variadic;
     int8_t offset;
 
+    // Span parameters are split into pointer and length parameters, see AppendSpanParameters()
+    const TypeInfo *span;
+    bool span_length;
+
     // ABI-specific part
 
 #if defined(_M_X64)
@@ -171,6 +199,51 @@ struct ParameterInfo {
 #endif
 };
 
+#if defined(__x86_64__) && !defined(_WIN32)
+
+enum class ForwardOp: int8_t {
+    Bool,
+    Integer,
+    UInt64,
+    String,
+    String16,
+    Pointer,
+    Callback,
+    RecordRegisters,
+    RecordMemory,
+    Float32,
+    Float64
+};
+
+// Precompiled by AnalyseFunction, offsets are relative to the bottom of the forward
+// stack area, which starts with the 6 GPR slots, followed by the 8 XMM slots and the stack arguments.
+struct ForwardStep {
+    ForwardOp op;
+    int8_t param;
+    int32_t offset;
+    int32_t offset2; // Second eightbyte of records passed in registers, or -1
+};
+
+#endif
+
+// Collected when koffi.config({ stats: true }) is used, times are in nanoseconds
+struct FunctionStats {
+    const char *name;
+
+    std::atomic<int64_t> calls {0};
+    std::atomic<int64_t> errors {0};
+
+    std::atomic<int64_t> prepare_time {0};
+    std::atomic<int64_t> execute_time {0};
+    std::atomic<int64_t> complete_time {0};
+};
+
+static inline int64_t GetStatsTime()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
 // Also used for callbacks, even though many members are not used in this case
 struct FunctionInfo {
     mutable std::atomic_int refcount {1};
@@ -185,16 +258,31 @@ struct FunctionInfo {
     ParameterInfo ret;
     HeapArray<ParameterInfo> parameters;
     int8_t out_parameters;
+    int8_t hidden_parameters; // Span lengths, not given by JS code
     bool variadic;
 
+    // Variadic only, analysed once for each set of variadic argument types
+    mutable HeapArray<const FunctionInfo *> variants;
+
+    FunctionStats *stats = nullptr; // Shared by variadic variants
+
+    // Assigned by the call tracer, once per tracing session
+    mutable int trace_session = 0;
+    mutable uint32_t trace_id;
+
     // ABI-specific part
 
     Size args_size;
+    Size stack_size; // Arguments passed on the caller stack, upper bound on some ABIs
 #if defined(__i386__) || defined(_M_IX86)
     bool fast;
 #else
     bool forward_fp;
 #endif
+#if defined(__x86_64__) && !defined(_WIN32)
+    LocalArray<ForwardStep, MaxParameters> steps;
+    const void *forward_thunk; // Generated at runtime when the jit setting is enabled
+#endif
 
     ~FunctionInfo();
 
@@ -214,13 +302,19 @@ struct InstanceMemory {
     bool temporary;
 };
 
+class ThreadedCallback;
+
 struct TrampolineInfo {
-    const FunctionInfo *proto;
+    const FunctionInfo *proto = nullptr;
     Napi::FunctionReference func;
 
-    int32_t generation;
+    int32_t generation = -1;
+    ThreadedCallback *threaded = nullptr; // Registered callbacks only
 };
 
+class AsyncEngine;
+class CallTracer;
+
 struct InstanceData {
     ~InstanceData();
 
@@ -233,12 +327,18 @@ struct InstanceData {
 
     LocalArray<InstanceMemory *, 9> memories;
     int temporaries = 0;
+    bool relaying = false; // Decoding callback arguments on the Koffi stack, see DecodeRelayedObject()
 
     TrampolineInfo trampolines[MaxTrampolines * 2];
     int16_t next_trampoline = 0;
     int16_t temp_trampolines = 0;
     uint32_t registered_trampolines = 0;
 
+    // Registered callbacks with runtime-generated trampolines, indexed from MaxTrampolines * 2.
+    // Unused entries have a null proto.
+    BucketArray<TrampolineInfo> dynamic_trampolines;
+    Size dynamic_callbacks = 0;
+
     BlockAllocator str_alloc;
 
     Size sync_stack_size = DefaultSyncStackSize;
@@ -247,10 +347,42 @@ struct InstanceData {
     Size async_heap_size = DefaultAsyncHeapSize;
     int resident_async_pools = DefaultResidentAsyncPools;
     int max_temporaries = DefaultMaxAsyncCalls - DefaultResidentAsyncPools;
+    int async_threads = DefaultAsyncThreads;
+
+    AsyncEngine *async_engine = nullptr;
+
+    bool jit = false; // Forward thunks have no unwind information yet
+    bool stats = false;
+    BucketArray<FunctionStats> function_stats;
+    std::atomic<int64_t> heap_overflows {0};
+    std::atomic<int64_t> async_pool_misses {0};
+
+    CallTracer *tracer = nullptr;
+
+    // Trampolines that run during a call need the CallData of a generic call (as does tracing),
+    // so fast calls and call stubs must fall back to the generic path when this is true.
+    bool NeedsGenericCalls() const
+    {
+        return temp_trampolines || registered_trampolines || dynamic_callbacks || tracer;
+    }
+
+    // Returns nullptr for dynamic trampolines that are not registered in this instance
+    TrampolineInfo *GetTrampolineInfo(Size idx)
+    {
+        if (idx < MaxTrampolines * 2)
+            return &trampolines[idx];
+
+        idx -= MaxTrampolines * 2;
+        if (idx >= dynamic_trampolines.len || !dynamic_trampolines[idx].proto)
+            return nullptr;
+
+        return &dynamic_trampolines[idx];
+    }
 };
 RG_STATIC_ASSERT(DefaultResidentAsyncPools <= RG_LEN(InstanceData::memories.data) - 1);
 RG_STATIC_ASSERT(DefaultMaxAsyncCalls >= DefaultResidentAsyncPools);
 RG_STATIC_ASSERT(MaxAsyncCalls >= DefaultMaxAsyncCalls);
+RG_STATIC_ASSERT(MaxAsyncThreads < RG_ASYNC_MAX_THREADS);
 RG_STATIC_ASSERT(MaxTrampolines <= 16);
 
 }
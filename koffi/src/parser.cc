@@ -32,6 +32,10 @@ bool PrototypeParser::Parse(const char *str, FunctionInfo *out_func)
         MarkError("You are not allowed to directly return C arrays");
         return false;
     }
+    if (out_func->ret.type->primitive == PrimitiveKind::Span) {
+        MarkError("Spans cannot be returned, use an output span parameter instead");
+        return false;
+    }
     if (Match("__cdecl")) {
         out_func->convention = CallConvention::Cdecl;
     } else if (Match("__stdcall")) {
@@ -60,6 +64,8 @@ bool PrototypeParser::Parse(const char *str, FunctionInfo *out_func)
                 param.directions = 2;
             } else if (Match("_Inout_")) {
                 param.directions = 3;
+            } else if (Match("_Pinned_")) {
+                param.directions = 4;
             } else {
                 param.directions = 1;
             }
@@ -72,14 +78,23 @@ bool PrototypeParser::Parse(const char *str, FunctionInfo *out_func)
                 return false;
             }
 
-            if ((param.directions & 2) && param.type->primitive != PrimitiveKind::Pointer) {
-                MarkError("Only pointers can be used for output parameters");
+            bool span = (param.type->primitive == PrimitiveKind::Span);
+
+            if ((param.directions & 2) && param.type->primitive != PrimitiveKind::Pointer && !span) {
+                MarkError("Only pointers and spans can be used for output parameters");
+                return false;
+            }
+            if ((param.directions & 4) && param.type->primitive != PrimitiveKind::Pointer) {
+                MarkError("Only pointers can be pinned");
                 return false;
             }
 
-            offset += (offset < tokens.len && IsIdentifier(tokens[offset]));
+            if (offset < tokens.len && IsIdentifier(tokens[offset])) {
+                param.name = DuplicateString(tokens[offset], &instance->str_alloc).ptr;
+                offset++;
+            }
 
-            if (out_func->parameters.len >= MaxParameters) {
+            if (out_func->parameters.len + span >= MaxParameters) {
                 MarkError("Functions cannot have more than %1 parameters", MaxParameters);
                 return false;
             }
@@ -88,9 +103,13 @@ bool PrototypeParser::Parse(const char *str, FunctionInfo *out_func)
                 return false;
             }
 
-            param.offset = (int8_t)out_func->parameters.len;
+            param.offset = (int8_t)(out_func->parameters.len - out_func->hidden_parameters);
 
-            out_func->parameters.Append(param);
+            if (span) {
+                AppendSpanParameters(instance, param, out_func);
+            } else {
+                out_func->parameters.Append(param);
+            }
 
             if (offset >= tokens.len || tokens[offset] != ",")
                 break;
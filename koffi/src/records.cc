@@ -0,0 +1,342 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+#include "vendor/libcc/libcc.hh"
+#include "ffi.hh"
+#include "call.hh"
+#include "records.hh"
+#include "util.hh"
+
+#include <napi.h>
+
+namespace RG {
+
+// Record views access C memory through a DataView, numeric members use the DataView
+// methods directly (which V8 can inline) and the other ones go through Decode/Encode.
+// Views don't copy anything, they share the memory of the DataView.
+
+static bool GetViewMemory(Napi::Env env, Napi::Value value, const TypeInfo *type, Size offset, uint8_t **out_ptr)
+{
+    void *ptr;
+    size_t len;
+
+    if (RG_UNLIKELY(napi_get_dataview_info(env, value, &len, &ptr, nullptr, nullptr) != napi_ok)) {
+        ThrowError<Napi::TypeError>(env, "Invalid record view");
+        return false;
+    }
+    if (RG_UNLIKELY(offset < 0 || offset > (Size)len - type->size)) {
+        ThrowError<Napi::Error>(env, "Record view is out of bounds");
+        return false;
+    }
+
+    *out_ptr = (uint8_t *)ptr + offset;
+    return true;
+}
+
+// Called by generated code as read(view, offset, idx), with idx < 0 for the whole record
+static Napi::Value ReadRecord(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    const TypeInfo *type = (const TypeInfo *)info.Data();
+
+    Size offset = (Size)info[1].As<Napi::Number>().Int64Value();
+    int idx = info[2].As<Napi::Number>().Int32Value();
+
+    if (idx >= 0) {
+        const RecordMember &member = type->members[idx];
+
+        offset += member.offset;
+        type = member.type;
+    }
+
+    uint8_t *ptr;
+    if (RG_UNLIKELY(!GetViewMemory(env, info[0], type, offset, &ptr)))
+        return env.Null();
+
+    // Always return a plain object for whole records, even for lazy types
+    if (idx < 0) {
+        Napi::Object obj = Napi::Object::New(env);
+        DecodeObject(obj, ptr, type);
+        return obj;
+    }
+
+    return Decode(env, ptr, type);
+}
+
+// Called by generated code as write(view, offset, idx, value), with idx < 0 for the whole record
+static Napi::Value WriteRecord(const Napi::CallbackInfo &info)
+{
+    Napi::Env env = info.Env();
+    const TypeInfo *type = (const TypeInfo *)info.Data();
+
+    Size offset = (Size)info[1].As<Napi::Number>().Int64Value();
+    int idx = info[2].As<Napi::Number>().Int32Value();
+
+    if (idx >= 0) {
+        const RecordMember &member = type->members[idx];
+
+        offset += member.offset;
+        type = member.type;
+    }
+
+    uint8_t *ptr;
+    if (RG_UNLIKELY(!GetViewMemory(env, info[0], type, offset, &ptr)))
+        return env.Null();
+
+    Encode(env, ptr, info[3], type);
+    return env.Undefined();
+}
+
+static const char *GetDataViewSuffix(const TypeInfo *type)
+{
+    switch (type->primitive) {
+        case PrimitiveKind::Int8: return "Int8";
+        case PrimitiveKind::UInt8: return "Uint8";
+        case PrimitiveKind::Int16: return "Int16";
+        case PrimitiveKind::UInt16: return "Uint16";
+        case PrimitiveKind::Int32: return "Int32";
+        case PrimitiveKind::UInt32: return "Uint32";
+        case PrimitiveKind::Float32: return "Float32";
+        case PrimitiveKind::Float64: return "Float64";
+
+        default: return nullptr;
+    }
+}
+
+static void GenerateAccessors(const TypeInfo *type, HeapArray<char> *out_code)
+{
+    for (Size i = 0; i < type->members.len; i++) {
+        const RecordMember &member = type->members[i];
+        const char *suffix = GetDataViewSuffix(member.type);
+
+        if (suffix) {
+            Fmt(out_code, "get [names[%1]]() { return this.#view.get%2(this.#offset + %3, true); }\n", i, suffix, member.offset);
+            Fmt(out_code, "set [names[%1]](v) { this.#view.set%2(this.#offset + %3, v, true); }\n", i, suffix, member.offset);
+            continue;
+        }
+
+        switch (member.type->primitive) {
+            case PrimitiveKind::Bool: {
+                RG_ASSERT(member.type->size == 1);
+
+                Fmt(out_code, "get [names[%1]]() { return this.#view.getUint8(this.#offset + %2) != 0; }\n", i, member.offset);
+                Fmt(out_code, "set [names[%1]](v) { this.#view.setUint8(this.#offset + %2, v ? 1 : 0); }\n", i, member.offset);
+            } break;
+
+            case PrimitiveKind::Int64:
+            case PrimitiveKind::UInt64: {
+                const char *kind = (member.type->primitive == PrimitiveKind::Int64) ? "BigInt64" : "BigUint64";
+
+                // Same rules as NewBigInt(): use a Number if the value is safe
+                Fmt(out_code, "get [names[%1]]() { let v = this.#view.get%2(this.#offset + %3, true); "
+                              "return (v >= -9007199254740992n && v <= 9007199254740992n) ? Number(v) : v; }\n", i, kind, member.offset);
+                Fmt(out_code, "set [names[%1]](v) { this.#view.set%2(this.#offset + %3, "
+                              "typeof v == 'bigint' ? v : BigInt(Math.trunc(v)), true); }\n", i, kind, member.offset);
+            } break;
+
+            case PrimitiveKind::Record: {
+                Fmt(out_code, "get [names[%1]]() { return new nested[%1](this.#view, this.#offset + %2); }\n", i, member.offset);
+                Fmt(out_code, "set [names[%1]](v) { write(this.#view, this.#offset, %1, v); }\n", i);
+            } break;
+
+            default: {
+                Fmt(out_code, "get [names[%1]]() { return read(this.#view, this.#offset, %1); }\n", i);
+                Fmt(out_code, "set [names[%1]](v) { write(this.#view, this.#offset, %1, v); }\n", i);
+            } break;
+        }
+    }
+}
+
+static bool GenerateClasses(Napi::Env env, const TypeInfo *type)
+{
+    RG_ASSERT(type->primitive == PrimitiveKind::Record);
+
+    Napi::Array names = Napi::Array::New(env, type->members.len);
+    Napi::Array nested = Napi::Array::New(env, type->members.len);
+
+    for (Size i = 0; i < type->members.len; i++) {
+        const RecordMember &member = type->members[i];
+
+        names.Set((uint32_t)i, NewString(env, member.name));
+
+        if (member.type->primitive == PrimitiveKind::Record) {
+            Napi::Function cls = GetRecordView(env, member.type);
+            if (cls.IsEmpty())
+                return false;
+
+            nested.Set((uint32_t)i, cls);
+        }
+    }
+
+    HeapArray<char> code;
+
+    Fmt(&code, "(function (name, names, nested, read, write) {\n'use strict';\n");
+
+    Fmt(&code, "class View {\n#view; #offset;\n");
+    Fmt(&code, "constructor(view, offset) { this.#view = view; this.#offset = offset; }\n");
+    GenerateAccessors(type, &code);
+    Fmt(&code, "toJSON() { return read(this.#view, this.#offset, -1); }\n");
+    Fmt(&code, "[Symbol.for('nodejs.util.inspect.custom')]() { return this.toJSON(); }\n");
+    Fmt(&code, "}\n");
+
+    Fmt(&code, "class Records {\n#view; #offset; #length;\n");
+    Fmt(&code, "constructor(buffer, offset, length) { this.#view = new DataView(buffer); this.#offset = offset; this.#length = length; }\n");
+    Fmt(&code, "get buffer() { return this.#view.buffer; }\n");
+    Fmt(&code, "get byteOffset() { return this.#offset; }\n");
+    Fmt(&code, "get byteLength() { return this.#length * %1; }\n", type->size);
+    Fmt(&code, "get length() { return this.#length; }\n");
+    Fmt(&code, "#check(idx) { if (!Number.isInteger(idx) || idx < 0 || idx >= this.#length) throw new RangeError(`Index ${idx} is out of range`); }\n");
+    Fmt(&code, "at(idx) { this.#check(idx); return new View(this.#view, this.#offset + idx * %1); }\n", type->size);
+    Fmt(&code, "get(idx) { this.#check(idx); return read(this.#view, this.#offset + idx * %1, -1); }\n", type->size);
+    Fmt(&code, "set(idx, value) { this.#check(idx); write(this.#view, this.#offset + idx * %1, -1, value); }\n", type->size);
+    Fmt(&code, "*[Symbol.iterator]() { for (let i = 0; i < this.#length; i++) yield new View(this.#view, this.#offset + i * %1); }\n", type->size);
+    Fmt(&code, "}\n");
+
+    Fmt(&code, "Object.defineProperty(View, 'name', { value: name });\n");
+    Fmt(&code, "Object.defineProperty(Records, 'name', { value: name + '[]' });\n");
+    Fmt(&code, "return [View, Records];\n})");
+
+    napi_value script = NewString(env, code.ptr, code.len);
+    napi_value factory;
+    if (napi_run_script(env, script, &factory) != napi_ok)
+        return false;
+
+    Napi::Function read = Napi::Function::New(env, ReadRecord, "read", (void *)type);
+    Napi::Function write = Napi::Function::New(env, WriteRecord, "write", (void *)type);
+
+    Napi::Value ret = Napi::Function(env, factory).Call({ NewString(env, type->name), names, nested, read, write });
+    if (ret.IsEmpty())
+        return false;
+
+    Napi::Array classes = ret.As<Napi::Array>();
+
+    type->view_class.Reset(classes.Get(0u).As<Napi::Function>(), 1);
+    type->array_class.Reset(classes.Get(1u).As<Napi::Function>(), 1);
+
+    return true;
+}
+
+Napi::Function GetRecordView(Napi::Env env, const TypeInfo *type)
+{
+    if (type->view_class.IsEmpty() && !GenerateClasses(env, type))
+        return Napi::Function();
+
+    return type->view_class.Value();
+}
+
+Napi::Function GetRecordArray(Napi::Env env, const TypeInfo *type)
+{
+    if (type->array_class.IsEmpty() && !GenerateClasses(env, type))
+        return Napi::Function();
+
+    return type->array_class.Value();
+}
+
+Napi::Object DecodeLazyObject(Napi::Env env, const uint8_t *origin, const TypeInfo *type)
+{
+    Napi::Function cls = GetRecordView(env, type);
+    if (RG_UNLIKELY(cls.IsEmpty()))
+        return Napi::Object();
+
+    Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, (size_t)type->size);
+    memcpy(buffer.Data(), origin, (size_t)type->size);
+
+    napi_value view;
+    napi_status status = napi_create_dataview(env, (size_t)type->size, buffer, 0, &view);
+    RG_ASSERT(status == napi_ok);
+
+    return cls.New({ view, Napi::Number::New(env, 0) });
+}
+
+Napi::Value DecodeRelayedObject(Napi::Env env, const uint8_t *origin, const TypeInfo *type, int16_t realign)
+{
+    if (!type->lazy || realign) {
+        InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+        // Only top-level arguments get placeholders, nested lazy records are decoded eagerly
+        bool prev = instance->relaying;
+        instance->relaying = true;
+        RG_DEFER { instance->relaying = prev; };
+
+        return DecodeObject(env, origin, type, realign);
+    }
+
+    Napi::ArrayBuffer buffer = Napi::ArrayBuffer::New(env, (size_t)type->size);
+    memcpy(buffer.Data(), origin, (size_t)type->size);
+
+    napi_value view;
+    napi_status status = napi_create_dataview(env, (size_t)type->size, buffer, 0, &view);
+    RG_ASSERT(status == napi_ok);
+
+    // Relay() never gives other DataView values to callbacks
+    status = napi_wrap(env, view, (void *)type, nullptr, nullptr, nullptr);
+    RG_ASSERT(status == napi_ok);
+
+    return Napi::Value(env, view);
+}
+
+napi_value CallRelayed(Napi::Function *func, size_t argc, napi_value *argv)
+{
+    Napi::Env env = func->Env();
+
+    for (size_t i = 0; i < argc; i++) {
+        bool is_view;
+        napi_is_dataview(env, argv[i], &is_view);
+
+        if (!is_view)
+            continue;
+
+        const TypeInfo *type;
+        if (napi_remove_wrap(env, argv[i], (void **)&type) != napi_ok)
+            continue;
+
+        Napi::Function cls = GetRecordView(env, type);
+        if (RG_UNLIKELY(cls.IsEmpty()))
+            return nullptr;
+
+        argv[i] = cls.New({ Napi::Value(env, argv[i]), Napi::Number::New(env, 0) });
+        if (RG_UNLIKELY(env.IsExceptionPending()))
+            return nullptr;
+    }
+
+    return func->Call(argc, argv);
+}
+
+bool GetRecordArrayMemory(Napi::Env env, Napi::Object obj, const TypeInfo *type, uint8_t **out_ptr)
+{
+    InstanceData *instance = env.GetInstanceData<InstanceData>();
+
+    Napi::Value buffer = obj.Get("buffer");
+    Napi::Value offset = obj.Get("byteOffset");
+    Napi::Value length = obj.Get("length");
+
+    if (RG_UNLIKELY(!buffer.IsArrayBuffer() || !offset.IsNumber() || !length.IsNumber())) {
+        ThrowError<Napi::TypeError>(env, "Unexpected %1 value, expected record array", GetValueType(instance, obj));
+        return false;
+    }
+
+    Napi::ArrayBuffer array = buffer.As<Napi::ArrayBuffer>();
+    int64_t start = offset.As<Napi::Number>().Int64Value();
+    int64_t end = start + length.As<Napi::Number>().Int64Value() * type->size;
+
+    // Detached buffers have a length of 0
+    if (RG_UNLIKELY(start < 0 || end < start || end > (int64_t)array.ByteLength())) {
+        ThrowError<Napi::Error>(env, "Record array memory is not available anymore");
+        return false;
+    }
+
+    *out_ptr = (uint8_t *)array.Data() + start;
+    return true;
+}
+
+}
@@ -0,0 +1,41 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+#pragma once
+
+#include "vendor/libcc/libcc.hh"
+
+#include <napi.h>
+
+namespace RG {
+
+struct TypeInfo;
+
+// Accessor classes are generated once for each record type, these return an
+// empty function (and throw) if something goes wrong.
+Napi::Function GetRecordView(Napi::Env env, const TypeInfo *type);
+Napi::Function GetRecordArray(Napi::Env env, const TypeInfo *type);
+
+// Copies the record memory, members are decoded when they are accessed
+Napi::Object DecodeLazyObject(Napi::Env env, const uint8_t *origin, const TypeInfo *type);
+
+// JS code cannot run on the Koffi stack, so callbacks get lazy records in two steps: Relay()
+// decodes them to placeholders, and CallRelayed() makes the objects once back on the JS stack.
+// Lazy records nested in other records or arrays are decoded eagerly.
+Napi::Value DecodeRelayedObject(Napi::Env env, const uint8_t *origin, const TypeInfo *type, int16_t realign = 0);
+napi_value CallRelayed(Napi::Function *func, size_t argc, napi_value *argv);
+
+// Record arrays are made by koffi.records(), and tagged with the record type
+bool GetRecordArrayMemory(Napi::Env env, Napi::Object obj, const TypeInfo *type, uint8_t **out_ptr);
+
+}
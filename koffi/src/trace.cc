@@ -0,0 +1,258 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+#include "vendor/libcc/libcc.hh"
+#include "ffi.hh"
+#include "trace.hh"
+
+#include <napi.h>
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#elif defined(__linux__)
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace RG {
+
+RG_STATIC_ASSERT(!(TraceRingSize & (TraceRingSize - 1)));
+
+static const char TraceMagic[8] = { 'K', 'O', 'F', 'F', 'I', 'T', 'R', 'C' };
+static const uint32_t TraceVersion = 1;
+
+// Function ids are assigned lazily, and only once for each tracing session
+static std::atomic_int next_session {1};
+
+CallTracer *CallTracer::Open(const char *filename)
+{
+    CallTracer *tracer = new CallTracer();
+    RG_DEFER_N(err_guard) { delete tracer; };
+
+    tracer->fp = OpenFile(filename, (int)OpenFileFlag::Write);
+    if (!tracer->fp)
+        return nullptr;
+
+    uint8_t header[16];
+    uint32_t record_size = RG_SIZE(TraceRecord);
+
+    memcpy(header, TraceMagic, 8);
+    memcpy(header + 8, &TraceVersion, 4);
+    memcpy(header + 12, &record_size, 4);
+
+    if (fwrite(header, 1, RG_SIZE(header), tracer->fp) != RG_SIZE(header)) {
+        LogError("Failed to write to '%1': %2", filename, strerror(errno));
+        return nullptr;
+    }
+
+    tracer->ring = (TraceRecord *)Allocator::Allocate(nullptr, TraceRingSize * RG_SIZE(TraceRecord));
+    tracer->session = next_session++;
+    tracer->js_thread = GetThreadID();
+
+    tracer->flusher = std::thread(&CallTracer::RunFlusher, tracer);
+
+    err_guard.Disable();
+    return tracer;
+}
+
+CallTracer::~CallTracer()
+{
+    if (flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_one();
+
+        flusher.join();
+    }
+
+    if (fp) {
+        Flush();
+
+        if (dropped) {
+            TraceRecord rec = {};
+
+            rec.kind = TraceKind::Dropped;
+            rec.u.dropped = dropped;
+
+            fwrite(&rec, 1, RG_SIZE(rec), fp);
+        }
+
+        fclose(fp);
+    }
+
+    Allocator::Release(nullptr, ring, TraceRingSize * RG_SIZE(TraceRecord));
+}
+
+void CallTracer::Record(const FunctionInfo *func, TraceRecord *rec)
+{
+    if (func->trace_session != session) {
+        TraceRecord name = {};
+
+        name.kind = TraceKind::Name;
+        name.func = next_func;
+        CopyString(func->name, name.u.name);
+
+        // Try again on the next call, and drop this one because nothing could name it.
+        // The ring is full, Push() already counted the drop.
+        if (!Push(name))
+            return;
+
+        func->trace_session = session;
+        func->trace_id = next_func++;
+    }
+
+    rec->func = func->trace_id;
+    rec->thread = rec->thread ? rec->thread : js_thread;
+
+    Push(*rec);
+}
+
+void CallTracer::SummarizeArguments(Napi::Env env, const FunctionInfo *func, const napi_value *args, TraceRecord *out_rec)
+{
+    out_rec->argc = (uint8_t)std::min(func->parameters.len, (Size)UINT8_MAX);
+
+    for (Size i = 0; i < std::min(func->parameters.len, (Size)2); i++) {
+        const ParameterInfo &param = func->parameters[i];
+        out_rec->types[i] = SummarizeValue(env, args[param.offset], &out_rec->u.call.args[i]);
+    }
+}
+
+TraceValue CallTracer::SummarizeValue(Napi::Env env, napi_value value, uint64_t *out_raw)
+{
+    napi_valuetype type;
+    if (!value || napi_typeof(env, value, &type) != napi_ok)
+        return TraceValue::None;
+
+    switch (type) {
+        case napi_undefined:
+        case napi_null: return TraceValue::Null;
+
+        case napi_boolean: {
+            bool b = false;
+            napi_get_value_bool(env, value, &b);
+
+            *out_raw = b;
+            return TraceValue::Boolean;
+        } break;
+        case napi_number: {
+            double d = 0.0;
+            napi_get_value_double(env, value, &d);
+
+            memcpy(out_raw, &d, RG_SIZE(d));
+            return TraceValue::Number;
+        } break;
+        case napi_bigint: {
+            int64_t i = 0;
+            bool lossless;
+            napi_get_value_bigint_int64(env, value, &i, &lossless);
+
+            *out_raw = (uint64_t)i;
+            return TraceValue::BigInt;
+        } break;
+        case napi_string: {
+            size_t len = 0;
+            napi_get_value_string_utf16(env, value, nullptr, 0, &len);
+
+            *out_raw = (uint64_t)len;
+            return TraceValue::String;
+        } break;
+        case napi_external: {
+            void *ptr = nullptr;
+            napi_get_value_external(env, value, &ptr);
+
+            *out_raw = (uint64_t)(uintptr_t)ptr;
+            return TraceValue::External;
+        } break;
+
+        default: return TraceValue::Object;
+    }
+
+    RG_UNREACHABLE();
+}
+
+uint32_t CallTracer::GetThreadID()
+{
+#if defined(_WIN32)
+    return (uint32_t)GetCurrentThreadId();
+#elif defined(__linux__)
+    return (uint32_t)syscall(SYS_gettid);
+#else
+    return (uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+}
+
+bool CallTracer::Push(const TraceRecord &rec)
+{
+    uint64_t head = this->head.load(std::memory_order_relaxed);
+    uint64_t tail = this->tail.load(std::memory_order_acquire);
+
+    if (RG_UNLIKELY(head - tail >= (uint64_t)TraceRingSize)) {
+        dropped++;
+        return false;
+    }
+
+    ring[head & (TraceRingSize - 1)] = rec;
+    this->head.store(head + 1, std::memory_order_release);
+
+    // Don't wait for the next periodic flush if calls come in fast
+    if (RG_UNLIKELY(head + 1 - tail == TraceRingSize / 2)) {
+        cv.notify_one();
+    }
+
+    return true;
+}
+
+void CallTracer::RunFlusher()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!stop) {
+        cv.wait_for(lock, std::chrono::milliseconds(100));
+
+        lock.unlock();
+        Flush();
+        lock.lock();
+    }
+}
+
+bool CallTracer::Flush()
+{
+    uint64_t head = this->head.load(std::memory_order_acquire);
+    uint64_t tail = this->tail.load(std::memory_order_relaxed);
+
+    while (tail < head) {
+        Size offset = (Size)(tail & (TraceRingSize - 1));
+        Size len = (Size)std::min(head - tail, (uint64_t)(TraceRingSize - offset));
+
+        if (fwrite(ring + offset, RG_SIZE(TraceRecord), (size_t)len, fp) != (size_t)len) {
+            LogError("Failed to write trace records: %1", strerror(errno));
+
+            this->tail.store(head, std::memory_order_release);
+            return false;
+        }
+
+        tail += len;
+        this->tail.store(tail, std::memory_order_release);
+    }
+
+    return true;
+}
+
+}
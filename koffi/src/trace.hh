@@ -0,0 +1,112 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+#pragma once
+
+#include "vendor/libcc/libcc.hh"
+
+#include <napi.h>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+
+namespace RG {
+
+struct FunctionInfo;
+
+static const Size TraceRingSize = 65536;
+
+enum class TraceKind: uint8_t {
+    Name = 0,
+    Call = 1,
+    AsyncCall = 2,
+    Dropped = 3
+};
+
+enum class TraceValue: uint8_t {
+    None = 0,
+    Null = 1,
+    Boolean = 2,
+    Number = 3, // Stored as double
+    BigInt = 4, // Stored as int64_t
+    String = 5, // Stored as length (in UTF-16 code units)
+    External = 6, // Stored as address
+    Object = 7
+};
+
+// Stored as-is (native endianness) after a 16-byte header, see tools/trace.js
+struct TraceRecord {
+    TraceKind kind;
+    uint8_t flags; // Bit 0 is set for failed calls
+    uint8_t argc;
+    TraceValue types[3]; // First two arguments, then return value
+    uint8_t reserved[2];
+    uint32_t func;
+    uint32_t thread;
+
+    union {
+        struct {
+            int64_t start; // Nanoseconds (monotonic clock)
+            int64_t end;
+            int64_t native_time; // Time spent in the C function
+            uint64_t args[2];
+            uint64_t ret;
+        } call;
+        char name[48]; // Truncated and NUL-terminated
+        uint64_t dropped;
+    } u;
+};
+RG_STATIC_ASSERT(RG_SIZE(TraceRecord) == 64);
+
+class CallTracer {
+    FILE *fp = nullptr;
+
+    // Single producer (JS thread) and single consumer (flush thread)
+    TraceRecord *ring = nullptr;
+    std::atomic<uint64_t> head {0};
+    std::atomic<uint64_t> tail {0};
+    uint64_t dropped = 0;
+
+    std::thread flusher;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop = false;
+
+    int session;
+    uint32_t next_func = 0;
+    uint32_t js_thread;
+
+public:
+    ~CallTracer();
+
+    static CallTracer *Open(const char *filename);
+
+    // JS thread only, fills in the function (and thread if missing) and queues the record.
+    // Records are dropped if the ring is full, so that tracing never blocks calls.
+    void Record(const FunctionInfo *func, TraceRecord *rec);
+
+    static void SummarizeArguments(Napi::Env env, const FunctionInfo *func, const napi_value *args, TraceRecord *out_rec);
+    static TraceValue SummarizeValue(Napi::Env env, napi_value value, uint64_t *out_raw);
+
+    static uint32_t GetThreadID();
+
+private:
+    CallTracer() = default;
+
+    bool Push(const TraceRecord &rec);
+
+    void RunFlusher();
+    bool Flush();
+};
+
+}
@@ -0,0 +1,147 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+#include "vendor/libcc/libcc.hh"
+#include "ffi.hh"
+#include "trampolines.hh"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+    #include <sys/mman.h>
+
+    #define DYNAMIC_TRAMPOLINES
+#endif
+
+namespace RG {
+
+#ifdef DYNAMIC_TRAMPOLINES
+
+// Each stub loads its index into R11 and jumps to the assembly code shared by
+// all of them, which does the same thing as the static trampolines.
+extern "C" int TrampolineDynamic;
+extern "C" int TrampolineDynamicX;
+
+static const Size PageSize = 4096;
+static const Size StubSize = 32;
+static const Size StubsPerPage = PageSize / (2 * StubSize);
+
+// Pages are never released, native code may keep pointers to trampolines around
+static std::mutex trampolines_mutex;
+static HeapArray<uint8_t *> pages;
+static HeapArray<Size> free_indices;
+static Size next_index = 0;
+
+static void WriteStub(uint8_t *ptr, uint64_t idx, const void *target)
+{
+    uint64_t addr = (uint64_t)target;
+
+    memset(ptr, 0xCC, StubSize); // int3
+
+    ptr[0] = 0xF3; ptr[1] = 0x0F; ptr[2] = 0x1E; ptr[3] = 0xFA; // endbr64
+    ptr[4] = 0x49; ptr[5] = 0xBB; memcpy(ptr + 6, &idx, 8); // movabs $idx, %r11
+    ptr[14] = 0x49; ptr[15] = 0xBA; memcpy(ptr + 16, &addr, 8); // movabs $target, %r10
+    ptr[24] = 0x41; ptr[25] = 0xFF; ptr[26] = 0xE2; // jmp *%r10
+}
+
+Size AllocateDynamicTrampoline()
+{
+    std::lock_guard<std::mutex> lock(trampolines_mutex);
+
+    if (free_indices.len) {
+        Size idx = free_indices[free_indices.len - 1];
+        free_indices.RemoveLast(1);
+
+        return idx;
+    }
+
+    if (next_index >= MaxDynamicTrampolines)
+        return -1;
+
+    if (!(next_index % StubsPerPage)) {
+        uint8_t *page = (uint8_t *)mmap(nullptr, PageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (page == MAP_FAILED)
+            return -1;
+
+        for (Size i = 0; i < StubsPerPage; i++) {
+            uint64_t idx = (uint64_t)(MaxTrampolines * 2 + next_index + i);
+            uint8_t *ptr = page + i * 2 * StubSize;
+
+            WriteStub(ptr, idx, &TrampolineDynamic);
+            WriteStub(ptr + StubSize, idx, &TrampolineDynamicX);
+        }
+
+        // Some systems (such as hardened macOS processes) refuse executable pages,
+        // callers can fall back to static trampolines.
+        if (mprotect(page, PageSize, PROT_READ | PROT_EXEC) < 0) {
+            munmap(page, PageSize);
+            return -1;
+        }
+
+        pages.Append(page);
+    }
+
+    return MaxTrampolines * 2 + next_index++;
+}
+
+void ReleaseDynamicTrampoline(Size idx)
+{
+    std::lock_guard<std::mutex> lock(trampolines_mutex);
+
+    RG_ASSERT(idx >= MaxTrampolines * 2 && idx < MaxTrampolines * 2 + next_index);
+    free_indices.Append(idx);
+}
+
+void *GetDynamicTrampoline(Size idx, bool xmm)
+{
+    std::lock_guard<std::mutex> lock(trampolines_mutex);
+
+    idx -= MaxTrampolines * 2;
+    RG_ASSERT(idx >= 0 && idx < next_index);
+
+    uint8_t *page = pages[idx / StubsPerPage];
+    uint8_t *ptr = page + (idx % StubsPerPage) * 2 * StubSize + xmm * StubSize;
+
+    return ptr;
+}
+
+Size FindDynamicTrampoline(const void *ptr)
+{
+    std::lock_guard<std::mutex> lock(trampolines_mutex);
+
+    for (Size i = 0; i < pages.len; i++) {
+        const uint8_t *page = pages[i];
+
+        if (ptr >= page && ptr < page + PageSize) {
+            Size offset = (const uint8_t *)ptr - page;
+
+            if (offset % StubSize)
+                return -1;
+
+            Size idx = i * StubsPerPage + offset / (2 * StubSize);
+            return idx < next_index ? MaxTrampolines * 2 + idx : -1;
+        }
+    }
+
+    return -1;
+}
+
+#else
+
+Size AllocateDynamicTrampoline() { return -1; }
+void ReleaseDynamicTrampoline(Size) { RG_UNREACHABLE(); }
+
+void *GetDynamicTrampoline(Size, bool) { RG_UNREACHABLE(); }
+Size FindDynamicTrampoline(const void *) { return -1; }
+
+#endif
+
+}
@@ -0,0 +1,31 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+#pragma once
+
+#include "vendor/libcc/libcc.hh"
+
+namespace RG {
+
+// Trampolines generated at runtime for registered callbacks, on platforms that support it.
+// Their indices start at MaxTrampolines * 2, after the static ones. The code is shared by
+// all instances, so indices are allocated process-wide.
+
+// Returns -1 if dynamic trampolines are not supported, or if they are all in use
+Size AllocateDynamicTrampoline();
+void ReleaseDynamicTrampoline(Size idx);
+
+void *GetDynamicTrampoline(Size idx, bool xmm);
+Size FindDynamicTrampoline(const void *ptr);
+
+}
@@ -17,6 +17,14 @@
 #include "util.hh"
 
 #include <napi.h>
+#if NODE_WANT_INTERNALS
+    #include <js_native_api_v8.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #include <arm_neon.h>
+#endif
 
 namespace RG {
 
@@ -108,6 +116,9 @@ const TypeInfo *ResolveType(InstanceData *instance, Span<const char> str, int *o
     }
 
     if (indirect) {
+        if (type->primitive == PrimitiveKind::Span)
+            return nullptr;
+
         type = MakePointerType(instance, type, indirect);
         RG_ASSERT(type);
     }
@@ -170,6 +181,64 @@ const TypeInfo *MakePointerType(InstanceData *instance, const TypeInfo *ref, int
     return ref;
 }
 
+const TypeInfo *MakeSpanType(InstanceData *instance, const TypeInfo *ref, const TypeInfo *length)
+{
+    RG_ASSERT(ref->primitive == PrimitiveKind::Void || GetTypedArrayType(ref) >= 0);
+    RG_ASSERT(IsInteger(length));
+
+    char name_buf[256];
+    Fmt(name_buf, "span<%1, %2>", ref->name, length->name);
+
+    TypeInfo *type = (TypeInfo *)instance->types_map.FindValue(name_buf, nullptr);
+
+    if (!type) {
+        type = instance->types.AppendDefault();
+
+        type->name = DuplicateString(name_buf, &instance->str_alloc).ptr;
+
+        type->primitive = PrimitiveKind::Span;
+        type->size = 2 * RG_SIZE(void *);
+        type->align = RG_SIZE(void *);
+        type->ref.type = ref;
+        type->length = length;
+
+        instance->types_map.Set(type->name, type);
+    }
+
+    return type;
+}
+
+// JS code gives a single value for each span parameter, but the C function gets a pointer
+// and a length. Input spans use the buffer directly (pinned), and the length slot is filled
+// by ExpandSpans(). Output spans use an array to return the value, see CallData::PushSpan().
+void AppendSpanParameters(InstanceData *instance, const ParameterInfo &param, FunctionInfo *func)
+{
+    RG_ASSERT(param.type->primitive == PrimitiveKind::Span);
+
+    const TypeInfo *span = param.type;
+
+    ParameterInfo ptr = param;
+    ParameterInfo len = param;
+
+    ptr.span = span;
+    len.span = span;
+    len.span_length = true;
+
+    if (param.directions & 2) {
+        ptr.type = MakePointerType(instance, span->ref.type, (param.directions & 1) ? 1 : 2);
+        len.type = MakePointerType(instance, span->length);
+    } else {
+        ptr.type = MakePointerType(instance, span->ref.type);
+        ptr.directions = 4;
+        len.type = span->length;
+        len.offset = (int8_t)(MaxParameters * 2 + param.offset);
+    }
+
+    func->parameters.Append(ptr);
+    func->parameters.Append(len);
+    func->hidden_parameters++;
+}
+
 const char *GetValueType(const InstanceData *instance, Napi::Value value)
 {
     for (const TypeInfo &type: instance->types) {
@@ -296,6 +365,97 @@ int IsHFA(const TypeInfo *type, int min, int max)
     return hfa ? count : 0;
 }
 
+bool IsAsciiString(Span<const char> str)
+{
+    const char *ptr = str.ptr;
+    const char *end = str.end();
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    __m128i high = _mm_setzero_si128();
+
+    for (; end - ptr >= 64; ptr += 64) {
+        __m128i chunk0 = _mm_loadu_si128((const __m128i *)ptr + 0);
+        __m128i chunk1 = _mm_loadu_si128((const __m128i *)ptr + 1);
+        __m128i chunk2 = _mm_loadu_si128((const __m128i *)ptr + 2);
+        __m128i chunk3 = _mm_loadu_si128((const __m128i *)ptr + 3);
+
+        high = _mm_or_si128(high, _mm_or_si128(_mm_or_si128(chunk0, chunk1), _mm_or_si128(chunk2, chunk3)));
+    }
+    for (; end - ptr >= 16; ptr += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)ptr);
+        high = _mm_or_si128(high, chunk);
+    }
+
+    if (_mm_movemask_epi8(high))
+        return false;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    uint8x16_t high = vdupq_n_u8(0);
+
+    for (; end - ptr >= 64; ptr += 64) {
+        uint8x16_t chunk0 = vld1q_u8((const uint8_t *)ptr + 0);
+        uint8x16_t chunk1 = vld1q_u8((const uint8_t *)ptr + 16);
+        uint8x16_t chunk2 = vld1q_u8((const uint8_t *)ptr + 32);
+        uint8x16_t chunk3 = vld1q_u8((const uint8_t *)ptr + 48);
+
+        high = vorrq_u8(high, vorrq_u8(vorrq_u8(chunk0, chunk1), vorrq_u8(chunk2, chunk3)));
+    }
+    for (; end - ptr >= 16; ptr += 16) {
+        uint8x16_t chunk = vld1q_u8((const uint8_t *)ptr);
+        high = vorrq_u8(high, chunk);
+    }
+
+    if (vmaxvq_u8(high) >= 0x80)
+        return false;
+#else
+    uint64_t high = 0;
+
+    for (; end - ptr >= 8; ptr += 8) {
+        uint64_t chunk;
+        memcpy(&chunk, ptr, 8);
+
+        high |= chunk;
+    }
+
+    if (high & 0x8080808080808080ull)
+        return false;
+#endif
+
+    uint8_t tail = 0;
+    for (; ptr < end; ptr++) {
+        tail |= (uint8_t)*ptr;
+    }
+
+    return !(tail & 0x80);
+}
+
+Napi::String NewString(Napi::Env env, const char *str)
+{
+    Size len = (Size)strlen(str);
+    return NewString(env, str, len);
+}
+
+Napi::String NewString(Napi::Env env, const char *str, Size len)
+{
+    if (RG_LIKELY(IsAsciiString(MakeSpan(str, len)))) {
+#if NODE_WANT_INTERNALS
+        v8::Isolate *isolate = v8::Isolate::GetCurrent();
+        v8::Local<v8::String> str8;
+
+        // Fails only if the string is too long, let N-API deal with the error
+        if (RG_LIKELY(v8::String::NewFromOneByte(isolate, (const uint8_t *)str, v8::NewStringType::kNormal, (int)len).ToLocal(&str8)))
+            return Napi::String(env, v8impl::JsValueFromV8LocalValue(str8));
+#endif
+
+        napi_value value;
+        napi_status status = napi_create_string_latin1(env, str, (size_t)len, &value);
+        NAPI_THROW_IF_FAILED(env, status, Napi::String());
+
+        return Napi::String(env, value);
+    } else {
+        return Napi::String::New(env, str, (size_t)len);
+    }
+}
+
 void DumpMemory(const char *type, Span<const uint8_t> bytes)
 {
     if (bytes.len) {
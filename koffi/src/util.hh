@@ -70,6 +70,10 @@ static inline bool IsFloat(const TypeInfo *type)
 const TypeInfo *ResolveType(Napi::Value value, int *out_directions = nullptr);
 const TypeInfo *ResolveType(InstanceData *instance, Span<const char> str, int *out_directions = nullptr);
 const TypeInfo *MakePointerType(InstanceData *instance, const TypeInfo *type, int count = 1);
+const TypeInfo *MakeSpanType(InstanceData *instance, const TypeInfo *ref, const TypeInfo *length);
+
+struct ParameterInfo;
+void AppendSpanParameters(InstanceData *instance, const ParameterInfo &param, FunctionInfo *func);
 
 // Can be slow, only use for error messages
 const char *GetValueType(const InstanceData *instance, Napi::Value value);
@@ -126,6 +130,12 @@ static inline Napi::Value NewBigInt(Napi::Env env, uint64_t value)
     }
 }
 
+bool IsAsciiString(Span<const char> str);
+
+// Pure ASCII strings (the vast majority) skip the UTF-8 decoder
+Napi::String NewString(Napi::Env env, const char *str);
+Napi::String NewString(Napi::Env env, const char *str, Size len);
+
 int AnalyseFlat(const TypeInfo *type, FunctionRef<void(const TypeInfo *type, int offset, int count)> func);
 
 int IsHFA(const TypeInfo *type, int min, int max);
@@ -29,6 +29,12 @@ const PackedBFG = koffi.pack('PackedBFG', {
     })
 });
 
+const Pack3 = koffi.struct('Pack3', {
+    a: 'int',
+    b: 'int',
+    c: 'int'
+});
+
 main();
 
 async function main() {
@@ -42,11 +48,19 @@ async function main() {
 }
 
 async function test() {
+    // Use a small worker pool, so that calls have to wait for each other
+    koffi.config({ async_threads: 2 });
+    assert.equal(koffi.config().async_threads, 2);
+
     const lib_filename = path.dirname(__filename) + '/build/misc' + koffi.extension;
     const lib = koffi.load(lib_filename);
 
     const ConcatenateToInt1 = lib.func('ConcatenateToInt1', 'int64_t', Array(12).fill('int8_t'));
     const MakePackedBFG = lib.func('PackedBFG __fastcall MakePackedBFG(int x, double y, _Out_ PackedBFG *p, const char *str)');
+    const MultiplyPinned = lib.func('void MultiplyIntegers(int multiplier, _Pinned_ int *values, int len)');
+    const SumBytes = lib.func('uint32_t SumBytes(span buf)');
+    const ReadMessage = lib.func('void ReadMessage(_Inout_ span buf)');
+    const FillPack3s = lib.func('void FillPack3s(_Out_ Pack3 *arr, int len)');
 
     let promises = [];
 
@@ -88,5 +102,68 @@ async function test() {
         promises.push(p);
     }
 
+    // Async call with pinned buffer
+    {
+        let arr = new Int32Array([1, 2, 3, 4]);
+        let p = new Promise((resolve, reject) => {
+            MultiplyPinned.async(-2, arr, 3, (err, res) => {
+                if (err) {
+                    reject(err);
+                } else {
+                    resolve();
+                }
+            });
+        });
+
+        await p;
+        assert.deepEqual(arr, new Int32Array([-2, -4, -6, 4]));
+    }
+
+    // Many calls completing out of order, with results delivered in batches
+    {
+        let results = await Promise.all(Array.from({ length: 48 }, (_, i) => new Promise((resolve, reject) => {
+            ConcatenateToInt1.async(i % 10, 6, 1, 2, 3, 9, 4, 4, 0, 6, 8, 7, (err, res) => {
+                if (err) {
+                    reject(err);
+                } else {
+                    resolve(res);
+                }
+            });
+        })));
+
+        for (let i = 0; i < results.length; i++)
+            assert.equal(results[i], BigInt(i % 10) * 100000000000n + 61239440687n);
+    }
+
+    // Promise-based calls
+    {
+        assert.equal(await ConcatenateToInt1.promise(5, 6, 1, 2, 3, 9, 4, 4, 0, 6, 8, 7), 561239440687n);
+
+        let out = {};
+        let res = await MakePackedBFG.promise(2, 7, out, 'Hello');
+        assert.deepEqual(res, { a: 2, b: 4, c: -25, d: 'X/Hello/X', e: 54, inner: { f: 14, g: 5 } });
+        assert.deepEqual(out, res);
+
+        await assert.rejects(MultiplyPinned.promise('foo', new Int32Array(1), 1), TypeError);
+        assert.throws(() => MultiplyPinned.promise(2), TypeError);
+
+        assert.equal(await SumBytes.promise(Buffer.from([4, 5, 6])), 15);
+        await assert.rejects(SumBytes.promise([1, 2]), TypeError);
+
+        let msg = [Buffer.alloc(8)];
+        await ReadMessage.promise(msg);
+        assert.equal(msg[0].toString(), 'Hello Wo');
+
+        let packs = koffi.records(Pack3, 3);
+        await FillPack3s.promise(packs, packs.length);
+        assert.deepEqual(packs.get(2), { a: 2, b: 4, c: -2 });
+    }
+
+    // Errors detected before the call are given to the callback
+    {
+        let err = await new Promise(resolve => MultiplyPinned.async('foo', new Int32Array(1), 1, resolve));
+        assert.ok(err instanceof TypeError);
+    }
+
     await Promise.all(promises);
 }
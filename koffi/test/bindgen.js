@@ -0,0 +1,118 @@
+#!/usr/bin/env node
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+// Generate an addon with tools/bindgen.js, build it with CNoke, and check that
+// it gives the same results as the dynamic binding.
+
+const koffi = require('./build/koffi.node');
+const assert = require('assert');
+const fs = require('fs');
+const path = require('path');
+const { spawnSync } = require('child_process');
+const bindgen = require('../tools/bindgen.js');
+
+main();
+
+async function main() {
+    try {
+        await test();
+        console.log('Success!');
+    } catch (err) {
+        console.error(err);
+        process.exit(1);
+    }
+}
+
+async function test() {
+    const decl_filename = path.dirname(__filename) + '/bindgen_decl.js';
+    const addon_dir = path.dirname(__filename) + '/build/bindgen';
+    const cnoke_filename = path.dirname(__filename) + '/../../cnoke/cnoke.js';
+
+    koffi.struct('Pack3', { a: 'int', b: 'int', c: 'int' });
+    koffi.struct('Float2', { a: 'float', b: 'float' });
+    koffi.struct('Double3', { a: 'double', s: koffi.struct({ b: 'double', c: 'double' }) });
+    koffi.struct('IJK1', { i: 'int8_t', j: 'int8_t', k: 'int8_t' });
+
+    bindgen.generate(koffi, decl_filename, addon_dir, 'misc_bindgen');
+
+    let proc = spawnSync(process.execPath, [cnoke_filename, '-d', addon_dir], { stdio: 'inherit' });
+    assert.equal(proc.status, 0, 'Failed to build generated addon');
+
+    const lib_filename = path.dirname(__filename) + '/build/misc' + koffi.extension;
+    const lib = koffi.load(lib_filename);
+
+    let dynamic = {};
+    for (let proto of require(decl_filename)) {
+        let func = lib.func(proto);
+        dynamic[func.name] = func;
+    }
+    let addon = require(addon_dir + '/build/misc_bindgen.node').load(lib_filename);
+
+    assert.deepEqual(Object.keys(addon).sort(), Object.keys(dynamic).sort());
+
+    for (let mylib of [dynamic, addon]) {
+        assert.equal(mylib.GetMinusOne1(), -1);
+        assert.equal(mylib.ThroughUInt32UU(4000000000), 4000000000);
+        assert.equal(mylib.ThroughUInt64UU(18446744073709551615n), 18446744073709551615n);
+        assert.equal(mylib.ThroughInt64II(-5), -5);
+        assert.equal(mylib.ThroughInt64II(-9223372036854775807n), -9223372036854775807n);
+
+        // Structs and struct pointers
+        {
+            let p = {};
+            mylib.FillPack3(1, 2, 3, p);
+            assert.deepEqual(p, { a: 1, b: 2, c: 3 });
+            mylib.AddPack3(6, 9, -12, p);
+            assert.deepEqual(p, { a: 7, b: 11, c: -9 });
+
+            assert.deepEqual(mylib.RetPack3(4, 5, 6), { a: 4, b: 5, c: 6 });
+
+            let f2 = {};
+            assert.deepEqual(mylib.PackFloat2(1.5, 6, f2), { a: 1.5, b: 6 });
+            assert.deepEqual(f2, { a: 1.5, b: 6 });
+
+            let d3 = {};
+            assert.deepEqual(mylib.PackDouble3(0.5, 10, 5, d3), { a: 0.5, s: { b: 10, c: 5 } });
+            assert.deepEqual(d3, { a: 0.5, s: { b: 10, c: 5 } });
+        }
+
+        // Memory and strings
+        assert.equal(mylib.SumBytes(new Uint8Array([1, 2, 3, 250]), 4), 256);
+        assert.equal(mylib.ConcatenateToStr1(5, 6, 1, 2, 3, 9, 4, 4, { i: 0, j: 6, k: 8 }, 7), '561239440687');
+
+        // Errors
+        assert.throws(() => mylib.RetPack3(1, 'a', 3), /Unexpected String value for argument 2, expected number/);
+        assert.throws(() => mylib.FillPack3(1, 2, 3, 5), { name: 'TypeError' });
+        assert.throws(() => mylib.AddPack3(1, 2, 3, { a: 1 }), /Missing expected object property 'b'/);
+    }
+
+    // Generated functions give TypedArray memory to C directly
+    {
+        let arr = new Int32Array(3);
+        addon.FillPack3(4, 5, 6, arr);
+        assert.deepEqual(arr, new Int32Array([4, 5, 6]));
+        addon.AddPack3(1, 1, 1, arr);
+        assert.deepEqual(arr, new Int32Array([5, 6, 7]));
+        assert.throws(() => addon.FillPack3(4, 5, 6, new Int32Array(2)), { name: 'TypeError' });
+    }
+
+    // Output parameters other than struct pointers cannot be generated
+    {
+        let bad_filename = addon_dir + '/bad_decl.js';
+        fs.writeFileSync(bad_filename, "module.exports = ['void BadOut(_Out_ int *out)'];\n");
+        assert.throws(() => bindgen.generate(koffi, bad_filename, addon_dir + '/bad'),
+                      /Output parameters must be struct pointers \(parameter 1 of BadOut\)/);
+    }
+}
@@ -0,0 +1,29 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+// Functions of misc.c used by test/bindgen.js, for lib.func() and for the generated addon.
+// The test declares the struct types before this module gets loaded.
+
+module.exports = [
+    'int8_t GetMinusOne1(void)',
+    'uint32_t ThroughUInt32UU(uint32_t v)',
+    'uint64_t ThroughUInt64UU(uint64_t v)',
+    'int64_t ThroughInt64II(int64_t v)',
+    'void FillPack3(int a, int b, int c, _Out_ Pack3 *p)',
+    'void __fastcall AddPack3(int a, int b, int c, _Inout_ Pack3 *p)',
+    'Pack3 RetPack3(int a, int b, int c)',
+    'Float2 PackFloat2(float a, float b, _Out_ Float2 *out)',
+    'Double3 PackDouble3(double a, double b, double c, _Out_ Double3 *out)',
+    'uint32_t SumBytes(const uint8_t *ptr, size_t len)',
+    'const char *ConcatenateToStr1(int8_t a, int8_t b, int8_t c, int8_t d, int8_t e, int8_t f, int8_t g, int8_t h, IJK1 ijk, int8_t j)'
+];
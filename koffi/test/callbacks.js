@@ -16,6 +16,7 @@
 const koffi = require('./build/koffi.node');
 const assert = require('assert');
 const path = require('path');
+const util = require('util');
 
 const BFG = koffi.struct('BFG', {
     a: 'int8_t',
@@ -29,12 +30,35 @@ const BFG = koffi.struct('BFG', {
     })
 });
 
+const LazyPack3 = koffi.lazy('LazyPack3', koffi.struct('Pack3', {
+    a: 'int',
+    b: 'int',
+    c: 'int'
+}));
+
+
+// Same layout as Pack3, with lazy records nested inside
+const Wrap3 = koffi.struct('Wrap3', {
+    inner: koffi.lazy(koffi.struct({
+        a: 'int',
+        b: 'int'
+    })),
+    c: 'int'
+});
+const Ones3 = koffi.struct('Ones3', {
+    values: koffi.array(koffi.lazy(koffi.struct('One', { x: 'int' })), 3)
+});
+
 const SimpleCallback = koffi.callback('int SimpleCallback(const char *str)');
+const Pack3Callback = koffi.callback('int Pack3Callback(LazyPack3 p)');
+const Wrap3Callback = koffi.callback('int Wrap3Callback(Wrap3 p)');
+const Ones3Callback = koffi.callback('int Ones3Callback(Ones3 p)');
 const RecursiveCallback = koffi.callback('RecursiveCallback', 'float', ['int', 'str', 'double']);
 const BigCallback = koffi.callback('BFG BigCallback(BFG bfg)');
 const SuperCallback = koffi.callback('void SuperCallback(int i, int v1, double v2, int v3, int v4, int v5, int v6, float v7, int v8)');
 const ApplyCallback = koffi.callback('int __stdcall ApplyCallback(int a, int b, int c)');
 const IntCallback = koffi.callback('int IntCallback(int x)');
+const NotifyCallback = koffi.callback('void NotifyCallback(int x)');
 
 const StructCallbacks = koffi.struct('StructCallbacks', {
     first: koffi.pointer(IntCallback),
@@ -59,6 +83,9 @@ async function test() {
     const lib = koffi.load(lib_filename);
 
     const CallJS = lib.func('int CallJS(const char *str, SimpleCallback *cb)');
+    const ApplyPack3 = lib.func('int ApplyPack3(int a, int b, int c, Pack3Callback *func)');
+    const ApplyWrap3 = lib.func('int ApplyPack3(int a, int b, int c, Wrap3Callback *func)');
+    const ApplyOnes3 = lib.func('int ApplyPack3(int a, int b, int c, Ones3Callback *func)');
     const CallRecursiveJS = lib.func('float CallRecursiveJS(int i, RecursiveCallback *func)');
     const ModifyBFG = lib.func('BFG ModifyBFG(int x, double y, const char *str, BigCallback *func, _Out_ BFG *p)');
     const Recurse8 = lib.func('void Recurse8(int i, SuperCallback *func)');
@@ -67,6 +94,8 @@ async function test() {
     const ApplyStruct = lib.func('int ApplyStruct(int x, StructCallbacks callbacks)');
     const SetCallback = lib.func('void SetCallback(IntCallback *func)');
     const CallCallback = lib.func('int CallCallback(int x)');
+    const CallThreaded = lib.func('int CallThreaded(IntCallback *func, int threads, int count)');
+    const NotifyThreaded = lib.func('CallThreaded', 'int', ['NotifyCallback *', 'int', 'int']);
 
     // Simple test similar to README example
     {
@@ -100,6 +129,31 @@ async function test() {
         assert.deepEqual(out, { a: 2, b: 4, c: -25, d: 'X/Yo!/X', e: 54, inner: { f: 10, g: 3 } });
     }
 
+    // Lazy struct arguments, usable after the callback returns
+    {
+        let kept = null;
+        let ret = ApplyPack3(1, 2, 3, p => {
+            kept = p;
+            return p.a + p.b * p.c;
+        });
+        assert.equal(ret, 7);
+        assert.deepEqual(kept.toJSON(), { a: 1, b: 2, c: 3 });
+    }
+
+    // Lazy records nested in struct arguments
+    {
+        let kept = null;
+        let ret = ApplyWrap3(1, 2, 3, p => {
+            kept = p;
+            return p.inner.a + p.inner.b * p.c;
+        });
+        assert.equal(ret, 7);
+        assert.deepEqual(kept, { inner: { a: 1, b: 2 }, c: 3 });
+
+        ret = ApplyOnes3(4, 5, 6, p => p.values[0].x + p.values[1].x * p.values[2].x);
+        assert.equal(ret, 34);
+    }
+
     // With many parameters
     {
         let a = [], b = [], c = [], d = [], e = [], f = [], g = [], h = [];
@@ -161,4 +215,67 @@ async function test() {
         assert.equal(koffi.unregister(cb), null);
         assert.throws(() => koffi.unregister(cb));
     }
+
+    // Many registered callbacks at once
+    {
+        let callbacks = [];
+
+        for (let i = 0; i < 1000; i++)
+            callbacks.push(koffi.register(x => x + i, koffi.pointer(IntCallback)));
+
+        for (let i = 0; i < callbacks.length; i += 37) {
+            SetCallback(callbacks[i]);
+            assert.equal(CallCallback(27), 27 + i);
+        }
+
+        for (let cb of callbacks)
+            koffi.unregister(cb);
+    }
+
+    // Thread-safe callbacks, called from native threads
+    {
+        let cb = koffi.register(x => x * 2, koffi.pointer(IntCallback), 'blocking');
+
+        // Still works on the JS thread
+        SetCallback(cb);
+        assert.equal(CallCallback(27), 54);
+
+        let sum = await util.promisify(CallThreaded.async)(cb, 4, 100);
+        assert.equal(sum, 2 * (400 * 399 / 2));
+
+        koffi.unregister(cb);
+    }
+    {
+        let seen = new Set;
+        let done;
+        let wait = new Promise(resolve => { done = resolve; });
+
+        let cb = koffi.register(x => {
+            seen.add(x);
+            if (seen.size == 400)
+                done();
+        }, koffi.pointer(NotifyCallback), 'nonblocking');
+
+        // Native threads don't wait for the JS thread, which is busy in this call
+        assert.equal(NotifyThreaded(cb, 4, 100), 0);
+        await wait;
+
+        koffi.unregister(cb);
+    }
+    assert.throws(() => koffi.register(x => x, koffi.pointer(IntCallback), 'nonblocking'), { message: /must return void/ });
+    {
+        // Pointed-to memory may be gone by the time non-blocking callbacks run
+        const NotifyStr = koffi.callback('void NotifyStr(const char *str)');
+        const NotifyPack3 = koffi.callback('void NotifyPack3(LazyPack3 *p)');
+        const NotifyRecord = koffi.callback('void NotifyRecord(int x, LazyPack3 p)');
+        const NotifyOpaque = koffi.callback('void NotifyOpaque(void *ptr, double x)');
+
+        assert.throws(() => koffi.register(x => {}, koffi.pointer(NotifyStr), 'nonblocking'), { message: /cannot take/ });
+        assert.throws(() => koffi.register(x => {}, koffi.pointer(NotifyPack3), 'nonblocking'), { message: /cannot take/ });
+        assert.throws(() => koffi.register(x => {}, koffi.pointer(NotifyRecord), 'nonblocking'), { message: /cannot take/ });
+        koffi.unregister(koffi.register(x => {}, koffi.pointer(NotifyStr), 'blocking'));
+        koffi.unregister(koffi.register(x => {}, koffi.pointer(NotifyOpaque), 'nonblocking'));
+        koffi.unregister(koffi.register(x => {}, koffi.pointer(SuperCallback), 'nonblocking'));
+    }
+    assert.throws(() => koffi.register(x => x, koffi.pointer(IntCallback), 'foo'), { message: /Unknown callback mode/ });
 }
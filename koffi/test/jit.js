@@ -0,0 +1,25 @@
+#!/usr/bin/env node
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+// Run the synchronous test suite again with forward thunks generated at runtime,
+// which are opt-in (and only available on x86_64 SysV platforms).
+
+const koffi = require('./build/koffi.node');
+const assert = require('assert');
+
+koffi.config({ jit: true });
+assert.equal(koffi.config().jit, true);
+
+require('./sync.js');
@@ -23,6 +23,13 @@
     typedef uint32_t char32_t;
 #endif
 
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <pthread.h>
+#endif
+
 #ifdef _WIN32
     #define EXPORT __declspec(dllexport)
 #else
@@ -211,6 +218,22 @@ EXPORT void FillPack3(int a, int b, int c, Pack3 *p)
     p->c = c;
 }
 
+EXPORT Pack3 *GetStaticPack3(int a, int b, int c)
+{
+    static Pack3 p;
+
+    p.a = a;
+    p.b = b;
+    p.c = c;
+
+    return &p;
+}
+
+EXPORT double ScalePack3(const Pack3 *p, double factor)
+{
+    return p ? (p->a + p->b + p->c) * factor : -1.0;
+}
+
 EXPORT Pack3 RetPack3(int a, int b, int c)
 {
     Pack3 p;
@@ -527,6 +550,12 @@ EXPORT float CallRecursiveJS(int i, float (*func)(int i, const char *str, double
     return f;
 }
 
+EXPORT int ApplyPack3(int a, int b, int c, int (*func)(Pack3 p))
+{
+    Pack3 p = { a, b, c };
+    return func(p);
+}
+
 EXPORT BFG ModifyBFG(int x, double y, const char *str, BFG (*func)(BFG bfg), BFG *p)
 {
     BFG bfg;
@@ -584,6 +613,75 @@ EXPORT void MultiplyIntegers(int multiplier, int *values, int len)
     }
 }
 
+EXPORT uint32_t SumBytes(const uint8_t *ptr, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += ptr[i];
+    }
+    return sum;
+}
+
+EXPORT uint32_t SumSmallBytes(const uint8_t *ptr, uint8_t len)
+{
+    return SumBytes(ptr, len);
+}
+
+EXPORT double SumFloats(int bias, const float *values, int len)
+{
+    double sum = bias;
+    for (int i = 0; i < len; i++) {
+        sum += values[i];
+    }
+    return sum;
+}
+
+EXPORT void ReadMessage(char *buf, size_t *len)
+{
+    static const char msg[] = "Hello World!";
+
+    if (*len > strlen(msg)) {
+        *len = strlen(msg);
+    }
+    memcpy(buf, msg, *len);
+}
+
+EXPORT void GetBlob(int which, const uint8_t **ptr, size_t *len)
+{
+    static const uint8_t blob[] = { 'K', 'O', 0, 'F', 'F', 'I' };
+
+    *ptr = which ? blob : NULL;
+    *len = which ? sizeof(blob) : 0;
+}
+
+EXPORT void GetSquares(const int **ptr, int *len)
+{
+    static const int squares[] = { 0, 1, 4, 9, 16 };
+
+    *ptr = squares;
+    *len = 5;
+}
+
+EXPORT int SumPack3s(const Pack3 *arr, int len)
+{
+    int sum = 0;
+
+    for (int i = 0; i < len; i++) {
+        sum += arr[i].a + arr[i].b + arr[i].c;
+    }
+
+    return sum;
+}
+
+EXPORT void FillPack3s(Pack3 *arr, int len)
+{
+    for (int i = 0; i < len; i++) {
+        arr[i].a = i;
+        arr[i].b = i * i;
+        arr[i].c = -i;
+    }
+}
+
 EXPORT const char *ThroughStr(StrStruct s)
 {
     return s.str;
@@ -633,3 +731,72 @@ EXPORT int CallCallback(int x)
 {
     return callback(x);
 }
+
+typedef struct ThreadedCalls {
+    IntCallback *func;
+    int start;
+    int count;
+    int sum;
+} ThreadedCalls;
+
+static void RunThreadedCalls(ThreadedCalls *calls)
+{
+    for (int i = 0; i < calls->count; i++) {
+        calls->sum += calls->func(calls->start + i);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI ThreadedCallsMain(LPVOID udata)
+{
+    RunThreadedCalls((ThreadedCalls *)udata);
+    return 0;
+}
+#else
+static void *ThreadedCallsMain(void *udata)
+{
+    RunThreadedCalls((ThreadedCalls *)udata);
+    return NULL;
+}
+#endif
+
+EXPORT int CallThreaded(IntCallback *func, int threads, int count)
+{
+    ThreadedCalls calls[16];
+#ifdef _WIN32
+    HANDLE handles[16];
+#else
+    pthread_t handles[16];
+#endif
+
+    if (threads > 16)
+        threads = 16;
+
+    for (int i = 0; i < threads; i++) {
+        calls[i].func = func;
+        calls[i].start = i * count;
+        calls[i].count = count;
+        calls[i].sum = 0;
+
+#ifdef _WIN32
+        handles[i] = CreateThread(NULL, 0, ThreadedCallsMain, &calls[i], 0, NULL);
+#else
+        pthread_create(&handles[i], NULL, ThreadedCallsMain, &calls[i]);
+#endif
+    }
+
+    int sum = 0;
+
+    for (int i = 0; i < threads; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(handles[i], INFINITE);
+        CloseHandle(handles[i]);
+#else
+        pthread_join(handles[i], NULL);
+#endif
+
+        sum += calls[i].sum;
+    }
+
+    return sum;
+}
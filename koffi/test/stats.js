@@ -0,0 +1,86 @@
+#!/usr/bin/env node
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+// Statistics change how functions are called, so they are tested in their own
+// process to keep the other test suites running with the default configuration.
+
+const koffi = require('./build/koffi.node');
+const assert = require('assert');
+const path = require('path');
+
+main();
+
+async function main() {
+    try {
+        await test();
+        console.log('Success!');
+    } catch (err) {
+        console.error(err);
+        process.exit(1);
+    }
+}
+
+async function test() {
+    assert.throws(() => koffi.stats(), { name: 'Error' });
+
+    koffi.config({ stats: true });
+    assert.equal(koffi.config().stats, true);
+
+    const lib_filename = path.dirname(__filename) + '/build/misc' + koffi.extension;
+    const lib = koffi.load(lib_filename);
+
+    const ConcatenateToInt1 = lib.func('ConcatenateToInt1', 'int64_t', Array(12).fill('int8_t'));
+    const MultiplyPinned = lib.func('void MultiplyIntegers(int multiplier, _Pinned_ int *values, int len)');
+
+    // Synchronous calls
+    for (let i = 0; i < 4; i++)
+        assert.equal(ConcatenateToInt1(5, 6, 1, 2, 3, 9, 4, 4, 0, 6, 8, 7), 561239440687n);
+
+    // Many asynchronous calls in flight at once
+    {
+        let results = await Promise.all(Array.from({ length: 32 },
+                                                   () => ConcatenateToInt1.promise(5, 6, 1, 2, 3, 9, 4, 4, 0, 6, 8, 7)));
+        assert.ok(results.every(res => res == 561239440687n));
+    }
+
+    // Successful and failed calls
+    {
+        let arr = new Int32Array([1, 2, 3, 4]);
+        await MultiplyPinned.promise(-2, arr, 3);
+        assert.deepEqual(arr, new Int32Array([-2, -4, -6, 4]));
+
+        await assert.rejects(MultiplyPinned.promise('foo', new Int32Array(1), 1), TypeError);
+        assert.throws(() => MultiplyPinned('foo', new Int32Array(1), 1), TypeError);
+    }
+
+    // Collected statistics
+    {
+        let stats = koffi.stats(true);
+        let concat = stats.functions.find(fn => fn.name == 'ConcatenateToInt1');
+        let multiply = stats.functions.find(fn => fn.name == 'MultiplyIntegers');
+
+        assert.equal(concat.calls, 36);
+        assert.equal(concat.errors, 0);
+        assert.ok(concat.prepare_time > 0 && concat.execute_time > 0 && concat.complete_time > 0);
+        assert.equal(multiply.calls, 3);
+        assert.equal(multiply.errors, 2);
+        assert.ok(stats.async_pool_misses > 0);
+
+        stats = koffi.stats();
+        assert.equal(stats.functions.find(fn => fn.name == 'ConcatenateToInt1').calls, 0);
+        assert.equal(stats.functions.find(fn => fn.name == 'MultiplyIntegers').errors, 0);
+        assert.equal(stats.async_pool_misses, 0);
+    }
+}
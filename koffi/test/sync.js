@@ -15,7 +15,11 @@
 
 const koffi = require('./build/koffi.node');
 const assert = require('assert');
+const fs = require('fs');
+const os = require('os');
 const path = require('path');
+const v8 = require('v8');
+const vm = require('vm');
 
 const Pack1 = koffi.struct('Pack1', {
     a: 'int'
@@ -115,6 +119,8 @@ const StrStruct = koffi.struct('StrStruct', {
     str16: koffi.types.string16
 });
 
+const IntCallback = koffi.callback('int IntCallback(int x)');
+
 main();
 
 async function main() {
@@ -143,6 +149,8 @@ async function test() {
     const AddPack2 = lib.fastcall('AddPack2', 'void', ['int', 'int', koffi.inout(koffi.pointer(Pack2))]);
     const FillPack3 = lib.func('FillPack3', 'void', ['int', 'int', 'int', koffi.out(koffi.pointer(Pack3))]);
     const RetPack3 = lib.func('RetPack3', Pack3, ['int', 'int', 'int']);
+    const GetStaticPack3 = lib.func('Pack3 *GetStaticPack3(int a, int b, int c)');
+    const ScalePack3 = lib.func('double ScalePack3(const Pack3 *p, double factor)');
     const AddPack3 = lib.fastcall('AddPack3', 'void', ['int', 'int', 'int', koffi.inout(koffi.pointer(Pack3))]);
     const PackFloat2 = lib.func('Float2 PackFloat2(float a, float b, _Out_ Float2 *out)');
     const ThroughFloat2 = lib.func('Float2 ThroughFloat2(Float2 f2)');
@@ -184,8 +192,23 @@ async function test() {
     const ArrayToStruct = lib.func('IntContainer ArrayToStruct(int *ptr, int len)');
     const FillRange = lib.func('void FillRange(int init, int step, _Out_ int *out, int len)');
     const MultiplyIntegers = lib.func('void MultiplyIntegers(int multiplier, _Inout_ int *values, int len)');
+    const MultiplyPinned = lib.func('void MultiplyIntegers(int multiplier, _Pinned_ int *values, int len)');
+    const MultiplyPinned2 = lib.func('MultiplyIntegers', 'void', ['int', koffi.pinned('int *'), 'int']);
+    const SumBytes = lib.func('uint32_t SumBytes(span buf)');
+    const SumSmallBytes = lib.func('SumSmallBytes', 'uint32_t', [koffi.span('uint8_t', 'uint8_t')]);
+    const SumFloats = lib.func('SumFloats', 'double', ['int', koffi.span('float', 'int')]);
+    const ReadMessage = lib.func('void ReadMessage(_Inout_ span buf)');
+    const GetBlob = lib.func('void GetBlob(int which, _Out_ span blob)');
+    const GetSquares = lib.func('GetSquares', 'void', [koffi.out(koffi.span('int', 'int'))]);
+    const SumPack3s = lib.func('int SumPack3s(const Pack3 *arr, int len)');
+    const RetLazyPack3 = lib.func('RetPack3', koffi.lazy(Pack3), ['int', 'int', 'int']);
+    const PackLazyDouble3 = lib.func('PackDouble3', koffi.lazy(Double3), ['double', 'double', 'double', koffi.out(koffi.pointer(Double3))]);
+    const LazyArrayToStruct = lib.func('ArrayToStruct', koffi.lazy('LazyIntContainer', IntContainer), ['int *', 'int']);
+    const FillPack3s = lib.func('void FillPack3s(_Out_ Pack3 *arr, int len)');
     const ThroughStr = lib.func('str ThroughStr(StrStruct s)');
     const ThroughStr16 = lib.func('str16 ThroughStr16(StrStruct s)');
+    const SetCallback = lib.func('void SetCallback(IntCallback *func)');
+    const CallCallback = lib.func('int CallCallback(int x)');
 
     // Simple signed value returns
     assert.equal(GetMinusOne1(), -1);
@@ -231,6 +254,17 @@ async function test() {
         let q = RetPack3(6, 9, -12);
         assert.deepEqual(q, { a: 6, b: 9, c: -12 });
 
+        let target = { a: 0, b: 0, c: 0, d: 42 };
+        assert.strictEqual(RetPack3.into(target, 1, -2, 3), target);
+        assert.deepEqual(target, { a: 1, b: -2, c: 3, d: 42 });
+        let raw = new Int32Array(3);
+        assert.strictEqual(RetPack3.into(raw, 4, 5, 6), raw);
+        assert.deepEqual(raw, Int32Array.from([4, 5, 6]));
+        assert.throws(() => RetPack3.into(new Int32Array(2), 4, 5, 6), { name: 'Error' });
+        assert.throws(() => RetPack3.into(null, 4, 5, 6), { name: 'TypeError' });
+        assert.throws(() => RetPack3.into({}, 4, 5), { name: 'TypeError' });
+        assert.equal(FillPack3.into, undefined);
+
         AddPack3(6, 9, -12, p);
         assert.deepEqual(p, { a: 7, b: 11, c: -9 });
     }
@@ -251,6 +285,10 @@ async function test() {
         assert.deepEqual(ThroughFloat3({ a: 20.0, b: [30.0, 40.0] }), f3);
         assert.deepEqual(ThroughFloat3(f3), f3);
 
+        let f3raw = new Float32Array(3);
+        PackFloat3.into(f3raw, 1.5, 2.5, 3.5, {});
+        assert.deepEqual(f3raw, Float32Array.from([1.5, 2.5, 3.5]));
+
         let d2p = {};
         let d2 = PackDouble2(1.0, 2.0, d2p);
         assert.deepEqual(d2, { a: 1.0, b: 2.0 });
@@ -260,6 +298,12 @@ async function test() {
         let d3 = PackDouble3(0.5, 10.0, 5.0, d3p);
         assert.deepEqual(d3, { a: 0.5, s: { b: 10.0, c: 5.0 } });
         assert.deepEqual(d3, d3p);
+
+        let d3raw = new Float64Array(3);
+        PackDouble3.into(d3raw, 1.5, 2.5, 3.5, {});
+        assert.deepEqual(d3raw, Float64Array.from([1.5, 2.5, 3.5]));
+        PackDouble3.into(d3, 4, 5, 6, {});
+        assert.deepEqual(d3, { a: 4, s: { b: 5, c: 6 } });
     }
 
     // Mixed int/float structs
@@ -267,6 +311,12 @@ async function test() {
         let sif = { i: 4, f: 2.0 };
         assert.deepEqual(ReverseIntFloat(sif), { i: 2, f: 4 });
         assert.deepEqual(ReverseFloatInt(sif), { i: 2, f: 4 });
+
+        let raw = new Uint8Array(8);
+        let view = new DataView(raw.buffer);
+        ReverseFloatInt.into(raw, { f: 2, i: 4 });
+        assert.equal(view.getInt32(0, true), 2);
+        assert.equal(view.getFloat32(4, true), 4);
     }
 
     // Many parameters
@@ -301,10 +351,38 @@ async function test() {
         assert.equal(ReturnBigString(str), str);
     }
 
+    // ASCII and non-ASCII strings, to exercise the fast path around vector-sized chunks
+    {
+        for (let len of [0, 1, 15, 16, 17, 63, 64, 65, 200]) {
+            for (let pos of [0, len >> 1, len - 1]) {
+                if (pos < 0)
+                    continue;
+
+                let ascii = 'x'.repeat(len);
+                let latin1 = ascii.substr(0, pos) + 'é' + ascii.substr(pos + 1);
+                let utf16 = ascii.substr(0, pos) + '€' + ascii.substr(pos + 1);
+
+                assert.equal(ReturnBigString(ascii), ascii);
+                assert.equal(ReturnBigString(latin1), latin1);
+                assert.equal(ReturnBigString(utf16), utf16);
+            }
+        }
+
+        assert.deepEqual(ReturnFixedStr2({ buf: 'Héllo!' }), { buf: 'Héllo!' });
+    }
+
     // Variadic
     {
         let str = PrintFmt('foo %d %g %s', 'int', 200, 'double', 1.5, 'str', 'BAR');
         assert.equal(str, 'foo 200 1.5 BAR');
+
+        // Alternate between signatures to exercise the variant cache
+        for (let i = 0; i < 3; i++) {
+            assert.equal(PrintFmt('%d', 'int', i), String(i));
+            assert.equal(PrintFmt('%s-%g', 'str', 'X', 'double', i + 0.5), `X-${i}.5`);
+            assert.equal(PrintFmt('%d %d', 'int', i, 'int', i * 2), `${i} ${i * 2}`);
+            assert.equal(PrintFmt('none'), 'none');
+        }
     }
 
     // UTF-16LE strings
@@ -385,6 +463,148 @@ async function test() {
         assert.deepEqual(out2, new Int32Array([3 * 13, 3 * 16, 3 * 19, 3 * 22, 3 * 25, 3 * 28, 3 * 31, 34, 37, 40]));
     }
 
+    // Pinned array pointers (no copy)
+    {
+        let arr = new Int32Array([1, 2, 3, 4, 5, 6]);
+        let view = arr.subarray(2);
+
+        MultiplyPinned(2, arr, 2);
+        MultiplyPinned2(10, view, 3);
+        assert.deepEqual(arr, new Int32Array([2, 4, 30, 40, 50, 6]));
+
+        MultiplyPinned(-1, arr.buffer, 1);
+        MultiplyPinned(3, new DataView(arr.buffer, 20), 1);
+        assert.deepEqual(arr, new Int32Array([-2, 4, 30, 40, 50, 18]));
+
+        assert.throws(() => MultiplyPinned(2, new Uint8Array(8), 2), { name: 'TypeError' });
+        assert.throws(() => MultiplyPinned(2, [1, 2], 2), { name: 'TypeError' });
+    }
+
+    // Spans (pointer and length)
+    {
+        let buf = Buffer.from([1, 2, 3, 250]);
+
+        assert.equal(SumBytes(buf), 256);
+        assert.equal(SumBytes(buf.subarray(1, 3)), 5);
+        assert.equal(SumBytes(new Uint16Array([256, 1]).buffer), 2);
+        assert.equal(SumBytes(new DataView(buf.buffer, buf.byteOffset + 2, 2)), 253);
+        assert.equal(SumBytes(null), 0);
+        assert.equal(SumFloats(1, new Float32Array([0.5, 1.5, 2])), 5);
+        assert.equal(SumSmallBytes(Buffer.alloc(300, 1)), 255);
+
+        let orig = Buffer.alloc(32);
+        let out = [orig];
+        ReadMessage(out);
+        assert.ok(Buffer.isBuffer(out[0]));
+        assert.equal(out[0].toString(), 'Hello World!');
+        out[0][0] = 'J'.charCodeAt(0);
+        assert.equal(orig.toString('latin1', 0, 5), 'Jello');
+        out = [new Uint8Array(5)];
+        ReadMessage(out);
+        assert.deepEqual(out[0], new Uint8Array(Buffer.from('Hello')));
+        out = [new Int32Array(8)];
+        ReadMessage(out);
+        assert.equal(out[0].length, 3);
+        assert.equal(Buffer.from(out[0].buffer, 0, 12).toString(), 'Hello World!');
+
+        let blob = [undefined];
+        GetBlob(1, blob);
+        assert.deepEqual(blob[0], Buffer.from('KO\0FFI', 'latin1'));
+        GetBlob(0, blob);
+        assert.equal(blob[0], null);
+
+        let squares = [null];
+        GetSquares(squares);
+        assert.deepEqual(squares[0], new Int32Array([0, 1, 4, 9, 16]));
+
+        assert.throws(() => SumBytes(), { name: 'TypeError' });
+        assert.throws(() => SumBytes([1, 2]), { name: 'TypeError' });
+        assert.throws(() => SumFloats(0, new Float64Array(2)), { name: 'TypeError' });
+        assert.throws(() => GetBlob(1, null), { name: 'TypeError' });
+        assert.throws(() => ReadMessage([new ArrayBuffer(8)]), { name: 'TypeError' });
+        assert.throws(() => koffi.span('int64_t'), { name: 'TypeError' });
+        assert.throws(() => koffi.span('int', 'float'), { name: 'TypeError' });
+        assert.throws(() => koffi.pointer('span'), { name: 'TypeError' });
+        assert.throws(() => koffi.struct({ s: 'span' }), { name: 'TypeError' });
+        assert.throws(() => lib.func('span GetBlob(int which)'), { name: 'Error' });
+        assert.throws(() => koffi.callback('void SpanCallback(span buf)'), { name: 'TypeError' });
+    }
+
+    // Record arrays
+    {
+        let packs = koffi.records(Pack3, 4);
+
+        assert.equal(packs.length, 4);
+        assert.equal(packs.byteLength, 48);
+        FillPack3s(packs, packs.length);
+        assert.deepEqual(packs.get(3), { a: 3, b: 9, c: -3 });
+        assert.deepEqual(Array.from(packs, p => p.b), [0, 1, 4, 9]);
+
+        let p = packs.at(2);
+        p.a = 100;
+        p.c += 10;
+        assert.deepEqual(p.toJSON(), { a: 100, b: 4, c: 8 });
+        packs.set(0, { a: 1, b: 2, c: 3 });
+        assert.equal(SumPack3s(packs, packs.length), 6 + 1 + 112 + 9);
+        assert.equal(new Int32Array(packs.buffer)[6], 100);
+
+        let buf = new Int32Array([0, 0, 0, 1, 2, 3, 4, 5, 6, 7]);
+        let view = koffi.records(Pack3, buf.subarray(3));
+        assert.equal(view.length, 2);
+        assert.equal(SumPack3s(view, view.length), 21);
+        view.at(1).b = -5;
+        assert.equal(buf[7], -5);
+
+        let bfgs = koffi.records(BFG, 2);
+        let bfg = bfgs.at(1);
+        bfg.a = -3;
+        bfg.b = 2n ** 60n;
+        bfg.e = 42;
+        bfg.inner.g = 1.5;
+        assert.equal(bfg.a, -3);
+        assert.equal(bfg.b, 2n ** 60n);
+        bfg.b = 12;
+        assert.equal(bfg.b, 12);
+        assert.equal(bfg.e, 42);
+        assert.equal(bfg.inner.g, 1.5);
+        assert.equal(bfg.d, null);
+        assert.throws(() => { bfg.d = 'foo'; }, { name: 'TypeError' });
+
+        assert.throws(() => packs.at(4), { name: 'RangeError' });
+        assert.throws(() => packs.get(-1), { name: 'RangeError' });
+        assert.throws(() => koffi.records('int', 4), { name: 'TypeError' });
+        assert.throws(() => koffi.records(Pack3, 'foo'), { name: 'TypeError' });
+        assert.throws(() => koffi.records(Pack3, new Uint8Array(64).subarray(2)), { name: 'Error' });
+        assert.throws(() => SumPack3s(koffi.records(Pack2, 2), 2), { name: 'TypeError' });
+    }
+
+    // Lazy struct values
+    {
+        let q = RetLazyPack3(6, 9, -12);
+        assert.equal(q.b, 9);
+        assert.deepEqual(q.toJSON(), { a: 6, b: 9, c: -12 });
+        assert.equal(JSON.stringify(q), '{"a":6,"b":9,"c":-12}');
+        q.a = 1;
+        assert.equal(q.a, 1);
+        AddPack3(1, 2, 3, q);
+        assert.deepEqual(q.toJSON(), { a: 2, b: 11, c: -9 });
+
+        let d3p = {};
+        let d3 = PackLazyDouble3(0.5, 10.0, 5.0, d3p);
+        assert.equal(d3.s.c, 5.0);
+        d3.s.b = 2;
+        assert.deepEqual(d3.toJSON(), { a: 0.5, s: { b: 2, c: 5 } });
+        assert.deepEqual(d3p, { a: 0.5, s: { b: 10, c: 5 } });
+
+        let ic = LazyArrayToStruct([5, 7, 8], 3);
+        assert.equal(ic.len, 3);
+        assert.deepEqual(ic.values, Int32Array.from([5, 7, 8, ...Array(13).fill(0)]));
+
+        assert.throws(() => koffi.lazy(BFG), { name: 'TypeError' });
+        assert.throws(() => koffi.lazy('int'), { name: 'TypeError' });
+        assert.throws(() => koffi.lazy(koffi.lazy(Pack3)), { name: 'TypeError' });
+    }
+
     // Test struct strings
     {
         assert.equal(ThroughStr({ str: 'Hello', str16: null }), 'Hello');
@@ -392,4 +612,165 @@ async function test() {
         assert.equal(ThroughStr16({ str: null, str16: 'World!' }), 'World!');
         assert.equal(ThroughStr16({ str: 'World!', str16: null }), null);
     }
+
+    // Batched calls
+    {
+        assert.deepEqual(ThroughUInt32UU.batch([[1], [2], [0xFFFFFFFF]]), [1, 2, 0xFFFFFFFF]);
+        assert.deepEqual(RetPack2.batch([[1, 2], [3, 4]]), [{ a: 1, b: 2 }, { a: 3, b: 4 }]);
+        assert.deepEqual(ConcatenateToInt1.batch([]), []);
+
+        let results = new Uint32Array(4);
+        assert.equal(ThroughUInt32UU.batch([[5], [6], [7]], results), results);
+        assert.deepEqual(results, new Uint32Array([5, 6, 7, 0]));
+
+        let out = {};
+        assert.deepEqual(PackFloat2.batch([[1, 2, out], [3, 4, out]]), [{ a: 1, b: 2 }, { a: 3, b: 4 }]);
+        assert.deepEqual(out, { a: 3, b: 4 });
+
+        let values = new Uint32Array([8, 9, 10]);
+        assert.deepEqual(ThroughUInt32UU.batch({ v: values }), [8, 9, 10]);
+        assert.deepEqual(RetPack2.batch({ 0: new Int32Array([1, 2]), 1: 7 }), [{ a: 1, b: 7 }, { a: 2, b: 7 }]);
+        assert.deepEqual(PackFloat2.batch({ out: {}, b: new Float32Array([1, 2]), a: 5 }), [{ a: 5, b: 1 }, { a: 5, b: 2 }]);
+        assert.deepEqual(PackFloat2.batch({ 2: {}, b: new Float32Array([3]), 0: 4 }), [{ a: 4, b: 3 }]);
+
+        assert.throws(() => ThroughUInt32UU.batch([[1], 2]), { name: 'TypeError' });
+        assert.throws(() => RetPack2.batch({ 0: 1, 1: 2 }), { name: 'TypeError' });
+        assert.throws(() => RetPack2.batch({ 0: new Int32Array(2), 1: new Int32Array(3) }), { name: 'Error' });
+        assert.throws(() => RetPack2.batch({ a: new Int32Array(2), b: 1 }), /Unknown batch column 'a'/);
+        assert.throws(() => PackFloat2.batch({ a: new Float32Array(1), 0: 1, out: {} }), /Duplicate batch column for parameter 1/);
+        assert.throws(() => PackFloat2.batch({ a: new Float32Array(1), b: 1 }), { name: 'TypeError' });
+        assert.throws(() => RetPack2.batch([[1, 2], [3]]), { name: 'TypeError' });
+        assert.throws(() => ThroughUInt32UU.batch([[1]], new Int32Array(1)), { name: 'TypeError' });
+        assert.throws(() => ThroughUInt32UU.batch([[1], [2]], new Uint32Array(1)), { name: 'Error' });
+    }
+
+    // Direct memory access
+    {
+        let ptr = GetStaticPack3(1, 2, 3);
+        assert.deepEqual(koffi.decode(ptr, 0, Pack3), { a: 1, b: 2, c: 3 });
+        assert.equal(koffi.decode(ptr, 4, 'int'), 2);
+        assert.deepEqual(koffi.decode(ptr, 0, 'int', 3), new Int32Array([1, 2, 3]));
+
+        koffi.encode(ptr, 0, Pack2, { a: 7, b: 8 });
+        koffi.encode(ptr, 8, 'int', -4);
+        assert.deepEqual(koffi.decode(ptr, 0, Pack3), { a: 7, b: 8, c: -4 });
+
+        let buf = new ArrayBuffer(32);
+        koffi.encode(buf, 0, Float3, { a: 1.5, b: [2, 3] });
+        koffi.encode(buf, 12, koffi.array('int', 2), new Int32Array([6, 9]));
+        koffi.encode(buf, 24, 'int64_t', 42n);
+        assert.deepEqual(koffi.decode(buf, 0, 'float', 3), new Float32Array([1.5, 2, 3]));
+        assert.deepEqual(koffi.decode(buf, 8, Pack2, 2), [{ a: 0x40400000, b: 6 }, { a: 9, b: 0 }]);
+        assert.equal(koffi.decode(new Uint8Array(buf, 16), 8, 'int64_t'), 42n);
+
+        assert.throws(() => koffi.decode(buf, 28, 'int64_t'), { name: 'Error' });
+        assert.throws(() => koffi.encode(buf, -1, 'int', 1), { name: 'Error' });
+        assert.throws(() => koffi.encode(buf, 0, StrStruct, { str: 'Hello', str16: null }), { name: 'TypeError' });
+        assert.throws(() => koffi.decode(buf, 0, 'void'), { name: 'TypeError' });
+    }
+
+    // External memory views
+    {
+        let ptr = GetStaticPack3(4, 5, 6);
+        let view = new Int32Array(koffi.view(ptr, 12));
+        let view2 = new Int32Array(koffi.view(ptr, 8));
+
+        assert.deepEqual(view, new Int32Array([4, 5, 6]));
+        view2[1] = 42;
+        assert.deepEqual(koffi.decode(ptr, 0, Pack3), { a: 4, b: 42, c: 6 });
+
+        let disposed = 0;
+        let NoopPtr = koffi.disposable(koffi.pointer('void'), ptr => { disposed++; });
+        assert.equal(koffi.view(ptr, 12, NoopPtr).byteLength, 12);
+        assert.equal(disposed, 0);
+
+        // The disposable must run exactly once, after the view has been collected
+        {
+            v8.setFlagsFromString('--expose-gc');
+            let gc = vm.runInNewContext('gc');
+
+            for (let i = 0; i < 20 && !disposed; i++) {
+                gc();
+                await new Promise(resolve => setImmediate(resolve));
+            }
+            assert.equal(disposed, 1);
+
+            gc();
+            await new Promise(resolve => setImmediate(resolve));
+            assert.equal(disposed, 1);
+        }
+
+        assert.throws(() => koffi.view(ptr, 12, 'int *'), { name: 'TypeError' });
+        assert.throws(() => koffi.view(null, 12), { name: 'TypeError' });
+        assert.throws(() => koffi.view(ptr, -1), { name: 'Error' });
+    }
+
+    // Simple functions are called through stubs, with a fallback to the generic path
+    {
+        let ptr = GetStaticPack3(1, 2, 3);
+
+        assert.equal(ThroughUInt32UU(4294967295), 4294967295);
+        assert.equal(ThroughUInt32UU(-1), 4294967295);
+        assert.equal(ScalePack3(ptr, 1.5), 9);
+        assert.equal(ScalePack3(null, 1.5), -1);
+
+        // Values the stubs do not handle
+        assert.equal(ThroughUInt32UU(42n), 42);
+        assert.equal(ScalePack3({ a: 4, b: 5, c: 6 }, 2), 30);
+        assert.throws(() => ScalePack3(ptr, 'foo'), { name: 'TypeError' });
+
+        // Registered callbacks need the generic path
+        let cb = koffi.register(x => -x, koffi.pointer(IntCallback));
+        try {
+            SetCallback(cb);
+            for (let i = 0; i < 4; i++)
+                assert.equal(CallCallback(27 + i), -27 - i);
+        } finally {
+            koffi.unregister(cb);
+        }
+        assert.equal(ThroughUInt32UU(7), 7);
+    }
+
+    // Call tracing
+    {
+        let filename = path.join(os.tmpdir(), `koffi_trace_${process.pid}.bin`);
+
+        try {
+            koffi.trace(filename);
+            assert.throws(() => koffi.trace(filename), { name: 'Error' });
+
+            for (let i = 0; i < 10; i++)
+                assert.equal(ThroughUInt32UU(i), i);
+            assert.throws(() => ThroughUInt32UU('foo'), { name: 'TypeError' });
+
+            koffi.trace(null);
+
+            let buf = fs.readFileSync(filename);
+            assert.equal(buf.toString('latin1', 0, 8), 'KOFFITRC');
+            assert.equal(buf.length, 16 + 12 * 64); // One name record, 11 calls
+
+            let last = 16 + 11 * 64;
+            assert.equal(buf.readUInt8(16), 0);
+            assert.equal(buf.toString('utf8', 32, 32 + 'ThroughUInt32UU'.length), 'ThroughUInt32UU');
+            assert.equal(buf.readUInt8(last), 1);
+            assert.equal(buf.readUInt8(last + 1), 1);
+            assert.equal(buf.readDoubleLE(16 + 10 * 64 + 40), 9);
+        } finally {
+            koffi.trace(null);
+            fs.rmSync(filename, { force: true });
+        }
+    }
+
+    // Prototype introspection, as used by tools/bindgen.js
+    {
+        let proto = koffi.callback('IntrospectProto', 'Pack3', ['int', koffi.out(koffi.pointer(Pack3)), 'str']);
+        let defn = koffi.introspect(proto);
+
+        assert.equal(defn.primitive, 'Prototype');
+        assert.equal(defn.convention, 'Cdecl');
+        assert.equal(koffi.introspect(defn.result).name, 'Pack3');
+        assert.deepEqual(defn.parameters.map(param => param.direction), ['in', 'out', 'in']);
+        assert.equal(koffi.introspect(defn.parameters[1].type).primitive, 'Pointer');
+        assert.equal(koffi.introspect(defn.parameters[2].type).primitive, 'String');
+    }
 }
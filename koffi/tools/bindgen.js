@@ -0,0 +1,726 @@
+#!/usr/bin/env node
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+'use strict';
+
+// Generates the C++ source of a dedicated N-API addon (and a CMakeLists.txt
+// file to build it with CNoke) from Koffi declarations. The declarations are
+// parsed by Koffi itself and read back with koffi.introspect(), so the
+// generated addon and the dynamic binding cannot disagree.
+
+const fs = require('fs');
+const path = require('path');
+const process = require('process');
+
+const Primitives = {
+    Void: { ctype: 'void' },
+    Bool: { ctype: 'bool', expect: 'boolean', get: 'GetBoolean', make: v => `Napi::Boolean::New(env, ${v})` },
+    Int8: { ctype: 'int8_t', expect: 'number', get: 'GetInteger', make: v => `Napi::Number::New(env, (double)${v})` },
+    UInt8: { ctype: 'uint8_t', expect: 'number', get: 'GetInteger', make: v => `Napi::Number::New(env, (double)${v})` },
+    Int16: { ctype: 'int16_t', expect: 'number', get: 'GetInteger', make: v => `Napi::Number::New(env, (double)${v})` },
+    UInt16: { ctype: 'uint16_t', expect: 'number', get: 'GetInteger', make: v => `Napi::Number::New(env, (double)${v})` },
+    Int32: { ctype: 'int32_t', expect: 'number', get: 'GetInteger', make: v => `Napi::Number::New(env, (double)${v})` },
+    UInt32: { ctype: 'uint32_t', expect: 'number', get: 'GetInteger', make: v => `Napi::Number::New(env, (double)${v})` },
+    Int64: { ctype: 'int64_t', expect: 'number', get: 'GetInteger', make: v => `NewBigInt(env, ${v})` },
+    UInt64: { ctype: 'uint64_t', expect: 'number', get: 'GetInteger', make: v => `NewBigInt(env, ${v})` },
+    Float32: { ctype: 'float', expect: 'number', get: 'GetFloat', make: v => `Napi::Number::New(env, (double)${v})` },
+    Float64: { ctype: 'double', expect: 'number', get: 'GetFloat', make: v => `Napi::Number::New(env, ${v})` },
+    String: { ctype: 'const char *', expect: 'string', make: v => `NewString(env, ${v})` },
+    Pointer: { ctype: 'void *', expect: 'pointer', get: 'GetPointer', make: v => `NewPointer(env, ${v})` }
+};
+
+const Preamble = `
+#include <napi.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include <string>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <dlfcn.h>
+#endif
+
+#if defined(_WIN32) && !defined(_WIN64)
+    #define KOFFI_CDECL __cdecl
+    #define KOFFI_STDCALL __stdcall
+    #define KOFFI_FASTCALL __fastcall
+    #define KOFFI_THISCALL __thiscall
+#else
+    #define KOFFI_CDECL
+    #define KOFFI_STDCALL
+    #define KOFFI_FASTCALL
+    #define KOFFI_THISCALL
+#endif
+
+namespace {
+
+template <typename T, typename... Args>
+void ThrowError(Napi::Env env, const char *msg, Args... args)
+{
+    char buf[1024];
+    snprintf(buf, sizeof(buf), msg, args...);
+
+    auto err = T::New(env, buf);
+    err.ThrowAsJavaScriptException();
+}
+
+// Each binding only uses some of the helpers below, hence [[maybe_unused]]
+
+[[maybe_unused]] static const char *GetValueType(Napi::Value value)
+{
+    switch (value.Type()) {
+        case napi_undefined: return "Undefined";
+        case napi_null: return "Null";
+        case napi_boolean: return "Boolean";
+        case napi_number: return "Number";
+        case napi_string: return "String";
+        case napi_symbol: return "Symbol";
+        case napi_object: return value.IsArray() ? "Array" : "Object";
+        case napi_function: return "Function";
+        case napi_external: return "External";
+        case napi_bigint: return "BigInt";
+    }
+
+    return "Unknown";
+}
+
+[[maybe_unused]] static inline bool IsObject(Napi::Value value)
+{
+    return value.IsObject() && !value.IsArray();
+}
+
+[[maybe_unused]] static inline bool GetBoolean(Napi::Value value, bool *out)
+{
+    if (!value.IsBoolean())
+        return false;
+
+    *out = value.As<Napi::Boolean>();
+    return true;
+}
+
+template <typename T>
+[[maybe_unused]] static inline bool GetInteger(Napi::Value value, T *out)
+{
+    if (value.IsNumber()) {
+        *out = (T)value.As<Napi::Number>().Int64Value();
+        return true;
+    } else if (value.IsBigInt()) {
+        bool lossless;
+        *out = (T)value.As<Napi::BigInt>().Int64Value(&lossless);
+        return true;
+    }
+
+    return false;
+}
+
+template <typename T>
+[[maybe_unused]] static inline bool GetFloat(Napi::Value value, T *out)
+{
+    if (value.IsNumber()) {
+        *out = (T)value.As<Napi::Number>().DoubleValue();
+        return true;
+    } else if (value.IsBigInt()) {
+        bool lossless;
+        *out = (T)value.As<Napi::BigInt>().Int64Value(&lossless);
+        return true;
+    }
+
+    return false;
+}
+
+// TypedArray values (such as Buffer) give their own memory to C code, without any copy
+[[maybe_unused]] static inline bool GetPointer(Napi::Value value, void **out, size_t min_size = 0)
+{
+    if (value.IsExternal()) {
+        *out = value.As<Napi::External<void>>().Data();
+        return true;
+    } else if (value.IsNull() || value.IsUndefined()) {
+        *out = nullptr;
+        return true;
+    } else if (value.IsTypedArray()) {
+        Napi::TypedArray array = value.As<Napi::TypedArray>();
+
+        if (array.ByteLength() < min_size)
+            return false;
+
+        *out = (uint8_t *)array.ArrayBuffer().Data() + array.ByteOffset();
+        return true;
+    }
+
+    return false;
+}
+
+// Short strings are converted on the stack
+struct StringValue {
+    char buf[256];
+    std::unique_ptr<char[]> heap;
+    const char *ptr = nullptr;
+};
+
+[[maybe_unused]] static bool GetString(Napi::Value value, StringValue *out)
+{
+    if (value.IsString()) {
+        napi_env env = value.Env();
+
+        size_t len = 0;
+        napi_get_value_string_utf8(env, value, out->buf, sizeof(out->buf), &len);
+
+        // The string may have been truncated, measure it and use the heap
+        if (len >= sizeof(out->buf) - 1) {
+            napi_get_value_string_utf8(env, value, nullptr, 0, &len);
+
+            out->heap.reset(new char[len + 1]);
+            napi_get_value_string_utf8(env, value, out->heap.get(), len + 1, &len);
+
+            out->ptr = out->heap.get();
+        } else {
+            out->ptr = out->buf;
+        }
+
+        return true;
+    } else if (value.IsNull() || value.IsUndefined()) {
+        out->ptr = nullptr;
+        return true;
+    }
+
+    return false;
+}
+
+[[maybe_unused]] static inline Napi::Value NewBigInt(Napi::Env env, int64_t value)
+{
+    if (value <= 9007199254740992ll && value >= -9007199254740992ll) {
+        return Napi::Number::New(env, (double)value);
+    } else {
+        return Napi::BigInt::New(env, value);
+    }
+}
+
+[[maybe_unused]] static inline Napi::Value NewBigInt(Napi::Env env, uint64_t value)
+{
+    if (value <= 9007199254740992ull) {
+        return Napi::Number::New(env, (double)value);
+    } else {
+        return Napi::BigInt::New(env, value);
+    }
+}
+
+// Pure ASCII strings (the vast majority) skip the UTF-8 decoder
+[[maybe_unused]] static Napi::Value NewString(Napi::Env env, const char *str)
+{
+    if (!str)
+        return env.Null();
+
+    size_t len = 0;
+    bool ascii = true;
+    for (; str[len]; len++) {
+        ascii &= !((uint8_t)str[len] & 0x80);
+    }
+
+    napi_value value;
+    if (ascii) {
+        napi_create_string_latin1(env, str, len, &value);
+    } else {
+        napi_create_string_utf8(env, str, len, &value);
+    }
+
+    return Napi::Value(env, value);
+}
+
+[[maybe_unused]] static inline Napi::Value NewPointer(Napi::Env env, const void *ptr)
+{
+    return ptr ? (Napi::Value)Napi::External<void>::New(env, (void *)ptr) : env.Null();
+}
+
+// Libraries are never unloaded, same as Koffi
+
+static void *OpenLibrary(const char *filename)
+{
+#ifdef _WIN32
+    if (!filename)
+        return GetModuleHandle(nullptr);
+
+    int len = MultiByteToWideChar(CP_UTF8, 0, filename, -1, nullptr, 0);
+    std::unique_ptr<wchar_t[]> filename_w(new wchar_t[len]);
+    MultiByteToWideChar(CP_UTF8, 0, filename, -1, filename_w.get(), len);
+
+    return LoadLibraryW(filename_w.get());
+#else
+    return dlopen(filename, RTLD_NOW);
+#endif
+}
+
+static void *FindSymbol(void *module, const char *name)
+{
+#ifdef _WIN32
+    return (void *)GetProcAddress((HMODULE)module, name);
+#else
+    return dlsym(module, name);
+#endif
+}
+`;
+
+// Tests use generate() with their own build of Koffi
+if (require.main === module) {
+    main();
+} else {
+    module.exports = { generate };
+}
+
+function main() {
+    let args = process.argv.slice(2);
+
+    if (args.length < 2 || args.includes('--help')) {
+        console.log(`Usage: bindgen.js <declarations.js> <output_dir> [name]`);
+        process.exit(args.length < 2 ? 1 : 0);
+    }
+
+    try {
+        let koffi = require('../src/index.js');
+        generate(koffi, args[0], args[1], args[2]);
+    } catch (err) {
+        console.error(err.message);
+        process.exit(1);
+    }
+}
+
+function generate(koffi, decl_filename, dest_dir, name = null) {
+    decl_filename = path.resolve(decl_filename);
+    dest_dir = path.resolve(dest_dir);
+    name = name ?? path.basename(decl_filename).replace(/\..*$/, '');
+
+    if (!name.match(/^[A-Za-z_][A-Za-z0-9_]*$/))
+        throw new Error(`Addon name '${name}' is not a valid identifier`);
+
+    let decls = require(decl_filename);
+    if (typeof decls == 'function')
+        decls = decls(koffi);
+    if (!Array.isArray(decls))
+        throw new Error('Declarations module must export an array of prototypes, or a function returning one');
+
+    let gen = new Generator(koffi);
+    for (let proto of decls)
+        gen.addFunction(proto);
+
+    fs.mkdirSync(dest_dir, { recursive: true });
+    fs.writeFileSync(dest_dir + `/${name}.cc`, gen.emitSource(path.basename(decl_filename)));
+    fs.writeFileSync(dest_dir + '/CMakeLists.txt', emitCMake(name, dest_dir));
+}
+
+function Generator(koffi) {
+    let records = new Map;
+    let functions = [];
+
+    this.addFunction = function(proto) {
+        let type = (typeof proto == 'string') ? koffi.callback(proto) : proto;
+        let defn = koffi.introspect(type);
+
+        if (defn.primitive != 'Prototype')
+            throw new Error(`Expected function prototype, got ${defn.name}`);
+        if (functions.some(func => func.name == defn.name))
+            throw new Error(`Duplicate function '${defn.name}'`);
+
+        let func = {
+            name: defn.name,
+            ident: uniqueIdentifier(defn.name, functions.map(func => func.ident)),
+            convention: defn.convention,
+            result: resolve(defn.result, `result of ${defn.name}`),
+            parameters: defn.parameters.map((param, idx) => {
+                let where = `parameter ${idx + 1} of ${defn.name}`;
+                let type = resolve(param.type, where);
+
+                if (type.primitive == 'Void')
+                    throw new Error(`Type void cannot be used for ${where}`);
+                if (param.direction == 'pinned')
+                    throw new Error(`Pinned pointers are not supported (${where})`);
+                if (param.direction != 'in' && type.record == null)
+                    throw new Error(`Output parameters must be struct pointers (${where})`);
+
+                return { type: type, direction: param.direction };
+            })
+        };
+
+        functions.push(func);
+    };
+
+    function resolve(ref, where, opaque = false) {
+        let defn = koffi.introspect(ref);
+        let type = { name: defn.name, primitive: defn.primitive };
+
+        switch (defn.primitive) {
+            case 'Record': {
+                type.record = addRecord(defn, where);
+                type.ctype = type.record.ctype;
+            } break;
+
+            case 'Pointer': {
+                let pointee = koffi.introspect(defn.ref);
+
+                if (pointee.primitive == 'Record' && !opaque) {
+                    type.record = addRecord(pointee, where);
+                    type.ctype = type.record.ctype + ' *';
+                } else {
+                    type.ctype = 'void *';
+                }
+            } break;
+
+            default: {
+                if (Primitives[defn.primitive] == null)
+                    throw new Error(`Type ${defn.name} (${defn.primitive}) is not supported (${where})`);
+
+                type.ctype = Primitives[defn.primitive].ctype;
+            } break;
+        }
+
+        return type;
+    }
+
+    function addRecord(defn, where) {
+        let record = records.get(defn.name);
+
+        if (record == null) {
+            record = {
+                name: defn.name,
+                ctype: 'Record_' + uniqueIdentifier(defn.name, Array.from(records.values(), record => record.ctype.substr(7))),
+                size: defn.size,
+                alignment: defn.alignment,
+                members: []
+            };
+
+            // Members come first, so that records are emitted in dependency order.
+            // Pointer members are opaque, which also takes care of recursive types.
+            for (let member in defn.members) {
+                let type = resolve(defn.members[member], `member '${member}' of ${defn.name}`, true);
+
+                if (type.primitive == 'String')
+                    throw new Error(`String members are not supported (member '${member}' of ${defn.name})`);
+
+                // JS names may not be valid (or may be reserved) C++ identifiers
+                record.members.push({ name: member, field: 'm_' + record.members.length, type: type });
+            }
+
+            records.set(defn.name, record);
+        }
+
+        return record;
+    }
+
+    this.emitSource = function(origin) {
+        let out = [];
+
+        out.push(`// Generated by Koffi (tools/bindgen.js) from ${comment(origin)}, do not edit`);
+        out.push('');
+        out.push(Preamble.trim());
+        out.push('');
+
+        for (let record of records.values())
+            emitRecord(out, record);
+        for (let func of functions)
+            emitFunction(out, func);
+
+        emitLoader(out);
+
+        return out.join('\n') + '\n';
+    };
+
+    function emitRecord(out, record) {
+        let ctype = record.ctype;
+
+        if (record.alignment == 1)
+            out.push('#pragma pack(push, 1)');
+        out.push(`struct ${ctype} {`);
+        for (let member of record.members)
+            out.push(`    ${declare(member.type.ctype, member.field)}; // ${comment(member.name)}`);
+        out.push('};');
+        if (record.alignment == 1)
+            out.push('#pragma pack(pop)');
+        out.push(`static_assert(sizeof(${ctype}) == ${record.size} && alignof(${ctype}) == ${record.alignment}, ${literal(`Layout of ${record.name} does not match`)});`);
+        out.push('');
+
+        out.push(`[[maybe_unused]] static bool Push${ctype}(Napi::Env env, Napi::Object obj, ${ctype} *out)`);
+        out.push('{');
+        for (let member of record.members) {
+            let dest = `out->${member.field}`;
+            let what = literal(`Unexpected %s value for member '${escapeFormat(member.name)}', expected %s`);
+
+            out.push('    {');
+            out.push(`        Napi::Value value = obj.Get(${literal(member.name)});`);
+            out.push('');
+            out.push('        if (value.IsUndefined()) {');
+            out.push(`            ThrowError<Napi::TypeError>(env, ${literal(`Missing expected object property '${escapeFormat(member.name)}'`)});`);
+            out.push('            return false;');
+            out.push('        }');
+
+            if (member.type.primitive == 'Record') {
+                out.push('        if (!IsObject(value)) {');
+                out.push(`            ThrowError<Napi::TypeError>(env, ${what}, GetValueType(value), "object");`);
+                out.push('            return false;');
+                out.push('        }');
+                out.push(`        if (!Push${member.type.record.ctype}(env, value.As<Napi::Object>(), &${dest}))`);
+                out.push('            return false;');
+            } else {
+                let prim = Primitives[member.type.primitive];
+
+                out.push(`        if (!${prim.get}(value, &${dest})) {`);
+                out.push(`            ThrowError<Napi::TypeError>(env, ${what}, GetValueType(value), "${prim.expect}");`);
+                out.push('            return false;');
+                out.push('        }');
+            }
+            out.push('    }');
+        }
+        out.push('');
+        out.push('    return true;');
+        out.push('}');
+        out.push('');
+
+        out.push(`[[maybe_unused]] static void Decode${ctype}(Napi::Env env, const ${ctype} &src, Napi::Object obj)`);
+        out.push('{');
+        for (let member of record.members) {
+            let value = makeValue(member.type, `src.${member.field}`);
+            out.push(`    obj.Set(${literal(member.name)}, ${value});`);
+        }
+        out.push('}');
+        out.push('');
+    }
+
+    function emitFunction(out, func) {
+        let params = func.parameters;
+        let ret = func.result;
+
+        let signature = params.map((param, idx) => declare(param.type.ctype, `a${idx}`)).join(', ') || 'void';
+        out.push(`typedef ${declare(ret.ctype, `(KOFFI_${func.convention.toUpperCase()} *Func_${func.ident})`)}(${signature});`);
+        out.push('');
+
+        out.push(`static Napi::Value Call_${func.ident}(const Napi::CallbackInfo &info)`);
+        out.push('{');
+        out.push('    Napi::Env env = info.Env();');
+        out.push(`    Func_${func.ident} func = (Func_${func.ident})info.Data();`);
+        out.push('');
+
+        let args = params.map((param, idx) => `a${idx}`);
+        let writebacks = [];
+
+        if (params.length) {
+            out.push(`    if (info.Length() < ${params.length}) {`);
+            out.push(`        ThrowError<Napi::TypeError>(env, "Expected ${params.length} arguments, got %d", (int)info.Length());`);
+            out.push('        return env.Null();');
+            out.push('    }');
+            out.push('');
+        }
+
+        params.forEach((param, idx) => {
+            let type = param.type;
+            let what = `"Unexpected %s value for argument ${idx + 1}, expected %s"`;
+
+            out.push(`    // Argument ${idx + 1}: ${comment(type.name)}`);
+
+            if (type.primitive == 'Record') {
+                out.push(`    ${type.ctype} a${idx};`);
+                out.push(`    if (!IsObject(info[${idx}])) {`);
+                out.push(`        ThrowError<Napi::TypeError>(env, ${what}, GetValueType(info[${idx}]), "object");`);
+                out.push('        return env.Null();');
+                out.push('    }');
+                out.push(`    if (!Push${type.ctype}(env, info[${idx}].As<Napi::Object>(), &a${idx}))`);
+                out.push('        return env.Null();');
+            } else if (type.primitive == 'Pointer' && type.record != null) {
+                let ctype = type.record.ctype;
+
+                // Objects are copied to (and back from) a temporary struct, like Koffi does
+                out.push(`    ${ctype} t${idx};`);
+                out.push(`    ${ctype} *a${idx};`);
+                out.push(`    if (!GetPointer(info[${idx}], (void **)&a${idx}, sizeof(${ctype}))) {`);
+                out.push(`        if (!IsObject(info[${idx}]) || info[${idx}].IsTypedArray()) {`);
+                out.push(`            ThrowError<Napi::TypeError>(env, ${what}, GetValueType(info[${idx}]), "${ctype.replace(/^Record_/, '')} pointer");`);
+                out.push('            return env.Null();');
+                out.push('        }');
+                if (param.direction == 'out') {
+                    out.push(`        memset(&t${idx}, 0, sizeof(t${idx}));`);
+                } else {
+                    out.push(`        if (!Push${ctype}(env, info[${idx}].As<Napi::Object>(), &t${idx}))`);
+                    out.push('            return env.Null();');
+                }
+                out.push(`        a${idx} = &t${idx};`);
+                out.push('    }');
+
+                if (param.direction != 'in')
+                    writebacks.push(`    if (a${idx} == &t${idx}) {\n        Decode${ctype}(env, t${idx}, info[${idx}].As<Napi::Object>());\n    }`);
+            } else if (type.primitive == 'String') {
+                out.push(`    StringValue a${idx};`);
+                out.push(`    if (!GetString(info[${idx}], &a${idx})) {`);
+                out.push(`        ThrowError<Napi::TypeError>(env, ${what}, GetValueType(info[${idx}]), "string");`);
+                out.push('        return env.Null();');
+                out.push('    }');
+
+                args[idx] = `a${idx}.ptr`;
+            } else {
+                let prim = Primitives[type.primitive];
+
+                out.push(`    ${declare(type.ctype, `a${idx}`)};`);
+                out.push(`    if (!${prim.get}(info[${idx}], &a${idx})) {`);
+                out.push(`        ThrowError<Napi::TypeError>(env, ${what}, GetValueType(info[${idx}]), "${prim.expect}");`);
+                out.push('        return env.Null();');
+                out.push('    }');
+            }
+            out.push('');
+        });
+
+        if (ret.primitive == 'Void') {
+            out.push(`    func(${args.join(', ')});`);
+        } else {
+            out.push(`    ${declare(ret.ctype, 'ret')} = func(${args.join(', ')});`);
+        }
+        if (writebacks.length) {
+            out.push('');
+            out.push(...writebacks);
+        }
+        out.push('');
+
+        if (ret.primitive == 'Void') {
+            out.push('    return env.Undefined();');
+        } else if (ret.primitive == 'Record') {
+            out.push('    Napi::Object obj = Napi::Object::New(env);');
+            out.push(`    Decode${ret.ctype}(env, ret, obj);`);
+            out.push('    return obj;');
+        } else {
+            out.push(`    return ${makeValue(ret, 'ret')};`);
+        }
+        out.push('}');
+        out.push('');
+    }
+
+    function emitLoader(out) {
+        out.push('static Napi::Value Load(const Napi::CallbackInfo &info)');
+        out.push('{');
+        out.push('    Napi::Env env = info.Env();');
+        out.push('');
+        out.push('    void *module;');
+        out.push('    if (info.Length() >= 1 && info[0].IsString()) {');
+        out.push('        std::string filename = info[0].As<Napi::String>();');
+        out.push('        module = OpenLibrary(filename.c_str());');
+        out.push('    } else if (info.Length() < 1 || info[0].IsNull() || info[0].IsUndefined()) {');
+        out.push('        module = OpenLibrary(nullptr);');
+        out.push('    } else {');
+        out.push('        ThrowError<Napi::TypeError>(env, "Unexpected %s value for filename, expected string or null", GetValueType(info[0]));');
+        out.push('        return env.Null();');
+        out.push('    }');
+        out.push('    if (!module) {');
+        out.push('        ThrowError<Napi::Error>(env, "Failed to load shared library");');
+        out.push('        return env.Null();');
+        out.push('    }');
+        out.push('');
+        out.push('    Napi::Object lib = Napi::Object::New(env);');
+        out.push('');
+        for (let func of functions) {
+            out.push('    {');
+            out.push(`        void *ptr = FindSymbol(module, ${literal(func.name)});`);
+            out.push('        if (!ptr) {');
+            out.push(`            ThrowError<Napi::Error>(env, "Cannot find function '%s' in shared library", ${literal(func.name)});`);
+            out.push('            return env.Null();');
+            out.push('        }');
+            out.push(`        lib.Set(${literal(func.name)}, Napi::Function::New(env, Call_${func.ident}, ${literal(func.name)}, ptr));`);
+            out.push('    }');
+        }
+        out.push('');
+        out.push('    return lib;');
+        out.push('}');
+        out.push('');
+        out.push('}');
+        out.push('');
+        out.push('static Napi::Object InitModule(Napi::Env env, Napi::Object exports)');
+        out.push('{');
+        out.push('    exports.Set("load", Napi::Function::New(env, Load, "load"));');
+        out.push('    return exports;');
+        out.push('}');
+        out.push('');
+        out.push('NODE_API_MODULE(koffi_bindgen, InitModule);');
+    }
+
+    function makeValue(type, expr) {
+        if (type.primitive == 'Record') {
+            return `([&]() { Napi::Object obj = Napi::Object::New(env); Decode${type.ctype}(env, ${expr}, obj); return obj; })()`;
+        } else {
+            return Primitives[type.primitive].make(expr);
+        }
+    }
+}
+
+function declare(ctype, name) {
+    return ctype.endsWith('*') ? ctype + name : ctype + ' ' + name;
+}
+
+function uniqueIdentifier(name, used) {
+    let ident = name.replace(/[^A-Za-z0-9_]/g, '_');
+
+    for (let i = 2; used.includes(ident); i++)
+        ident = name.replace(/[^A-Za-z0-9_]/g, '_') + '_' + i;
+
+    return ident;
+}
+
+// Non-ASCII characters are given as UTF-8 bytes
+function literal(str) {
+    let out = '"';
+
+    for (let c of Buffer.from(str, 'utf8')) {
+        if (c == 0x22 || c == 0x5C) {
+            out += '\\' + String.fromCharCode(c);
+        } else if (c >= 0x20 && c < 0x7F) {
+            out += String.fromCharCode(c);
+        } else {
+            out += '\\' + c.toString(8).padStart(3, '0');
+        }
+    }
+
+    return out + '"';
+}
+
+function escapeFormat(str) {
+    return str.replace(/%/g, '%%');
+}
+
+// Backslashes could continue line comments
+function comment(str) {
+    return str.replace(/[\x00-\x1F\x7F\\]/g, ' ');
+}
+
+function emitCMake(name, dest_dir) {
+    let koffi_dir = path.relative(dest_dir, path.dirname(__dirname)).replace(/\\/g, '/') || '.';
+
+    return `# Generated by Koffi (tools/bindgen.js), do not edit
+
+cmake_minimum_required(VERSION 3.12)
+project(${name} CXX)
+
+find_package(CNoke)
+
+set(CMAKE_CXX_STANDARD 17)
+
+add_node_addon(NAME ${name} SOURCES ${name}.cc)
+target_include_directories(${name} PRIVATE \${CMAKE_CURRENT_SOURCE_DIR}/${koffi_dir}/vendor/node-addon-api)
+target_compile_definitions(${name} PRIVATE NAPI_DISABLE_CPP_EXCEPTIONS NAPI_VERSION=8)
+
+if(NOT WIN32)
+    target_link_libraries(${name} PRIVATE dl)
+endif()
+`;
+}
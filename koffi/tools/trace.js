@@ -0,0 +1,150 @@
+#!/usr/bin/env node
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program. If not, see https://www.gnu.org/licenses/.
+
+'use strict';
+
+// Converts binary traces made with koffi.trace() to the Chrome trace event
+// format (JSON), which can be opened in Perfetto or chrome://tracing.
+
+const fs = require('fs');
+const process = require('process');
+
+const TRACE_MAGIC = 'KOFFITRC';
+const TRACE_VERSION = 1;
+
+const TraceKind = {
+    Name: 0,
+    Call: 1,
+    AsyncCall: 2,
+    Dropped: 3
+};
+
+main();
+
+function main() {
+    let args = process.argv.slice(2);
+
+    if (args.length < 1 || args.includes('--help')) {
+        console.log(`Usage: trace.js <trace_file> [output.json]`);
+        process.exit(args.length < 1);
+    }
+
+    try {
+        let buf = fs.readFileSync(args[0]);
+        let json = JSON.stringify(convertTrace(buf));
+
+        if (args.length >= 2) {
+            fs.writeFileSync(args[1], json);
+        } else {
+            process.stdout.write(json + '\n');
+        }
+    } catch (err) {
+        console.error(err.message);
+        process.exit(1);
+    }
+}
+
+function convertTrace(buf) {
+    if (buf.length < 16 || buf.toString('latin1', 0, 8) != TRACE_MAGIC)
+        throw new Error('Not a Koffi trace file');
+
+    let version = buf.readUInt32LE(8);
+    let record_size = buf.readUInt32LE(12);
+
+    if (version != TRACE_VERSION)
+        throw new Error(`Unsupported trace version ${version}`);
+
+    let names = new Map;
+    let events = [];
+    let origin = null;
+
+    for (let offset = 16; offset + record_size <= buf.length; offset += record_size) {
+        let kind = buf.readUInt8(offset);
+        let func = buf.readUInt32LE(offset + 8);
+
+        switch (kind) {
+            case TraceKind.Name: {
+                let end = buf.indexOf(0, offset + 16);
+                if (end < 0 || end > offset + record_size)
+                    end = offset + record_size;
+
+                names.set(func, buf.toString('utf8', offset + 16, end));
+            } break;
+
+            case TraceKind.Call:
+            case TraceKind.AsyncCall: {
+                let flags = buf.readUInt8(offset + 1);
+                let argc = buf.readUInt8(offset + 2);
+                let thread = buf.readUInt32LE(offset + 12);
+                let start = buf.readBigInt64LE(offset + 16);
+                let end = buf.readBigInt64LE(offset + 24);
+                let native = buf.readBigInt64LE(offset + 32);
+
+                if (origin == null)
+                    origin = start;
+
+                let args = {
+                    argc: argc,
+                    native_us: Number(native) / 1000
+                };
+                for (let i = 0; i < Math.min(argc, 2); i++) {
+                    let value = decodeValue(buf, buf.readUInt8(offset + 3 + i), offset + 40 + i * 8);
+                    if (value !== undefined)
+                        args['arg' + i] = value;
+                }
+                let ret = decodeValue(buf, buf.readUInt8(offset + 5), offset + 56);
+                if (ret !== undefined)
+                    args.ret = ret;
+                if (flags & 1)
+                    args.error = true;
+
+                events.push({
+                    name: names.get(func) ?? `#${func}`,
+                    cat: kind == TraceKind.AsyncCall ? 'async' : 'sync',
+                    ph: 'X',
+                    ts: Number(start - origin) / 1000,
+                    dur: Number(end - start) / 1000,
+                    pid: 1,
+                    tid: thread,
+                    args: args
+                });
+            } break;
+
+            case TraceKind.Dropped: {
+                let dropped = buf.readBigUInt64LE(offset + 16);
+                console.error(`Warning: ${dropped} records were dropped during tracing`);
+            } break;
+        }
+    }
+
+    return {
+        traceEvents: events,
+        displayTimeUnit: 'ns'
+    };
+}
+
+function decodeValue(buf, type, offset) {
+    switch (type) {
+        case 1: return null;
+        case 2: return !!buf.readBigUInt64LE(offset);
+        case 3: return buf.readDoubleLE(offset);
+        case 4: return buf.readBigInt64LE(offset).toString();
+        case 5: return `<string ${buf.readBigUInt64LE(offset)}>`;
+        case 6: return '0x' + buf.readBigUInt64LE(offset).toString(16);
+        case 7: return '<object>';
+
+        default: return undefined;
+    }
+}